@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2009-2011, David Eklöv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef UART_COLUMNAR_H
+#define UART_COLUMNAR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <uart/usf.h>
+
+/*
+ * Columnar sample file. Samples are stored in blocks of up to
+ * SAMPLER_COLUMNAR_BLOCK_SAMPLES samples, each block holds one stream
+ * per column. Integer columns are LEB128 varints, most of them delta
+ * coded against the previous sample in the block and zigzag mapped,
+ * so every block can be decoded on its own. The block index at the
+ * end of the file has the min/max of the interesting columns, which
+ * lets readers skip blocks without touching them. Dangling samples
+ * have a reuse time of 0. The file is meant to be mapped with mmap()
+ * and everything is stored in native byte order.
+ */
+
+#define SAMPLER_COLUMNAR_MAGIC         "USFCOLS"
+#define SAMPLER_COLUMNAR_VERSION       1
+#define SAMPLER_COLUMNAR_BLOCK_SAMPLES 65536
+
+typedef enum {
+    SAMPLER_COLUMN_BURST = 0,   /* Burst number, delta */
+    SAMPLER_COLUMN_TIME,        /* Begin time, delta */
+    SAMPLER_COLUMN_REUSE,       /* End time - begin time, plain */
+    SAMPLER_COLUMN_PC_BEGIN,    /* Begin PC, delta */
+    SAMPLER_COLUMN_PC_END,      /* End PC, delta against the begin PC */
+    SAMPLER_COLUMN_LINE,        /* Begin address >> line size, delta */
+    SAMPLER_COLUMN_TYPE,        /* One byte, begin type | end type << 4 */
+    SAMPLER_COLUMN_TID,         /* Begin and end tid, plain */
+    SAMPLER_COLUMNS
+} sampler_column_t;
+
+#define SAMPLER_COLUMN_MASK(_c) (1U << (_c))
+#define SAMPLER_COLUMN_ALL      ((1U << SAMPLER_COLUMNS) - 1)
+
+typedef struct {
+    char        magic[8];
+    uint32_t    version;
+    usf_flags_t flags;
+    uint32_t    line_size_lg2;
+    uint32_t    pad;
+    uint64_t    index_offset;   /* 0 if the file wasn't closed */
+    uint64_t    no_blocks;
+    uint64_t    no_samples;
+    uint64_t    bursts_offset;
+    uint64_t    no_bursts;
+} sampler_columnar_header_t;
+
+typedef struct {
+    uint64_t    offset;         /* Columns are stored back to back */
+    uint64_t    no_samples;
+    uint64_t    column_size[SAMPLER_COLUMNS];
+
+    uint64_t    min_burst, max_burst;
+    uint64_t    min_time,  max_time;
+    uint64_t    min_reuse, max_reuse;
+    uint64_t    min_line,  max_line;
+} sampler_columnar_block_t;
+
+typedef struct {
+    uint64_t    begin_time;
+    uint64_t    end_time;
+    double      rate;           /* Sampling rate, see sampler_rate() */
+} sampler_columnar_burst_t;
+
+/* Decoded block, one array per column */
+typedef struct {
+    size_t      no_samples;
+    uint64_t   *burst;
+    uint64_t   *time;
+    uint64_t   *reuse;
+    uint64_t   *pc_begin;
+    uint64_t   *pc_end;
+    uint64_t   *line;
+    uint8_t    *type;
+    uint16_t   *tid_begin;
+    uint16_t   *tid_end;
+} sampler_columnar_samples_t;
+
+
+typedef struct sampler_columnar sampler_columnar_t;
+
+extern int sampler_columnar_open(sampler_columnar_t **c, const char *path);
+extern int sampler_columnar_close(sampler_columnar_t *c);
+
+extern const sampler_columnar_header_t *
+sampler_columnar_header(sampler_columnar_t *c);
+
+extern const sampler_columnar_block_t *
+sampler_columnar_block(sampler_columnar_t *c, unsigned long block);
+
+extern const sampler_columnar_burst_t *
+sampler_columnar_burst(sampler_columnar_t *c, unsigned long burst);
+
+/* Raw, still encoded, column of a block */
+extern const uint8_t *
+sampler_columnar_column(sampler_columnar_t *c, unsigned long block,
+                        sampler_column_t column, size_t *size);
+
+/* Allocate arrays large enough for any block */
+extern int sampler_columnar_samples_alloc(sampler_columnar_samples_t *s);
+extern void sampler_columnar_samples_free(sampler_columnar_samples_t *s);
+
+/* Decode the columns in the mask (SAMPLER_COLUMN_MASK()) of a block,
+ * the other arrays are left alone. */
+extern int sampler_columnar_decode(sampler_columnar_t *c, unsigned long block,
+                                   unsigned columns,
+                                   sampler_columnar_samples_t *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UART_COLUMNAR_H */
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2009-2011, David Eklöv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef UART_CONTAINER_H
+#define UART_CONTAINER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <uart/usf.h>
+
+/*
+ * Sample container, all bursts of a run in one file. The file starts
+ * with a header, followed by blocks of records and ends with the
+ * burst index. Records are appended in blocks as they are produced,
+ * each block belongs to one burst and points to the previous block
+ * of the same burst. The index holds the last block of every burst,
+ * so a reader can go straight to the burst it wants. Everything is
+ * stored in native byte order.
+ */
+
+#define SAMPLER_CONTAINER_MAGIC   "USFCONT"
+#define SAMPLER_CONTAINER_VERSION 1
+
+typedef struct {
+    char        magic[8];
+    uint32_t    version;
+    usf_flags_t flags;
+    uint64_t    line_sizes;
+    uint64_t    index_offset;   /* 0 if the file wasn't closed */
+    uint64_t    no_bursts;
+} sampler_container_header_t;
+
+typedef struct {
+    uint64_t    burst;
+    uint64_t    prev;           /* Previous block in the burst, or 0 */
+    uint32_t    no_records;
+    uint32_t    pad;
+} sampler_container_block_t;
+
+typedef struct {
+    uint8_t      type;          /* USF_EVENT_SAMPLE or USF_EVENT_DANGLING */
+    uint8_t      line_size;
+    uint8_t      pad[6];
+    usf_access_t begin;
+    usf_access_t end;           /* Undefined for dangling samples */
+} sampler_container_record_t;
+
+typedef struct {
+    uint64_t    begin_time;
+    uint64_t    end_time;
+    uint64_t    no_samples;
+    uint64_t    no_dangling;
+    uint64_t    last_block;     /* Last block in the burst, or 0 */
+    uint64_t    no_blocks;
+    double      rate;           /* Sampling rate, see sampler_rate() */
+} sampler_container_burst_t;
+
+
+typedef struct sampler_container sampler_container_t;
+
+extern int sampler_container_open(sampler_container_t **c, const char *path);
+extern int sampler_container_close(sampler_container_t *c);
+
+extern const sampler_container_header_t *
+sampler_container_header(sampler_container_t *c);
+
+extern const sampler_container_burst_t *
+sampler_container_burst(sampler_container_t *c, unsigned long burst);
+
+/* Read the samples of a burst, in the order they were written, as
+ * USF sample and dangling events. The event array is allocated with
+ * malloc() and owned by the caller. */
+extern int sampler_container_read(sampler_container_t *c, unsigned long burst,
+                                  usf_event_t **events, size_t *no_events);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UART_CONTAINER_H */
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
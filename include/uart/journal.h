@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2009-2011, David Eklöv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef UART_JOURNAL_H
+#define UART_JOURNAL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <uart/usf.h>
+
+/*
+ * Sample journal. The journal is a memory mapped file with a header
+ * followed by a ring of fixed size records. Every record describes
+ * itself and carries a sequence number and a checksum, so the
+ * journal can be read back after the process died without running
+ * sampler_fini(). The commit word of a record is cleared before the
+ * record is written and set last, a record with a bad commit word or
+ * checksum is ignored. When the ring is full the oldest records are
+ * overwritten. Everything is stored in native byte order.
+ *
+ * Watchpoint records make it possible to tell which samples were
+ * still outstanding when the process died, they become dangling
+ * samples when the journal is recovered. Watchpoints the sampler
+ * dropped without a sample are closed by an unwatch record.
+ */
+
+#define SAMPLER_JOURNAL_MAGIC   "USFJRNL"
+#define SAMPLER_JOURNAL_VERSION 1
+#define SAMPLER_JOURNAL_COMMIT  0x4a524543U
+
+typedef enum {
+    SAMPLER_JOURNAL_BURST_BEGIN = 1,    /* time, rate */
+    SAMPLER_JOURNAL_BURST_END,          /* time */
+    SAMPLER_JOURNAL_WATCH,              /* begin */
+    SAMPLER_JOURNAL_SAMPLE,             /* begin, end */
+    SAMPLER_JOURNAL_DANGLING,           /* begin */
+    SAMPLER_JOURNAL_FINI,               /* Clean shutdown */
+    SAMPLER_JOURNAL_UNWATCH,            /* begin */
+} sampler_journal_type_t;
+
+typedef struct {
+    char        magic[8];
+    uint32_t    version;
+    usf_flags_t flags;
+    uint64_t    line_sizes;
+    uint64_t    records_offset; /* File offset of the first record */
+    uint64_t    record_size;    /* sizeof(sampler_journal_record_t) */
+    uint64_t    no_records;     /* Size of the ring */
+} sampler_journal_header_t;
+
+typedef struct {
+    uint32_t     commit;        /* SAMPLER_JOURNAL_COMMIT when valid */
+    uint32_t     checksum;      /* Of everything after this field */
+    uint64_t     seq;
+    uint8_t      type;
+    uint8_t      line_size;
+    uint8_t      pad[6];
+    uint64_t     burst;
+    uint64_t     time;
+    double       rate;
+    usf_access_t begin;
+    usf_access_t end;
+} sampler_journal_record_t;
+
+/* Checksum used for the records */
+static inline uint32_t
+sampler_journal_checksum(const sampler_journal_record_t *r)
+{
+    const uint8_t *p   = (const uint8_t *)&r->seq;
+    const uint8_t *end = (const uint8_t *)(r + 1);
+    uint32_t       h   = 2166136261U;
+
+    while (p < end)
+        h = (h ^ *p++) * 16777619U;
+    return h;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UART_JOURNAL_H */
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2009-2011, David Eklöv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef UART_RAWTRACE_H
+#define UART_RAWTRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <uart/usf.h>
+
+/*
+ * Raw trace. A header followed by the accesses of a trace as an array
+ * of usf_access_t, in time order. The file is meant to be mapped with
+ * mmap() and passed to the sampler without decoding, e.g. with
+ * usfsampler on a fast disk. Everything is stored in native byte order
+ * and layout. no_records is 0 until the file is complete. usfraw
+ * writes raw traces from USF traces.
+ */
+
+#define SAMPLER_RAW_MAGIC   "USFRAW"
+#define SAMPLER_RAW_VERSION 1
+/* Offset of the first record, keeps them cache line aligned */
+#define SAMPLER_RAW_RECORDS_OFFSET 64
+
+typedef struct {
+    char        magic[8];
+    uint32_t    version;
+    usf_flags_t flags;          /* Of the USF trace */
+    uint64_t    line_sizes;
+    uint64_t    records_offset; /* File offset of the first record */
+    uint64_t    record_size;    /* sizeof(usf_access_t) */
+    uint64_t    no_records;
+} sampler_raw_header_t;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UART_RAWTRACE_H */
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
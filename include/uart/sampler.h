@@ -37,9 +37,72 @@ extern "C" {
 
 #include <uart/usf.h>
 
+typedef enum {
+    SAMPLER_OUTPUT_USF = 0,     /* One USF file per burst, <base>.<burst> */
+    SAMPLER_OUTPUT_CONTAINER,   /* All bursts in <base>.usfc, see container.h */
+    SAMPLER_OUTPUT_COLUMNAR,    /* All bursts in <base>.usfx, see columnar.h */
+    SAMPLER_OUTPUT_JOURNAL,     /* Crash safe journal <base>.usfj, see journal.h */
+    SAMPLER_OUTPUT_PCPROF,      /* Per-PC reuse report <base>.pcprof */
+} sampler_output_t;
+
+typedef enum {
+    SAMPLER_TARGET_NONE = 0,
+    SAMPLER_TARGET_SAMPLES,     /* Samples per second of wall clock time */
+    SAMPLER_TARGET_WATCHPOINTS, /* Live watchpoints at the end of a burst */
+    SAMPLER_TARGET_BYTES,       /* Bytes of USF events per burst */
+} sampler_target_t;
+
+/* USF files written by the sampler have this header argument,
+ * followed by the sampling rate of the burst. */
+#define SAMPLER_RATE_ARG "sampler_rate="
+
+typedef struct sampler_sink sampler_sink_t;
+
+/*
+ * Output sink, receives the bursts and samples. Bursts are numbered
+ * from 0 in the order they begin, rate is the fraction of the
+ * accesses that were sampled during the burst, see sampler_rate().
+ * A sample belongs to the burst that set its watchpoint, which isn't
+ * necessarily the active one.
+ * burst_end, watch, unwatch, flush and discard may be NULL.
+ */
+struct sampler_sink {
+    int  (*burst_begin)(sampler_sink_t *sink, unsigned long burst,
+                        unsigned long time, double rate);
+    int  (*burst_end)(sampler_sink_t *sink, unsigned long burst,
+                      unsigned long time);
+    int  (*sample)(sampler_sink_t *sink, unsigned long burst,
+                   usf_access_t *begin, usf_access_t *end,
+                   usf_line_size_2_t line_size_lg2);
+    int  (*dangling)(sampler_sink_t *sink, unsigned long burst,
+                     usf_access_t *begin, usf_line_size_2_t line_size_lg2);
+    /* A watchpoint was set, the sample or dangling sample follows */
+    int  (*watch)(sampler_sink_t *sink, unsigned long burst,
+                  usf_access_t *begin);
+    /* A watchpoint was dropped without a sample, e.g. when the
+     * spatial threshold was lowered */
+    int  (*unwatch)(sampler_sink_t *sink, unsigned long burst,
+                    usf_access_t *begin);
+    /* Write out buffered data */
+    int  (*flush)(sampler_sink_t *sink);
+    /* Called by sampler_fini() after the dangling samples */
+    int  (*fini)(sampler_sink_t *sink);
+    /* Called by sampler_discard(), must not write anything */
+    void (*discard)(sampler_sink_t *sink);
+
+    void  *data;
+};
+
 typedef struct {
     char           *usf_base_path;
     usf_flags_t     usf_flags;
+    sampler_output_t output;
+    /* Created from output at the first burst if not set */
+    sampler_sink_t *sink;
+    /* Size of the journal in bytes, 0 for the default */
+    unsigned long   journal_size;
+    /* Number of PCs kept by the PC profile, 0 for the default */
+    unsigned        pc_table_size;
 
     void *_internal;
 
@@ -57,6 +120,58 @@ typedef struct {
     unsigned long   burst_size;
     unsigned short  line_size_lg2;
 
+    /* Spatial sampling. If spatial_rate is set, every access to a
+     * line whose hash falls in the first spatial_rate part of the hash
+     * space is sampled instead of sampling in time. If spatial_budget
+     * is set, the rate is lowered to keep at most that many
+     * watchpoints, a new burst starts every time it changes. */
+    double          spatial_rate;
+    unsigned long   spatial_budget;
+
+    /* Adaptive sampling. If target is set, sample_period is adjusted
+     * at the start of every burst to bring the target metric towards
+     * target_value, within [sample_period_min, sample_period_max]
+     * (0 for no limit). The rate of every burst is passed to the sink,
+     * see sampler_rate(). Needs burst_size, ignored in spatial mode. */
+    sampler_target_t target;
+    double          target_value;
+    unsigned long   sample_period_min;
+    unsigned long   sample_period_max;
+
+    /* Reservoir sampling. If reservoir_size is set, at most that many
+     * samples are kept, chosen uniformly over the whole run, and
+     * written as a single burst by sampler_fini(). The burst and
+     * sample periods are ignored. */
+    unsigned long   reservoir_size;
+
+    /* Phase detection. If phase_interval is set, the accesses are
+     * split into intervals of that many accesses, which are grouped
+     * into phases by the PCs they execute. A burst that would begin in
+     * a phase that already has phase_bursts (default 1) bursts is
+     * skipped. The phases and the weight of every burst are written
+     * to <base>.phases by sampler_fini(). phase_threshold is the
+     * largest signature distance within a phase, 0-2, 0 for the
+     * default. */
+    unsigned long   phase_interval;
+    double          phase_threshold;
+    unsigned        phase_bursts;
+
+    /* Stack distance estimation. If sdist_precision (4-16) is set,
+     * the number of distinct lines accessed during the reuse of every
+     * sample is estimated with HyperLogLog sketches of
+     * 2^sdist_precision registers, one per sdist_bucket accesses (0
+     * for the default). A histogram per burst is written to
+     * <base>.sdist by sampler_fini(). */
+    unsigned        sdist_precision;
+    unsigned long   sdist_bucket;
+
+    /* Sharing classification. If sharing_table_size is set, samples
+     * whose accesses come from different threads are classified as
+     * read, true or false sharing. The sharing_table_size lines and
+     * PC pairs with the most of them are written to <base>.sharing by
+     * sampler_fini(). */
+    unsigned        sharing_table_size;
+
     int             log_level;
     unsigned        seed;
 } sampler_t;
@@ -65,20 +180,69 @@ typedef struct {
 extern int sampler_init(sampler_t *s);
 extern int sampler_fini(sampler_t *s);
 
+/* Release the sampler without writing anything, e.g. in a child
+ * process that inherited the sampler from its parent. */
+extern int sampler_discard(sampler_t *s);
+
+/* Create one of the built-in sinks, configured from the sampler */
+extern sampler_sink_t *sampler_sink_create(sampler_t *s, sampler_output_t output);
+
+/* Ask the sink to write out buffered data */
+extern int sampler_flush(sampler_t *s);
+
+/* Only sample accesses to [begin, end), rounded out to whole lines.
+ * Can be called several times to add more ranges, no ranges means
+ * that everything is sampled. */
+extern int sampler_addr_range_add(sampler_t *s, usf_addr_t begin, usf_addr_t end);
+
 /* Low level API */
 extern int sampler_watchpoint_lookup(sampler_t *s, usf_access_t *ref);
 extern int sampler_watchpoint_insert(sampler_t *s, usf_access_t *ref);
+/* Non-zero if the line containing addr is watched. Unlike
+ * sampler_watchpoint_lookup() this doesn't consume the watchpoint. */
+extern int sampler_watchpoint_check(sampler_t *s, usf_addr_t addr);
 
 extern int sampler_burst_begin(sampler_t *s, unsigned long time);
 extern int sampler_burst_end(sampler_t *s, unsigned long time);
 extern int sampler_burst_active(sampler_t *s);
+/* Begin a burst at time that really began earlier, e.g. before the
+ * part of the trace this sampler sees, with sampled accesses that
+ * weren't skipped so far, see sampler_ref_skip(). The sample gaps are
+ * drawn as if the sampler had been in the burst all along. */
+extern int sampler_burst_resume(sampler_t *s, unsigned long sampled,
+                                unsigned long time);
+
+/* Non-zero if the line containing addr overlaps the address ranges,
+ * or if there are no ranges. Other accesses can't hit a watchpoint. */
+extern int sampler_addr_match(sampler_t *s, usf_addr_t addr);
 
 /* High level API */
+/* Generators for burst_rnd and sample_rnd. When used by a sampler,
+ * sampler_rnd_exp() draws from a stream of that sampler seeded from
+ * seed, so samplers don't share random state. */
 extern unsigned sampler_rnd_exp(unsigned period);
 extern unsigned sampler_rnd_const(unsigned period);
 
 extern int sampler_ref(sampler_t *s, usf_access_t *ref);
 
+/* Start sampling at time instead of at the first access, e.g. for a
+ * part of a trace. The first burst, or the first sample without
+ * bursts, is drawn as if the sampler had been running before. */
+extern void sampler_start(sampler_t *s, unsigned long time);
+
+/* Fraction of the accesses that are currently sampled */
+extern double sampler_rate(sampler_t *s);
+
+/* Account for an access at time that shouldn't be sampled, e.g.
+ * because it is outside the address ranges. The access doesn't
+ * consume a sample slot. */
+extern void sampler_ref_skip(sampler_t *s, unsigned long time);
+
+/* Time of the next access that needs the full sampler_ref()
+ * treatment. Accesses before that only need to be passed to
+ * sampler_watchpoint_lookup(). */
+extern unsigned long sampler_next_event(sampler_t *s);
+
 #ifdef __cplusplus
 }
 #endif
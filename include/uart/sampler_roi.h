@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2009-2011, Andreas Sandberg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef UART_SAMPLER_ROI_H
+#define UART_SAMPLER_ROI_H
+
+/*
+ * Region of interest markers. Call uart_sampler_roi_begin() and
+ * uart_sampler_roi_end() around the code that should be sampled and
+ * run the application under pin_sampler with -roi_marker 1. The
+ * functions don't do anything on their own, the Pin tool intercepts
+ * them by name. They are weak so that the header can be included
+ * from several translation units.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+__attribute__((weak, noinline)) void
+uart_sampler_roi_begin(void)
+{
+    __asm__ __volatile__("" ::: "memory");
+}
+
+__attribute__((weak, noinline)) void
+uart_sampler_roi_end(void)
+{
+    __asm__ __volatile__("" ::: "memory");
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UART_SAMPLER_ROI_H */
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
@@ -0,0 +1,682 @@
+/*
+ * Copyright (C) 2009-2011, David Eklöv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "columnar.h"
+
+/* Worst case encoded size of one sample in a single column */
+#define MAX_VARINT 10
+
+typedef struct {
+    sampler_sink_t              sink;
+    FILE                       *file;
+    sampler_columnar_header_t   header;
+    uint64_t                    offset;
+    usf_atime_t                 last_time;
+
+    /* Samples in the current block */
+    sampler_columnar_samples_t  block;
+    uint8_t                    *buf;
+
+    sampler_columnar_block_t   *blocks;
+    unsigned long               max_blocks;
+
+    sampler_columnar_burst_t   *bursts;
+    int                        *burst_active;
+    unsigned long               max_bursts;
+} columnar_t;
+
+
+static inline uint64_t
+zigzag(uint64_t v)
+{
+    return (v << 1) ^ (uint64_t)((int64_t)v >> 63);
+}
+
+static inline uint64_t
+unzigzag(uint64_t v)
+{
+    return (v >> 1) ^ -(v & 1);
+}
+
+static inline uint8_t *
+put_varint(uint8_t *p, uint64_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static inline const uint8_t *
+get_varint(const uint8_t *p, const uint8_t *end, uint64_t *v)
+{
+    uint64_t r = 0;
+
+    for (unsigned shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t b = *p++;
+
+        r |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *v = r;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static uint8_t *
+encode_delta(uint8_t *p, const uint64_t *v, size_t n)
+{
+    uint64_t prev = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        p = put_varint(p, zigzag(v[i] - prev));
+        prev = v[i];
+    }
+    return p;
+}
+
+static uint8_t *
+encode_plain(uint8_t *p, const uint64_t *v, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        p = put_varint(p, v[i]);
+    return p;
+}
+
+static int
+decode_delta(const uint8_t *p, const uint8_t *end, uint64_t *v, size_t n)
+{
+    uint64_t prev = 0, d;
+
+    for (size_t i = 0; i < n; i++) {
+        if (!(p = get_varint(p, end, &d)))
+            return -1;
+        v[i] = prev += unzigzag(d);
+    }
+    return 0;
+}
+
+static int
+decode_plain(const uint8_t *p, const uint8_t *end, uint64_t *v, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (!(p = get_varint(p, end, &v[i])))
+            return -1;
+    }
+    return 0;
+}
+
+static uint8_t *
+column_encode(uint8_t *p, const sampler_columnar_samples_t *s,
+              sampler_column_t column)
+{
+    size_t n = s->no_samples;
+
+    switch (column) {
+    case SAMPLER_COLUMN_BURST:
+        return encode_delta(p, s->burst, n);
+    case SAMPLER_COLUMN_TIME:
+        return encode_delta(p, s->time, n);
+    case SAMPLER_COLUMN_REUSE:
+        return encode_plain(p, s->reuse, n);
+    case SAMPLER_COLUMN_PC_BEGIN:
+        return encode_delta(p, s->pc_begin, n);
+    case SAMPLER_COLUMN_PC_END:
+        for (size_t i = 0; i < n; i++)
+            p = put_varint(p, zigzag(s->pc_end[i] - s->pc_begin[i]));
+        return p;
+    case SAMPLER_COLUMN_LINE:
+        return encode_delta(p, s->line, n);
+    case SAMPLER_COLUMN_TYPE:
+        memcpy(p, s->type, n);
+        return p + n;
+    case SAMPLER_COLUMN_TID:
+        for (size_t i = 0; i < n; i++) {
+            p = put_varint(p, s->tid_begin[i]);
+            p = put_varint(p, s->tid_end[i]);
+        }
+        return p;
+    default:
+        return p;
+    }
+}
+
+static int
+column_decode(const uint8_t *p, const uint8_t *end,
+              sampler_columnar_samples_t *s, sampler_column_t column)
+{
+    size_t   n = s->no_samples;
+    uint64_t v;
+
+    switch (column) {
+    case SAMPLER_COLUMN_BURST:
+        return decode_delta(p, end, s->burst, n);
+    case SAMPLER_COLUMN_TIME:
+        return decode_delta(p, end, s->time, n);
+    case SAMPLER_COLUMN_REUSE:
+        return decode_plain(p, end, s->reuse, n);
+    case SAMPLER_COLUMN_PC_BEGIN:
+        return decode_delta(p, end, s->pc_begin, n);
+    case SAMPLER_COLUMN_PC_END:
+        /* Needs the begin PCs, they are decoded first */
+        for (size_t i = 0; i < n; i++) {
+            if (!(p = get_varint(p, end, &v)))
+                return -1;
+            s->pc_end[i] = s->pc_begin[i] + unzigzag(v);
+        }
+        return 0;
+    case SAMPLER_COLUMN_LINE:
+        return decode_delta(p, end, s->line, n);
+    case SAMPLER_COLUMN_TYPE:
+        if (end - p < n)
+            return -1;
+        memcpy(s->type, p, n);
+        return 0;
+    case SAMPLER_COLUMN_TID:
+        for (size_t i = 0; i < n; i++) {
+            if (!(p = get_varint(p, end, &v)))
+                return -1;
+            s->tid_begin[i] = v;
+            if (!(p = get_varint(p, end, &v)))
+                return -1;
+            s->tid_end[i] = v;
+        }
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+#define MINMAX(_b, _f, _v) do {                 \
+        if ((_v) < (_b)->min_##_f)              \
+            (_b)->min_##_f = (_v);              \
+        if ((_v) > (_b)->max_##_f)              \
+            (_b)->max_##_f = (_v);              \
+    } while (0)
+
+static int
+block_flush(columnar_t *c)
+{
+    sampler_columnar_samples_t *s = &c->block;
+    sampler_columnar_block_t   *b;
+    size_t                      n = s->no_samples;
+
+    if (!n)
+        return 0;
+
+    if (c->header.no_blocks == c->max_blocks) {
+        unsigned long max = c->max_blocks ? 2 * c->max_blocks : 64;
+
+        b = realloc(c->blocks, max * sizeof(sampler_columnar_block_t));
+        if (!b)
+            return -1;
+        c->blocks = b;
+        c->max_blocks = max;
+    }
+
+    b = &c->blocks[c->header.no_blocks];
+    bzero(b, sizeof(*b));
+    b->offset = c->offset;
+    b->no_samples = n;
+
+    b->min_burst = b->max_burst = s->burst[0];
+    b->min_time  = b->max_time  = s->time[0];
+    b->min_reuse = b->max_reuse = s->reuse[0];
+    b->min_line  = b->max_line  = s->line[0];
+    for (size_t i = 1; i < n; i++) {
+        MINMAX(b, burst, s->burst[i]);
+        MINMAX(b, time, s->time[i]);
+        MINMAX(b, reuse, s->reuse[i]);
+        MINMAX(b, line, s->line[i]);
+    }
+
+    for (int i = 0; i < SAMPLER_COLUMNS; i++) {
+        size_t size = column_encode(c->buf, s, i) - c->buf;
+
+        if (fwrite(c->buf, 1, size, c->file) != size)
+            return -1;
+        b->column_size[i] = size;
+        c->offset += size;
+    }
+
+    c->header.no_blocks++;
+    c->header.no_samples += n;
+    s->no_samples = 0;
+    return 0;
+}
+
+static int
+sample_add(columnar_t *c, unsigned long burst,
+           usf_access_t *begin, usf_access_t *end)
+{
+    sampler_columnar_samples_t *s = &c->block;
+    size_t                      i = s->no_samples++;
+
+    s->burst[i] = burst;
+    s->time[i] = begin->time;
+    s->pc_begin[i] = begin->pc;
+    s->line[i] = begin->addr >> c->header.line_size_lg2;
+    s->tid_begin[i] = begin->tid;
+    if (end) {
+        s->reuse[i] = end->time - begin->time;
+        s->pc_end[i] = end->pc;
+        s->type[i] = (begin->type & 0xf) | (end->type << 4);
+        s->tid_end[i] = end->tid;
+        if (end->time > c->last_time)
+            c->last_time = end->time;
+    } else {
+        s->reuse[i] = 0;
+        s->pc_end[i] = begin->pc;
+        s->type[i] = begin->type & 0xf;
+        s->tid_end[i] = begin->tid;
+    }
+
+    if (s->no_samples == SAMPLER_COLUMNAR_BLOCK_SAMPLES)
+        return block_flush(c);
+    return 0;
+}
+
+static void
+columnar_free(columnar_t *c)
+{
+    sampler_columnar_samples_free(&c->block);
+    free(c->buf);
+    free(c->blocks);
+    free(c->bursts);
+    free(c->burst_active);
+    free(c);
+}
+
+static int
+sink_burst_begin(sampler_sink_t *sink, unsigned long burst,
+                 unsigned long time, double rate)
+{
+    columnar_t *c = (columnar_t *)sink;
+
+    if (burst >= c->max_bursts) {
+        unsigned long max = c->max_bursts ? 2 * c->max_bursts : 64;
+        sampler_columnar_burst_t *bursts;
+        int *active;
+
+        while (max <= burst)
+            max *= 2;
+
+        bursts = realloc(c->bursts, max * sizeof(sampler_columnar_burst_t));
+        if (!bursts)
+            return -1;
+        c->bursts = bursts;
+
+        active = realloc(c->burst_active, max * sizeof(int));
+        if (!active)
+            return -1;
+        c->burst_active = active;
+        c->max_bursts = max;
+    }
+
+    for (; c->header.no_bursts <= burst; c->header.no_bursts++) {
+        bzero(&c->bursts[c->header.no_bursts], sizeof(sampler_columnar_burst_t));
+        c->burst_active[c->header.no_bursts] = 0;
+    }
+
+    c->bursts[burst].begin_time = time;
+    c->bursts[burst].rate = rate;
+    c->burst_active[burst] = 1;
+    return 0;
+}
+
+static int
+sink_burst_end(sampler_sink_t *sink, unsigned long burst, unsigned long time)
+{
+    columnar_t *c = (columnar_t *)sink;
+
+    if (burst >= c->header.no_bursts)
+        return -1;
+
+    c->bursts[burst].end_time = time;
+    c->burst_active[burst] = 0;
+    return 0;
+}
+
+static int
+sink_sample(sampler_sink_t *sink, unsigned long burst,
+            usf_access_t *begin, usf_access_t *end,
+            usf_line_size_2_t line_size_lg2)
+{
+    return sample_add((columnar_t *)sink, burst, begin, end);
+}
+
+static int
+sink_dangling(sampler_sink_t *sink, unsigned long burst,
+              usf_access_t *begin, usf_line_size_2_t line_size_lg2)
+{
+    return sample_add((columnar_t *)sink, burst, begin, NULL);
+}
+
+static int
+sink_flush(sampler_sink_t *sink)
+{
+    columnar_t *c = (columnar_t *)sink;
+
+    /* Blocks are only indexed on close, so only the stdio buffer is
+     * written here. */
+    return fflush(c->file) ? -1 : 0;
+}
+
+static int
+sink_fini(sampler_sink_t *sink)
+{
+    columnar_t *c = (columnar_t *)sink;
+    unsigned long no_blocks, no_bursts;
+    int err = 0;
+
+    err |= block_flush(c);
+
+    /* Bursts that were still running end with the last sample */
+    no_bursts = c->header.no_bursts;
+    for (unsigned long i = 0; i < no_bursts; i++) {
+        if (c->burst_active[i])
+            c->bursts[i].end_time = c->last_time > c->bursts[i].begin_time ?
+                c->last_time : c->bursts[i].begin_time;
+    }
+
+    no_blocks = c->header.no_blocks;
+    c->header.index_offset = c->offset;
+    c->header.bursts_offset = c->offset +
+        no_blocks * sizeof(sampler_columnar_block_t);
+
+    if (fwrite(c->blocks, sizeof(sampler_columnar_block_t), no_blocks,
+               c->file) != no_blocks ||
+        fwrite(c->bursts, sizeof(sampler_columnar_burst_t), no_bursts,
+               c->file) != no_bursts ||
+        fseeko(c->file, 0, SEEK_SET) ||
+        fwrite(&c->header, sizeof(c->header), 1, c->file) != 1)
+        err = -1;
+    if (fclose(c->file))
+        err = -1;
+
+    columnar_free(c);
+    return err ? -1 : 0;
+}
+
+static void
+sink_discard(sampler_sink_t *sink)
+{
+    columnar_free((columnar_t *)sink);
+}
+
+sampler_sink_t *
+uart_sampler_columnar_sink_new(const char *path, usf_flags_t flags,
+                               unsigned line_size_lg2)
+{
+    columnar_t *c;
+
+    c = malloc(sizeof(columnar_t));
+    if (!c)
+        return NULL;
+    bzero(c, sizeof(columnar_t));
+
+    memcpy(c->header.magic, SAMPLER_COLUMNAR_MAGIC,
+           sizeof(SAMPLER_COLUMNAR_MAGIC));
+    c->header.version = SAMPLER_COLUMNAR_VERSION;
+    c->header.flags = flags;
+    c->header.line_size_lg2 = line_size_lg2;
+
+    c->buf = malloc(SAMPLER_COLUMNAR_BLOCK_SAMPLES * MAX_VARINT);
+    if (!c->buf || sampler_columnar_samples_alloc(&c->block)) {
+        columnar_free(c);
+        return NULL;
+    }
+
+    c->file = fopen(path, "wb");
+    if (!c->file) {
+        columnar_free(c);
+        return NULL;
+    }
+
+    /* The header is written again with the index offset on close */
+    if (fwrite(&c->header, sizeof(c->header), 1, c->file) != 1) {
+        fclose(c->file);
+        columnar_free(c);
+        return NULL;
+    }
+    c->offset = sizeof(c->header);
+
+    c->sink.burst_begin = sink_burst_begin;
+    c->sink.burst_end = sink_burst_end;
+    c->sink.sample = sink_sample;
+    c->sink.dangling = sink_dangling;
+    c->sink.flush = sink_flush;
+    c->sink.fini = sink_fini;
+    c->sink.discard = sink_discard;
+    return &c->sink;
+}
+
+
+/*
+ * Reader
+ */
+
+struct sampler_columnar {
+    const uint8_t                    *base;
+    size_t                            size;
+    const sampler_columnar_header_t  *header;
+    const sampler_columnar_block_t   *blocks;
+    const sampler_columnar_burst_t   *bursts;
+};
+
+int
+sampler_columnar_open(sampler_columnar_t **c, const char *path)
+{
+    sampler_columnar_t              *col;
+    const sampler_columnar_header_t *h;
+    struct stat                      st;
+    void                            *base;
+    int                              fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return -1;
+
+    if (fstat(fd, &st) || st.st_size < sizeof(sampler_columnar_header_t)) {
+        close(fd);
+        return -1;
+    }
+
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return -1;
+
+    h = base;
+    if (memcmp(h->magic, SAMPLER_COLUMNAR_MAGIC,
+               sizeof(SAMPLER_COLUMNAR_MAGIC)) ||
+        h->version != SAMPLER_COLUMNAR_VERSION ||
+        !h->index_offset ||
+        h->index_offset + h->no_blocks * sizeof(sampler_columnar_block_t) >
+        st.st_size ||
+        h->bursts_offset + h->no_bursts * sizeof(sampler_columnar_burst_t) >
+        st.st_size)
+        goto err;
+
+    col = malloc(sizeof(sampler_columnar_t));
+    if (!col)
+        goto err;
+
+    col->base = base;
+    col->size = st.st_size;
+    col->header = h;
+    col->blocks = (const void *)(col->base + h->index_offset);
+    col->bursts = (const void *)(col->base + h->bursts_offset);
+
+    *c = col;
+    return 0;
+
+err:
+    munmap(base, st.st_size);
+    return -1;
+}
+
+int
+sampler_columnar_close(sampler_columnar_t *c)
+{
+    int err;
+
+    err = munmap((void *)c->base, c->size);
+    free(c);
+    return err ? -1 : 0;
+}
+
+const sampler_columnar_header_t *
+sampler_columnar_header(sampler_columnar_t *c)
+{
+    return c->header;
+}
+
+const sampler_columnar_block_t *
+sampler_columnar_block(sampler_columnar_t *c, unsigned long block)
+{
+    return block < c->header->no_blocks ? &c->blocks[block] : NULL;
+}
+
+const sampler_columnar_burst_t *
+sampler_columnar_burst(sampler_columnar_t *c, unsigned long burst)
+{
+    return burst < c->header->no_bursts ? &c->bursts[burst] : NULL;
+}
+
+const uint8_t *
+sampler_columnar_column(sampler_columnar_t *c, unsigned long block,
+                        sampler_column_t column, size_t *size)
+{
+    const sampler_columnar_block_t *b = sampler_columnar_block(c, block);
+    uint64_t                        offset;
+
+    if (!b || column >= SAMPLER_COLUMNS)
+        return NULL;
+
+    offset = b->offset;
+    for (int i = 0; i < column; i++)
+        offset += b->column_size[i];
+
+    if (offset + b->column_size[column] > c->size)
+        return NULL;
+
+    *size = b->column_size[column];
+    return c->base + offset;
+}
+
+int
+sampler_columnar_samples_alloc(sampler_columnar_samples_t *s)
+{
+    const size_t n = SAMPLER_COLUMNAR_BLOCK_SAMPLES;
+
+    bzero(s, sizeof(*s));
+    s->burst = malloc(n * sizeof(uint64_t));
+    s->time = malloc(n * sizeof(uint64_t));
+    s->reuse = malloc(n * sizeof(uint64_t));
+    s->pc_begin = malloc(n * sizeof(uint64_t));
+    s->pc_end = malloc(n * sizeof(uint64_t));
+    s->line = malloc(n * sizeof(uint64_t));
+    s->type = malloc(n * sizeof(uint8_t));
+    s->tid_begin = malloc(n * sizeof(uint16_t));
+    s->tid_end = malloc(n * sizeof(uint16_t));
+
+    if (!s->burst || !s->time || !s->reuse || !s->pc_begin || !s->pc_end ||
+        !s->line || !s->type || !s->tid_begin || !s->tid_end) {
+        sampler_columnar_samples_free(s);
+        return -1;
+    }
+    return 0;
+}
+
+void
+sampler_columnar_samples_free(sampler_columnar_samples_t *s)
+{
+    free(s->burst);
+    free(s->time);
+    free(s->reuse);
+    free(s->pc_begin);
+    free(s->pc_end);
+    free(s->line);
+    free(s->type);
+    free(s->tid_begin);
+    free(s->tid_end);
+    bzero(s, sizeof(*s));
+}
+
+int
+sampler_columnar_decode(sampler_columnar_t *c, unsigned long block,
+                        unsigned columns, sampler_columnar_samples_t *s)
+{
+    const sampler_columnar_block_t *b = sampler_columnar_block(c, block);
+
+    if (!b || b->no_samples > SAMPLER_COLUMNAR_BLOCK_SAMPLES)
+        return -1;
+    s->no_samples = b->no_samples;
+
+    /* The end PCs are stored relative to the begin PCs */
+    if (columns & SAMPLER_COLUMN_MASK(SAMPLER_COLUMN_PC_END))
+        columns |= SAMPLER_COLUMN_MASK(SAMPLER_COLUMN_PC_BEGIN);
+
+    for (int i = 0; i < SAMPLER_COLUMNS; i++) {
+        const uint8_t *p;
+        size_t         size;
+
+        if (!(columns & SAMPLER_COLUMN_MASK(i)))
+            continue;
+
+        p = sampler_columnar_column(c, block, i, &size);
+        if (!p || column_decode(p, p + size, s, i))
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
@@ -0,0 +1,472 @@
+/*
+ * Copyright (C) 2009-2011, David Eklöv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/types.h>
+
+#include "container.h"
+
+/* Records buffered per burst before they are written as a block */
+#define BLOCK_RECORDS 1024
+/* Write everything when this many records are buffered in total */
+#define MAX_PENDING   (64 * 1024)
+
+typedef struct {
+    sampler_container_burst_t   info;
+    int                         active;
+    sampler_container_record_t *pending;
+    uint32_t                    no_pending;
+} container_burst_t;
+
+typedef struct {
+    sampler_sink_t              sink;
+    FILE                       *file;
+    sampler_container_header_t  header;
+    uint64_t                    offset;
+    usf_atime_t                 last_time;
+
+    container_burst_t          *bursts;
+    unsigned long               no_bursts;
+    unsigned long               max_bursts;
+    unsigned long               no_pending;
+} container_t;
+
+
+static int
+block_flush(container_t *c, unsigned long idx)
+{
+    container_burst_t         *b = &c->bursts[idx];
+    sampler_container_block_t  block;
+
+    if (!b->no_pending)
+        return 0;
+
+    bzero(&block, sizeof(block));
+    block.burst = idx;
+    block.prev = b->info.last_block;
+    block.no_records = b->no_pending;
+
+    if (fwrite(&block, sizeof(block), 1, c->file) != 1 ||
+        fwrite(b->pending, sizeof(sampler_container_record_t),
+               b->no_pending, c->file) != b->no_pending)
+        return -1;
+
+    b->info.last_block = c->offset;
+    b->info.no_blocks++;
+    c->offset += sizeof(block) +
+        b->no_pending * sizeof(sampler_container_record_t);
+
+    c->no_pending -= b->no_pending;
+    b->no_pending = 0;
+    /* Most bursts only produce a few blocks, don't keep the buffer */
+    free(b->pending);
+    b->pending = NULL;
+    return 0;
+}
+
+static int
+block_flush_all(container_t *c)
+{
+    for (unsigned long i = 0; i < c->no_bursts; i++) {
+        if (block_flush(c, i))
+            return -1;
+    }
+    return 0;
+}
+
+static int
+record_add(container_t *c, unsigned long idx, uint8_t type,
+           usf_access_t *begin, usf_access_t *end,
+           usf_line_size_2_t line_size)
+{
+    container_burst_t          *b;
+    sampler_container_record_t *r;
+
+    if (idx >= c->no_bursts)
+        return -1;
+    b = &c->bursts[idx];
+
+    if (!b->pending) {
+        b->pending = malloc(BLOCK_RECORDS * sizeof(sampler_container_record_t));
+        if (!b->pending)
+            return -1;
+    }
+
+    r = &b->pending[b->no_pending++];
+    bzero(r, sizeof(*r));
+    r->type = type;
+    r->line_size = line_size;
+    r->begin = *begin;
+    if (end) {
+        r->end = *end;
+        if (end->time > c->last_time)
+            c->last_time = end->time;
+    }
+    c->no_pending++;
+
+    if (b->no_pending == BLOCK_RECORDS)
+        return block_flush(c, idx);
+    else if (c->no_pending >= MAX_PENDING)
+        return block_flush_all(c);
+    return 0;
+}
+
+static void
+container_free(container_t *c)
+{
+    for (unsigned long i = 0; i < c->no_bursts; i++)
+        free(c->bursts[i].pending);
+    free(c->bursts);
+    free(c);
+}
+
+static int
+sink_burst_begin(sampler_sink_t *sink, unsigned long burst,
+                 unsigned long time, double rate)
+{
+    container_t       *c = (container_t *)sink;
+    container_burst_t *b;
+
+    if (burst >= c->max_bursts) {
+        unsigned long max = c->max_bursts ? 2 * c->max_bursts : 64;
+
+        while (max <= burst)
+            max *= 2;
+
+        b = realloc(c->bursts, max * sizeof(container_burst_t));
+        if (!b)
+            return -1;
+        c->bursts = b;
+        c->max_bursts = max;
+    }
+
+    /* Bursts are normally numbered without gaps, but keep the index
+     * consistent if they aren't. */
+    for (; c->no_bursts <= burst; c->no_bursts++)
+        bzero(&c->bursts[c->no_bursts], sizeof(container_burst_t));
+
+    b = &c->bursts[burst];
+    b->info.begin_time = time;
+    b->info.rate = rate;
+    b->active = 1;
+    return 0;
+}
+
+static int
+sink_burst_end(sampler_sink_t *sink, unsigned long burst, unsigned long time)
+{
+    container_t *c = (container_t *)sink;
+
+    if (burst >= c->no_bursts)
+        return -1;
+
+    c->bursts[burst].info.end_time = time;
+    c->bursts[burst].active = 0;
+    return 0;
+}
+
+static int
+sink_sample(sampler_sink_t *sink, unsigned long burst,
+            usf_access_t *begin, usf_access_t *end,
+            usf_line_size_2_t line_size_lg2)
+{
+    container_t *c = (container_t *)sink;
+
+    if (record_add(c, burst, USF_EVENT_SAMPLE, begin, end, line_size_lg2))
+        return -1;
+    c->bursts[burst].info.no_samples++;
+    return 0;
+}
+
+static int
+sink_dangling(sampler_sink_t *sink, unsigned long burst,
+              usf_access_t *begin, usf_line_size_2_t line_size_lg2)
+{
+    container_t *c = (container_t *)sink;
+
+    if (record_add(c, burst, USF_EVENT_DANGLING, begin, NULL, line_size_lg2))
+        return -1;
+    c->bursts[burst].info.no_dangling++;
+    return 0;
+}
+
+static int
+sink_flush(sampler_sink_t *sink)
+{
+    container_t *c = (container_t *)sink;
+
+    if (block_flush_all(c) || fflush(c->file))
+        return -1;
+    return 0;
+}
+
+static int
+sink_fini(sampler_sink_t *sink)
+{
+    container_t *c = (container_t *)sink;
+    int err = 0;
+
+    err |= block_flush_all(c);
+
+    c->header.index_offset = c->offset;
+    c->header.no_bursts = c->no_bursts;
+    for (unsigned long i = 0; i < c->no_bursts; i++) {
+        container_burst_t *b = &c->bursts[i];
+
+        /* Bursts that were still running end with the last sample */
+        if (b->active)
+            b->info.end_time = c->last_time > b->info.begin_time ?
+                c->last_time : b->info.begin_time;
+
+        if (fwrite(&b->info, sizeof(b->info), 1, c->file) != 1)
+            err = -1;
+    }
+
+    if (fseeko(c->file, 0, SEEK_SET) ||
+        fwrite(&c->header, sizeof(c->header), 1, c->file) != 1)
+        err = -1;
+    if (fclose(c->file))
+        err = -1;
+
+    container_free(c);
+    return err ? -1 : 0;
+}
+
+static void
+sink_discard(sampler_sink_t *sink)
+{
+    container_free((container_t *)sink);
+}
+
+sampler_sink_t *
+uart_sampler_container_sink_new(const char *path, usf_flags_t flags,
+                                usf_line_sizes_t line_sizes)
+{
+    container_t *c;
+
+    c = malloc(sizeof(container_t));
+    if (!c)
+        return NULL;
+    bzero(c, sizeof(container_t));
+
+    memcpy(c->header.magic, SAMPLER_CONTAINER_MAGIC,
+           sizeof(SAMPLER_CONTAINER_MAGIC));
+    c->header.version = SAMPLER_CONTAINER_VERSION;
+    c->header.flags = flags;
+    c->header.line_sizes = line_sizes;
+
+    c->file = fopen(path, "wb");
+    if (!c->file) {
+        free(c);
+        return NULL;
+    }
+
+    /* The header is written again with the index offset on close */
+    if (fwrite(&c->header, sizeof(c->header), 1, c->file) != 1) {
+        fclose(c->file);
+        free(c);
+        return NULL;
+    }
+    c->offset = sizeof(c->header);
+
+    c->sink.burst_begin = sink_burst_begin;
+    c->sink.burst_end = sink_burst_end;
+    c->sink.sample = sink_sample;
+    c->sink.dangling = sink_dangling;
+    c->sink.flush = sink_flush;
+    c->sink.fini = sink_fini;
+    c->sink.discard = sink_discard;
+    return &c->sink;
+}
+
+
+/*
+ * Reader
+ */
+
+struct sampler_container {
+    FILE                       *file;
+    sampler_container_header_t  header;
+    sampler_container_burst_t  *bursts;
+};
+
+int
+sampler_container_open(sampler_container_t **c, const char *path)
+{
+    sampler_container_t *cont;
+    size_t               no_bursts;
+
+    cont = malloc(sizeof(sampler_container_t));
+    if (!cont)
+        return -1;
+    bzero(cont, sizeof(sampler_container_t));
+
+    cont->file = fopen(path, "rb");
+    if (!cont->file)
+        goto err;
+
+    if (fread(&cont->header, sizeof(cont->header), 1, cont->file) != 1 ||
+        memcmp(cont->header.magic, SAMPLER_CONTAINER_MAGIC,
+               sizeof(SAMPLER_CONTAINER_MAGIC)) ||
+        cont->header.version != SAMPLER_CONTAINER_VERSION ||
+        !cont->header.index_offset)
+        goto err;
+
+    no_bursts = cont->header.no_bursts;
+    if (no_bursts) {
+        cont->bursts = malloc(no_bursts * sizeof(sampler_container_burst_t));
+        if (!cont->bursts ||
+            fseeko(cont->file, cont->header.index_offset, SEEK_SET) ||
+            fread(cont->bursts, sizeof(sampler_container_burst_t),
+                  no_bursts, cont->file) != no_bursts)
+            goto err;
+    }
+
+    *c = cont;
+    return 0;
+
+err:
+    if (cont->file)
+        fclose(cont->file);
+    free(cont->bursts);
+    free(cont);
+    return -1;
+}
+
+int
+sampler_container_close(sampler_container_t *c)
+{
+    int err;
+
+    err = fclose(c->file);
+    free(c->bursts);
+    free(c);
+    return err ? -1 : 0;
+}
+
+const sampler_container_header_t *
+sampler_container_header(sampler_container_t *c)
+{
+    return &c->header;
+}
+
+const sampler_container_burst_t *
+sampler_container_burst(sampler_container_t *c, unsigned long burst)
+{
+    return burst < c->header.no_bursts ? &c->bursts[burst] : NULL;
+}
+
+int
+sampler_container_read(sampler_container_t *c, unsigned long burst,
+                       usf_event_t **events, size_t *no_events)
+{
+    const sampler_container_burst_t *b;
+    sampler_container_block_t        block;
+    sampler_container_record_t      *records = NULL;
+    uint64_t                        *blocks  = NULL;
+    usf_event_t                     *ev      = NULL;
+    size_t                           n = 0, max;
+    uint64_t                         offset;
+
+    b = sampler_container_burst(c, burst);
+    if (!b)
+        return -1;
+
+    max = b->no_samples + b->no_dangling;
+    ev = malloc((max ? max : 1) * sizeof(usf_event_t));
+    blocks = malloc((b->no_blocks ? b->no_blocks : 1) * sizeof(uint64_t));
+    records = malloc(BLOCK_RECORDS * sizeof(sampler_container_record_t));
+    if (!ev || !blocks || !records)
+        goto err;
+
+    /* The blocks are chained backwards, collect them first so that
+     * the events are returned in the order they were written. */
+    offset = b->last_block;
+    for (uint64_t i = b->no_blocks; i > 0; i--) {
+        if (!offset)
+            goto err;
+        blocks[i - 1] = offset;
+
+        if (fseeko(c->file, offset, SEEK_SET) ||
+            fread(&block, sizeof(block), 1, c->file) != 1 ||
+            block.burst != burst)
+            goto err;
+        offset = block.prev;
+    }
+
+    for (uint64_t i = 0; i < b->no_blocks; i++) {
+        if (fseeko(c->file, blocks[i], SEEK_SET) ||
+            fread(&block, sizeof(block), 1, c->file) != 1 ||
+            block.no_records > BLOCK_RECORDS ||
+            n + block.no_records > max ||
+            fread(records, sizeof(sampler_container_record_t),
+                  block.no_records, c->file) != block.no_records)
+            goto err;
+
+        for (uint32_t j = 0; j < block.no_records; j++) {
+            sampler_container_record_t *r = &records[j];
+            usf_event_t                *e = &ev[n++];
+
+            e->type = r->type;
+            if (r->type == USF_EVENT_SAMPLE) {
+                e->u.sample.begin = r->begin;
+                e->u.sample.end = r->end;
+                e->u.sample.line_size = r->line_size;
+            } else {
+                e->u.dangling.begin = r->begin;
+                e->u.dangling.line_size = r->line_size;
+            }
+        }
+    }
+
+    free(records);
+    free(blocks);
+    *events = ev;
+    *no_events = n;
+    return 0;
+
+err:
+    free(records);
+    free(blocks);
+    free(ev);
+    return -1;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
@@ -0,0 +1,252 @@
+/*
+ * Copyright (C) 2009-2011, David Eklöv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include "journal.h"
+
+#define DEFAULT_SIZE   (64UL << 20)
+/* Offset of the first record */
+#define RECORDS_OFFSET 4096
+
+typedef struct {
+    sampler_sink_t            sink;
+    uint8_t                  *base;
+    size_t                    size;
+    sampler_journal_header_t *header;
+    sampler_journal_record_t *records;
+    uint64_t                  no_records;
+    uint64_t                  seq;
+} journal_t;
+
+static sampler_journal_record_t *
+record_begin(journal_t *j, sampler_journal_type_t type, unsigned long burst,
+             unsigned long time, usf_access_t *begin, usf_access_t *end,
+             usf_line_size_2_t line_size)
+{
+    sampler_journal_record_t *r = &j->records[j->seq % j->no_records];
+
+    /* Invalidate the old record before touching it and only commit
+     * the new one when everything else is in place. */
+    r->commit = 0;
+    __sync_synchronize();
+
+    bzero(&r->seq, sizeof(*r) - offsetof(sampler_journal_record_t, seq));
+    r->seq = j->seq++;
+    r->type = type;
+    r->line_size = line_size;
+    r->burst = burst;
+    r->time = time;
+    if (begin)
+        r->begin = *begin;
+    if (end)
+        r->end = *end;
+    return r;
+}
+
+static void
+record_commit(sampler_journal_record_t *r)
+{
+    r->checksum = sampler_journal_checksum(r);
+
+    __sync_synchronize();
+    r->commit = SAMPLER_JOURNAL_COMMIT;
+}
+
+static void
+record_append(journal_t *j, sampler_journal_type_t type, unsigned long burst,
+              unsigned long time, usf_access_t *begin, usf_access_t *end,
+              usf_line_size_2_t line_size)
+{
+    record_commit(record_begin(j, type, burst, time, begin, end, line_size));
+}
+
+static int
+sink_burst_begin(sampler_sink_t *sink, unsigned long burst,
+                 unsigned long time, double rate)
+{
+    sampler_journal_record_t *r;
+
+    r = record_begin((journal_t *)sink, SAMPLER_JOURNAL_BURST_BEGIN, burst,
+                     time, NULL, NULL, 0);
+    r->rate = rate;
+    record_commit(r);
+    return 0;
+}
+
+static int
+sink_burst_end(sampler_sink_t *sink, unsigned long burst, unsigned long time)
+{
+    record_append((journal_t *)sink, SAMPLER_JOURNAL_BURST_END, burst,
+                  time, NULL, NULL, 0);
+    return 0;
+}
+
+static int
+sink_watch(sampler_sink_t *sink, unsigned long burst, usf_access_t *begin)
+{
+    record_append((journal_t *)sink, SAMPLER_JOURNAL_WATCH, burst,
+                  begin->time, begin, NULL, 0);
+    return 0;
+}
+
+static int
+sink_unwatch(sampler_sink_t *sink, unsigned long burst, usf_access_t *begin)
+{
+    record_append((journal_t *)sink, SAMPLER_JOURNAL_UNWATCH, burst,
+                  begin->time, begin, NULL, 0);
+    return 0;
+}
+
+static int
+sink_sample(sampler_sink_t *sink, unsigned long burst,
+            usf_access_t *begin, usf_access_t *end,
+            usf_line_size_2_t line_size_lg2)
+{
+    record_append((journal_t *)sink, SAMPLER_JOURNAL_SAMPLE, burst,
+                  end->time, begin, end, line_size_lg2);
+    return 0;
+}
+
+static int
+sink_dangling(sampler_sink_t *sink, unsigned long burst,
+              usf_access_t *begin, usf_line_size_2_t line_size_lg2)
+{
+    record_append((journal_t *)sink, SAMPLER_JOURNAL_DANGLING, burst,
+                  begin->time, begin, NULL, line_size_lg2);
+    return 0;
+}
+
+static int
+sink_flush(sampler_sink_t *sink)
+{
+    journal_t *j = (journal_t *)sink;
+
+    return msync(j->base, j->size, MS_ASYNC) ? -1 : 0;
+}
+
+static void
+sink_discard(sampler_sink_t *sink)
+{
+    journal_t *j = (journal_t *)sink;
+
+    munmap(j->base, j->size);
+    free(j);
+}
+
+static int
+sink_fini(sampler_sink_t *sink)
+{
+    journal_t *j = (journal_t *)sink;
+    int err;
+
+    record_append(j, SAMPLER_JOURNAL_FINI, 0, 0, NULL, NULL, 0);
+    err = msync(j->base, j->size, MS_SYNC);
+
+    sink_discard(sink);
+    return err ? -1 : 0;
+}
+
+sampler_sink_t *
+uart_sampler_journal_sink_new(const char *path, usf_flags_t flags,
+                              usf_line_sizes_t line_sizes, unsigned long size)
+{
+    journal_t *j;
+    void      *base;
+    int        fd;
+
+    if (!size)
+        size = DEFAULT_SIZE;
+    if (size < RECORDS_OFFSET + sizeof(sampler_journal_record_t))
+        return NULL;
+
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1)
+        return NULL;
+
+    if (ftruncate(fd, size)) {
+        close(fd);
+        return NULL;
+    }
+
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    j = malloc(sizeof(journal_t));
+    if (!j) {
+        munmap(base, size);
+        return NULL;
+    }
+    bzero(j, sizeof(journal_t));
+
+    j->base = base;
+    j->size = size;
+    j->header = base;
+    j->records = (sampler_journal_record_t *)(j->base + RECORDS_OFFSET);
+    j->no_records = (size - RECORDS_OFFSET) / sizeof(sampler_journal_record_t);
+
+    memcpy(j->header->magic, SAMPLER_JOURNAL_MAGIC,
+           sizeof(SAMPLER_JOURNAL_MAGIC));
+    j->header->version = SAMPLER_JOURNAL_VERSION;
+    j->header->flags = flags;
+    j->header->line_sizes = line_sizes;
+    j->header->records_offset = RECORDS_OFFSET;
+    j->header->record_size = sizeof(sampler_journal_record_t);
+    j->header->no_records = j->no_records;
+
+    j->sink.burst_begin = sink_burst_begin;
+    j->sink.burst_end = sink_burst_end;
+    j->sink.sample = sink_sample;
+    j->sink.dangling = sink_dangling;
+    j->sink.watch = sink_watch;
+    j->sink.unwatch = sink_unwatch;
+    j->sink.flush = sink_flush;
+    j->sink.fini = sink_fini;
+    j->sink.discard = sink_discard;
+    return &j->sink;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
@@ -0,0 +1,254 @@
+/*
+ * Copyright (C) 2009-2011, David Eklöv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Per-PC reuse profile. Samples are attributed to the PC of the
+ * access that ends the reuse, i.e. the instruction that would miss
+ * if the reuse time is too long. Reuse times are kept in log2
+ * buckets. Only the table_size PCs with the most samples are kept,
+ * see topk.h, so the memory use doesn't depend on the program.
+ *
+ * Every sample is weighted by 1/rate of its burst, so bursts sampled
+ * at different rates (adaptive period, reservoir, spatial budget)
+ * contribute in proportion to the accesses they represent. The table
+ * counts in fixed point, WEIGHT_ONE per access.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <inttypes.h>
+
+#include "topk.h"
+#include "pcprof.h"
+
+#define DEFAULT_TABLE_SIZE 1024
+#define REUSE_BUCKETS      64
+#define WEIGHT_ONE         256
+
+typedef struct {
+    double   reuse_sum;
+    double   hist[REUSE_BUCKETS];
+} pc_stats_t;
+
+typedef struct {
+    sampler_sink_t sink;
+    char          *path;
+    topk_t         pcs;
+    uint64_t       no_samples;
+    uint64_t       no_dangling;
+    uint64_t       weight;
+
+    /* Rate of every burst, samples can end after their burst */
+    double        *rates;
+    unsigned long  max_bursts;
+} pcprof_t;
+
+static inline unsigned
+reuse_bucket(uint64_t reuse)
+{
+    return reuse ? 63 - __builtin_clzll(reuse) : 0;
+}
+
+static int
+sink_burst_begin(sampler_sink_t *sink, unsigned long burst,
+                 unsigned long time, double rate)
+{
+    pcprof_t *p = (pcprof_t *)sink;
+
+    if (burst >= p->max_bursts) {
+        unsigned long max = p->max_bursts ? 2 * p->max_bursts : 64;
+        double *rates;
+
+        while (max <= burst)
+            max *= 2;
+        rates = realloc(p->rates, max * sizeof(double));
+        if (!rates)
+            return -1;
+        for (unsigned long i = p->max_bursts; i < max; i++)
+            rates[i] = 1.0;
+        p->rates = rates;
+        p->max_bursts = max;
+    }
+
+    p->rates[burst] = rate > 0 ? rate : 1.0;
+    return 0;
+}
+
+static int
+sink_sample(sampler_sink_t *sink, unsigned long burst,
+            usf_access_t *begin, usf_access_t *end,
+            usf_line_size_2_t line_size_lg2)
+{
+    pcprof_t     *p = (pcprof_t *)sink;
+    topk_entry_t *e;
+    pc_stats_t   *stats;
+    uint64_t      reuse = end->time - begin->time;
+    double        weight;
+    uint64_t      fixed;
+
+    weight = 1.0 / (burst < p->max_bursts ? p->rates[burst] : 1.0);
+    fixed = (uint64_t)(weight * WEIGHT_ONE + 0.5);
+
+    e = topk_add(&p->pcs, end->pc, fixed);
+    stats = TOPK_PAYLOAD(e);
+    stats->reuse_sum += weight * reuse;
+    stats->hist[reuse_bucket(reuse)] += weight;
+
+    p->no_samples++;
+    p->weight += fixed;
+    return 0;
+}
+
+static int
+sink_dangling(sampler_sink_t *sink, unsigned long burst,
+              usf_access_t *begin, usf_line_size_2_t line_size_lg2)
+{
+    ((pcprof_t *)sink)->no_dangling++;
+    return 0;
+}
+
+static void
+pcprof_free(pcprof_t *p)
+{
+    topk_fini(&p->pcs);
+    free(p->rates);
+    free(p->path);
+    free(p);
+}
+
+static int
+report_write(pcprof_t *p, FILE *f)
+{
+    topk_entry_t **sorted;
+    uint64_t       cum = 0;
+
+    sorted = topk_sorted(&p->pcs);
+    if (!sorted)
+        return -1;
+
+    fprintf(f, "# samples: %" PRIu64 " dangling: %" PRIu64
+            " weight: %.1f pcs: %u/%u\n", p->no_samples, p->no_dangling,
+            (double)p->weight / WEIGHT_ONE, p->pcs.size, p->pcs.capacity);
+    fprintf(f, "# Samples are attributed to the PC ending the reuse and\n"
+            "# weighted by 1/rate of their burst. error is the largest\n"
+            "# possible overcount, histogram entries are\n"
+            "# log2(reuse time):weight.\n");
+    fprintf(f, "# rank pc weight error percent cumulative mean_reuse histogram\n");
+
+    for (unsigned i = 0; i < p->pcs.size; i++) {
+        topk_entry_t *e = sorted[i];
+        pc_stats_t   *stats = TOPK_PAYLOAD(e);
+        double        n = 0;
+
+        for (int b = 0; b < REUSE_BUCKETS; b++)
+            n += stats->hist[b];
+
+        cum += e->count;
+        fprintf(f, "%u 0x%" PRIx64 " %.1f %.1f %.2f %.2f %.1f",
+                i + 1, e->key, (double)e->count / WEIGHT_ONE,
+                (double)e->error / WEIGHT_ONE,
+                100.0 * e->count / p->weight,
+                100.0 * cum / p->weight,
+                n ? stats->reuse_sum / n : 0.0);
+        for (int b = 0; b < REUSE_BUCKETS; b++) {
+            if (stats->hist[b])
+                fprintf(f, " %d:%.1f", b, stats->hist[b]);
+        }
+        fprintf(f, "\n");
+    }
+
+    free(sorted);
+    return 0;
+}
+
+static int
+sink_fini(sampler_sink_t *sink)
+{
+    pcprof_t *p = (pcprof_t *)sink;
+    FILE     *f;
+    int       err;
+
+    f = fopen(p->path, "w");
+    if (!f) {
+        pcprof_free(p);
+        return -1;
+    }
+
+    err = report_write(p, f);
+    if (fclose(f))
+        err = -1;
+
+    pcprof_free(p);
+    return err;
+}
+
+static void
+sink_discard(sampler_sink_t *sink)
+{
+    pcprof_free((pcprof_t *)sink);
+}
+
+sampler_sink_t *
+uart_sampler_pcprof_sink_new(const char *path, unsigned table_size)
+{
+    pcprof_t *p;
+
+    p = malloc(sizeof(pcprof_t));
+    if (!p)
+        return NULL;
+    bzero(p, sizeof(pcprof_t));
+
+    p->path = strdup(path);
+    if (!p->path ||
+        topk_init(&p->pcs, table_size ? table_size : DEFAULT_TABLE_SIZE,
+                  sizeof(pc_stats_t))) {
+        free(p->path);
+        free(p);
+        return NULL;
+    }
+
+    p->sink.burst_begin = sink_burst_begin;
+    p->sink.sample = sink_sample;
+    p->sink.dangling = sink_dangling;
+    p->sink.fini = sink_fini;
+    p->sink.discard = sink_discard;
+    return &p->sink;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
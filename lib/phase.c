@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2009-2011, David Eklöv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+
+#include "util.h"
+#include "phase.h"
+
+/* Later intervals go to the closest phase */
+#define MAX_PHASES 256
+
+int
+phase_init(phase_detector_t *p, unsigned long interval, double threshold)
+{
+    bzero(p, sizeof(phase_detector_t));
+    E_IF(!interval, -1);
+
+    p->interval  = interval;
+    p->threshold = threshold;
+    p->current   = PHASE_NONE;
+    return 0;
+}
+
+void
+phase_fini(phase_detector_t *p)
+{
+    free(p->phases);
+    free(p->burst_phase);
+}
+
+static double
+sig_distance(const double *a, const double *b)
+{
+    double d = 0;
+
+    for (int i = 0; i < PHASE_SIG_SIZE; i++)
+        d += fabs(a[i] - b[i]);
+    return d;
+}
+
+int
+phase_interval_end(phase_detector_t *p)
+{
+    double   sig[PHASE_SIG_SIZE];
+    double   best_d = INFINITY;
+    int      best = PHASE_NONE;
+    phase_t *phase;
+
+    if (!p->no_refs)
+        return 0;
+
+    for (int i = 0; i < PHASE_SIG_SIZE; i++)
+        sig[i] = (double)p->counts[i] / p->no_refs;
+    bzero(p->counts, sizeof(p->counts));
+    p->no_refs = 0;
+
+    for (unsigned i = 0; i < p->no_phases; i++) {
+        double d = sig_distance(sig, p->phases[i].sig);
+        if (d < best_d) {
+            best_d = d;
+            best = i;
+        }
+    }
+
+    if (best == PHASE_NONE ||
+        (best_d > p->threshold && p->no_phases < MAX_PHASES)) {
+        if (p->no_phases == p->max_phases) {
+            unsigned max = p->max_phases ? 2 * p->max_phases : 16;
+            phase_t *phases = realloc(p->phases, max * sizeof(phase_t));
+            E_IF(!phases, -1);
+            p->phases = phases;
+            p->max_phases = max;
+        }
+        best = p->no_phases++;
+        phase = &p->phases[best];
+        bzero(phase, sizeof(phase_t));
+        memcpy(phase->sig, sig, sizeof(sig));
+    } else
+        phase = &p->phases[best];
+
+    phase->no_intervals++;
+    p->current = best;
+
+    /* The bursts that began in the interval belong to its phase */
+    for (; p->first_pending < p->no_bursts; p->first_pending++) {
+        p->burst_phase[p->first_pending] = best;
+        phase->no_bursts++;
+    }
+    return 0;
+}
+
+int
+phase_burst(phase_detector_t *p, unsigned long burst)
+{
+    if (burst >= p->max_bursts) {
+        unsigned long max = p->max_bursts ? 2 * p->max_bursts : 64;
+        int *burst_phase;
+
+        while (max <= burst)
+            max *= 2;
+        burst_phase = realloc(p->burst_phase, max * sizeof(int));
+        E_IF(!burst_phase, -1);
+        p->burst_phase = burst_phase;
+        p->max_bursts = max;
+    }
+
+    for (; p->no_bursts <= burst; p->no_bursts++)
+        p->burst_phase[p->no_bursts] = PHASE_NONE;
+    return 0;
+}
+
+void
+phase_skip(phase_detector_t *p)
+{
+    if (p->current != PHASE_NONE)
+        p->phases[p->current].no_skipped++;
+}
+
+/*
+ * A burst stands for all the intervals of its phase, split evenly
+ * between the bursts of the phase. Phases without bursts weren't
+ * sampled and are only listed.
+ */
+int
+phase_write(phase_detector_t *p, FILE *f)
+{
+    unsigned long no_intervals = 0;
+
+    for (unsigned i = 0; i < p->no_phases; i++)
+        no_intervals += p->phases[i].no_intervals;
+
+    fprintf(f, "# interval: %lu intervals: %lu phases: %u\n",
+            p->interval, no_intervals, p->no_phases);
+    fprintf(f, "# phase intervals bursts skipped\n");
+    for (unsigned i = 0; i < p->no_phases; i++) {
+        phase_t *phase = &p->phases[i];
+        fprintf(f, "phase %u %lu %lu %lu\n", i, phase->no_intervals,
+                phase->no_bursts, phase->no_skipped);
+    }
+
+    fprintf(f, "# burst phase weight\n");
+    for (unsigned long i = 0; i < p->no_bursts; i++) {
+        int     ph = p->burst_phase[i];
+        double  weight = 1;
+
+        if (ph != PHASE_NONE)
+            weight = (double)p->phases[ph].no_intervals /
+                p->phases[ph].no_bursts;
+        fprintf(f, "burst %lu %d %.6g\n", i, ph, weight);
+    }
+
+    return ferror(f) ? -1 : 0;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
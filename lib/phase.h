@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2009-2011, David Eklöv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PHASE_H
+#define PHASE_H
+#include <stdio.h>
+#include <stdint.h>
+#include <uart/usf.h>
+
+/*
+ * Phase detector. The PCs of the accesses in every interval are
+ * hashed into a small vector, the basic block vector of the interval.
+ * An interval belongs to the known phase whose vector is closest to
+ * its own (Manhattan distance of the normalized vectors, 0-2) if that
+ * distance is within threshold, otherwise it starts a new phase.
+ */
+
+#define PHASE_SIG_SIZE 32
+#define PHASE_NONE     -1
+
+typedef struct {
+    double          sig[PHASE_SIG_SIZE];
+    unsigned long   no_intervals;
+    unsigned long   no_bursts;
+    unsigned long   no_skipped;
+} phase_t;
+
+typedef struct {
+    unsigned long   interval;
+    double          threshold;
+
+    uint32_t        counts[PHASE_SIG_SIZE];
+    unsigned long   no_refs;
+
+    phase_t        *phases;
+    unsigned        no_phases;
+    unsigned        max_phases;
+    /* Phase of the last complete interval */
+    int             current;
+
+    /* Phase of every burst, bursts from first_pending on began in
+     * the current interval and don't have one yet. */
+    int            *burst_phase;
+    unsigned long   no_bursts;
+    unsigned long   max_bursts;
+    unsigned long   first_pending;
+} phase_detector_t;
+
+int  uart_sampler_phase_init(phase_detector_t *p, unsigned long interval,
+                             double threshold);
+void uart_sampler_phase_fini(phase_detector_t *p);
+
+/* Classify the interval, called when it is complete */
+int  uart_sampler_phase_interval_end(phase_detector_t *p);
+
+/* Burst began in the current interval */
+int  uart_sampler_phase_burst(phase_detector_t *p, unsigned long burst);
+
+/* A burst was skipped because the phase has already been sampled */
+void uart_sampler_phase_skip(phase_detector_t *p);
+
+/* Write the phases and the weight of every burst */
+int  uart_sampler_phase_write(phase_detector_t *p, FILE *f);
+
+static inline int
+phase_ref(phase_detector_t *p, usf_addr_t pc)
+{
+    p->counts[(pc * 0x9e3779b97f4a7c15ULL) >> 59]++;
+    if (++p->no_refs < p->interval)
+        return 0;
+    return uart_sampler_phase_interval_end(p);
+}
+
+#define phase_init         uart_sampler_phase_init
+#define phase_fini         uart_sampler_phase_fini
+#define phase_interval_end uart_sampler_phase_interval_end
+#define phase_burst        uart_sampler_phase_burst
+#define phase_skip         uart_sampler_phase_skip
+#define phase_write        uart_sampler_phase_write
+
+#endif /* PHASE_H */
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
@@ -34,148 +34,123 @@
 #include <string.h>
 #include <strings.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <time.h>
 #include <assert.h>
 
 #include "list.h"
 #include "hash.h"
+#include "util.h"
+#include "phase.h"
+#include "sdist.h"
+#include "sharing.h"
 #include <uart/sampler.h>
 
 #define HASH_BINS 1024
+#define SPATIAL_MODULUS (1ULL << 32)
+#define PHASE_DEFAULT_THRESHOLD 0.2
+#define SDIST_DEFAULT_BUCKET 256
+/* Largest change of the sample period between two bursts */
+#define ADAPT_MAX_STEP 4.0
 
 typedef struct {
-    list_elem_t  elem;
-    usf_file_t  *usf_file;
-    char         name[256];
-} burst_t;
+    usf_addr_t begin;
+    usf_addr_t end;
+} addr_range_t;
+
+/* A reservoir slot, the sample is complete once done is set */
+typedef struct {
+    usf_access_t    begin;
+    usf_access_t    end;
+    double          distance;   /* Estimated stack distance */
+    int             done;
+} reservoir_entry_t;
 
 typedef struct {
     hash_t          hash;
-    list_t          list;
 
-    burst_t        *burst;
+    int             burst_active;
+    unsigned long   burst;
     unsigned long   burst_idx;
-} sampler_internal_t;
 
-typedef struct {
-    hash_elem_t   elem;
-    unsigned      line;
-    burst_t      *burst;
-    usf_access_t  ref;
-} watchpoint_t;
+    unsigned long   no_watchpoints;
+    /* Spatial sampling, lines with a hash below threshold are sampled */
+    uint64_t        threshold;
 
-#define MAX(_a, _b) ({                          \
-            __typeof__(_a) __a = _a;            \
-            __typeof__(_b) __b = _b;            \
-            __a < __b ? __b : __a;              \
-        })
-
-#define E_IF(_cond, _ret) do {                  \
-        if (_cond) {                            \
-            _LOG("error: %s", #_cond);          \
-            return _ret;                        \
-        }                                       \
-    } while (0)
-#define E_USF(error, _ret) E_IF((error) != USF_ERROR_OK, _ret) 
-
-#define SAMPLE_RND(_s) ((_s)->sample_rnd((_s)->sample_period))
-#define BURST_RND(_s)  ((_s)->burst_rnd((_s)->burst_period))
-
-
-#ifdef DEBUG
-static int log_level = 0;
-#define _LOG(_fmt, _args...) do {                                       \
-        printf("%s:%d: " _fmt "\n", __FUNCTION__, __LINE__, ##_args);   \
-    } while (0)
-
-#define LOG(_l, _fmt, _args...) do {            \
-        if (_l <= log_level)                    \
-            _LOG(_fmt, ##_args);                \
-    } while (0)
-#else
-#define _LOG(_fmt, _args...)
-#define LOG(_l, _fmt, _args...)
-#endif
-
-
-static burst_t *
-burst_new(sampler_t *s, char *file_path, usf_atime_t begin_time)
-{
-    burst_t *burst;
-    usf_header_t header;
-    usf_error_t error;
-    usf_event_t event;
-
-    burst = (burst_t *)malloc(sizeof(burst_t));
-    E_IF(burst == NULL, NULL);
-
-    header.version = USF_VERSION_CURRENT;
-    header.compression = USF_COMPRESSION_BZIP2;
-    header.flags = s->usf_flags;
-    header.time_begin = 0;
-    header.time_end = 0;
-    header.line_sizes = (1 << s->line_size_lg2);
-    header.argc = 0;
-    header.argv = NULL;
-
-    error = usf_create(&burst->usf_file, file_path, &header);
-    E_USF(error, NULL);
-
-    event.type = USF_EVENT_BURST;
-    event.u.burst.begin_time = begin_time;
-    
-    error = usf_append(burst->usf_file, &event);
-    E_USF(error, NULL);
-    return burst;
-}
+    /* Adaptive sampling, measured since the last adjustment */
+    unsigned long   adapt_samples;
+    unsigned long   adapt_watchpoints;
+    struct timespec adapt_time;
 
-static int
-burst_del(burst_t *burst)
-{
-    usf_error_t error;
+    /* Reservoir sampling, see reservoir_ref() */
+    reservoir_entry_t *reservoir;
+    unsigned long   reservoir_used;
+    unsigned long   reservoir_skipped;
+    double          reservoir_w;
+    unsigned long   reservoir_begin;
+    unsigned long   reservoir_end;
 
-    error = usf_close(burst->usf_file);
-    E_IF(error != USF_ERROR_OK, -1);
-    LOG(2, "burst: %s\n", burst->name);
+    /* Phase detection, enabled if phase.interval is set */
+    phase_detector_t phase;
 
-    free(burst);
-    return 0;
-}
+    /* Stack distance estimation, enabled if sdist.precision is set */
+    sdist_t         sdist;
 
-static int
-burst_log_smpl(burst_t *burst, usf_access_t *ref1, usf_access_t *ref2,
-	       usf_line_size_2_t line_size_lg2)
-{
-    usf_event_t event;
-    usf_error_t error;
+    /* Random stream of the built-in generators, seeded from seed */
+    unsigned short  rnd_state[3];
+    int             rnd_seeded;
 
-    event.type = USF_EVENT_SAMPLE; 
-    event.u.sample.begin = *ref1;
-    event.u.sample.end = *ref2;
-    event.u.sample.line_size = line_size_lg2;
+    /* Sharing classification, enabled if sharing_on is set */
+    int             sharing_on;
+    sharing_t       sharing;
 
-    error = usf_append(burst->usf_file, &event);
-    E_USF(error, -1);
-    LOG(2, "burst: %s\n", burst->name);
-    return 0;
-}
+    addr_range_t   *ranges;
+    unsigned        nranges;
+} sampler_internal_t;
 
-static int
-burst_log_dngl(burst_t *burst, usf_access_t *ref,
-	       usf_line_size_2_t line_size_lg2)
+typedef struct {
+    hash_elem_t    elem;
+    unsigned       line;
+    unsigned long  burst;
+    unsigned long  slot;        /* Reservoir slot */
+    usf_access_t   ref;
+} watchpoint_t;
+
+static int reservoir_write(sampler_t *s);
+static int phase_file_write(sampler_t *s);
+static int sdist_file_write(sampler_t *s);
+static int sharing_file_write(sampler_t *s);
+
+#define SAMPLE_RND(_s) rnd_call(_s, (_s)->sample_rnd, (_s)->sample_period)
+#define BURST_RND(_s)  rnd_call(_s, (_s)->burst_rnd, (_s)->burst_period)
+
+/* Uniform in [0, 1) from the sampler's own stream */
+static double
+rnd_uniform(sampler_t *s)
 {
-    usf_event_t event;
-    usf_error_t error;
+    sampler_internal_t *internal = (sampler_internal_t *)s->_internal;
 
-    event.type = USF_EVENT_DANGLING;
-    event.u.dangling.begin = *ref;
-    event.u.dangling.line_size = line_size_lg2;
+    if (!internal->rnd_seeded) {
+        internal->rnd_state[0] = 0x330e;
+        internal->rnd_state[1] = s->seed & 0xffff;
+        internal->rnd_state[2] = s->seed >> 16;
+        internal->rnd_seeded = 1;
+    }
+    return erand48(internal->rnd_state);
+}
 
-    error = usf_append(burst->usf_file, &event);
-    E_USF(error, -1);
-    LOG(2, "burst: %s\n", burst->name);
-    return 0;
+/* The built-in exponential generator draws from the sampler's stream,
+ * so samplers in different threads are independent and every sampler
+ * is reproducible from its seed. */
+static unsigned
+rnd_call(sampler_t *s, unsigned (*rnd)(unsigned), unsigned long period)
+{
+    if (rnd == sampler_rnd_exp)
+        return (unsigned)(period * -log(1 - rnd_uniform(s)));
+    return rnd(period);
 }
 
+
 static unsigned
 watchpoint_hash_func(hash_elem_t *e)
 {
@@ -192,7 +167,8 @@ watchpoint_hash_comp(hash_elem_t *e1, hash_elem_t *e2)
 }
 
 static int
-watchpoint_insert(hash_t *hash, burst_t *burst, unsigned line, usf_access_t *ref)
+watchpoint_insert(hash_t *hash, unsigned long burst, unsigned long slot,
+                  unsigned line, usf_access_t *ref)
 {
     watchpoint_t *w;
 
@@ -201,6 +177,7 @@ watchpoint_insert(hash_t *hash, burst_t *burst, unsigned line, usf_access_t *ref
 
     w->line  =  line;
     w->burst =  burst;
+    w->slot  =  slot;
     w->ref   = *ref;
 
     hash_insert(hash, &w->elem);
@@ -220,7 +197,39 @@ watchpoint_lookup(hash_t *hash, unsigned line)
     return HASH_STRUCT(watchpoint_t, elem, e);
 }
 
+static int
+watchpoint_check(hash_t *hash, unsigned line)
+{
+    watchpoint_t  w_cmp = { .line = line };
+
+    return hash_lookup(hash, &w_cmp.elem) != NULL;
+}
+
 
+/* The ranges are kept sorted and non-overlapping. Watchpoints are
+ * per line, so a line matches if any part of it is in a range. */
+static int
+addr_range_match(sampler_internal_t *internal, usf_addr_t addr,
+                 unsigned short line_size_lg2)
+{
+    usf_addr_t line_begin = addr & ~(((usf_addr_t)1 << line_size_lg2) - 1);
+    usf_addr_t line_end   = line_begin + ((usf_addr_t)1 << line_size_lg2);
+    unsigned   lo = 0;
+    unsigned   hi = internal->nranges;
+
+    while (lo < hi) {
+        unsigned      mid = (lo + hi) / 2;
+        addr_range_t *r   = &internal->ranges[mid];
+
+        if (line_end <= r->begin)
+            hi = mid;
+        else if (line_begin >= r->end)
+            lo = mid + 1;
+        else
+            return 1;
+    }
+    return 0;
+}
 
 int
 sampler_init(sampler_t *s)
@@ -232,6 +241,7 @@ sampler_init(sampler_t *s)
 
     internal = malloc(sizeof(sampler_internal_t));
     E_IF(!internal, -1);
+    bzero(internal, sizeof(sampler_internal_t));
     s->_internal = internal;
 
     s->usf_flags = USF_FLAG_NATIVE_ENDIAN | USF_FLAG_BURST;
@@ -239,9 +249,6 @@ sampler_init(sampler_t *s)
     err = hash_init(&internal->hash, HASH_BINS, watchpoint_hash_func, watchpoint_hash_comp);
     E_IF(err, -1);
 
-    err = list_init(&internal->list);
-    E_IF(err, -1);
-
     return 0;
 }
 
@@ -252,32 +259,138 @@ sampler_fini(sampler_t *s)
 
     sampler_internal_t *internal = (sampler_internal_t *)s->_internal;
     hash_elem_t *iter_h;
+
+    if (internal->reservoir) {
+        err = reservoir_write(s);
+        E_IF(err, -1);
+    }
+
     HASH_FOR_S(&internal->hash, iter_h) {
         watchpoint_t *w = HASH_STRUCT(watchpoint_t, elem, iter_h);
 
-        err = burst_log_dngl(w->burst, &w->ref, s->line_size_lg2);
-        E_IF(err, -1);
+        /* The reservoir already wrote its dangling samples */
+        if (!internal->reservoir) {
+            err = s->sink->dangling(s->sink, w->burst, &w->ref,
+                                    s->line_size_lg2);
+            E_IF(err, -1);
+            if (internal->sdist.precision) {
+                err = sdist_dangling(&internal->sdist, w->burst);
+                E_IF(err, -1);
+            }
+        }
 
         hash_remove(&internal->hash, iter_h);
         free(w);
     } HASH_FOR_S_END;
 
-    list_elem_t *iter_l;
-    LIST_FOR_S(&internal->list, iter_l) {
-        burst_t *b = LIST_STRUCT(burst_t, elem, iter_l);
+    if (internal->phase.interval) {
+        err = phase_file_write(s);
+        phase_fini(&internal->phase);
+        E_IF(err, -1);
+    }
+
+    if (internal->sdist.precision) {
+        err = sdist_file_write(s);
+        sdist_fini(&internal->sdist);
+        E_IF(err, -1);
+    }
 
-        err = burst_del(b);
+    if (internal->sharing_on) {
+        err = sharing_file_write(s);
+        sharing_fini(&internal->sharing);
         E_IF(err, -1);
-        
-        //list_remove(iter_l);
-    } LIST_FOR_S_END;
+    }
 
+    if (s->sink) {
+        err = s->sink->fini(s->sink);
+        E_IF(err, -1);
+        s->sink = NULL;
+    }
+
+    free(internal->reservoir);
+    free(internal->ranges);
     free(s->_internal);
     s->_internal = NULL;
 
     return 0;
 }
 
+int
+sampler_discard(sampler_t *s)
+{
+    sampler_internal_t *internal = (sampler_internal_t *)s->_internal;
+    hash_elem_t *iter_h;
+
+    HASH_FOR_S(&internal->hash, iter_h) {
+        watchpoint_t *w = HASH_STRUCT(watchpoint_t, elem, iter_h);
+
+        hash_remove(&internal->hash, iter_h);
+        free(w);
+    } HASH_FOR_S_END;
+    hash_fini(&internal->hash);
+
+    /* The sink must leave its files alone, closing them would flush
+     * buffered data that belongs to someone else. */
+    if (s->sink && s->sink->discard)
+        s->sink->discard(s->sink);
+    s->sink = NULL;
+
+    if (internal->phase.interval)
+        phase_fini(&internal->phase);
+    if (internal->sdist.precision)
+        sdist_fini(&internal->sdist);
+    if (internal->sharing_on)
+        sharing_fini(&internal->sharing);
+    free(internal->reservoir);
+    free(internal->ranges);
+    free(s->_internal);
+    s->_internal = NULL;
+
+    return 0;
+}
+
+int
+sampler_flush(sampler_t *s)
+{
+    if (!s->sink || !s->sink->flush)
+        return 0;
+    return s->sink->flush(s->sink);
+}
+
+int
+sampler_addr_range_add(sampler_t *s, usf_addr_t begin, usf_addr_t end)
+{
+    sampler_internal_t *internal = (sampler_internal_t *)s->_internal;
+    addr_range_t *ranges;
+    unsigned i, j;
+
+    E_IF(begin >= end, -1);
+
+    ranges = realloc(internal->ranges,
+                     (internal->nranges + 1) * sizeof(addr_range_t));
+    E_IF(!ranges, -1);
+    internal->ranges = ranges;
+
+    for (i = 0; i < internal->nranges && ranges[i].begin < begin; i++)
+        ;
+    memmove(&ranges[i + 1], &ranges[i],
+            (internal->nranges - i) * sizeof(addr_range_t));
+    ranges[i].begin = begin;
+    ranges[i].end   = end;
+    internal->nranges++;
+
+    /* Merge overlapping and adjacent ranges */
+    for (i = 0, j = 1; j < internal->nranges; j++) {
+        if (ranges[j].begin <= ranges[i].end) {
+            ranges[i].end = MAX(ranges[i].end, ranges[j].end);
+        } else
+            ranges[++i] = ranges[j];
+    }
+    internal->nranges = i + 1;
+
+    return 0;
+}
+
 /*
  * Low level API
  */
@@ -289,9 +402,38 @@ sampler_watchpoint_lookup(sampler_t *s, usf_access_t *ref)
     unsigned      line  = ref->addr >> s->line_size_lg2;
     watchpoint_t *w_hit = watchpoint_lookup(&internal->hash, line);
 
+    if (internal->reservoir && ref->time > internal->reservoir_end)
+        internal->reservoir_end = ref->time;
+
     if (w_hit) {
-        err = burst_log_smpl(w_hit->burst, &w_hit->ref, ref, s->line_size_lg2);
-        E_IF(err, -1);
+        double distance = 0;
+
+        internal->no_watchpoints--;
+        /* The sketches include the watched line */
+        if (internal->sdist.precision)
+            distance = MAX(sdist_estimate(&internal->sdist,
+                                          w_hit->ref.time) - 1, 0.0);
+
+        if (internal->sharing_on) {
+            err = sharing_sample(&internal->sharing, &w_hit->ref, ref,
+                                 s->line_size_lg2);
+            E_IF(err, -1);
+        }
+
+        if (internal->reservoir) {
+            reservoir_entry_t *r = &internal->reservoir[w_hit->slot];
+            r->end  = *ref;
+            r->distance = distance;
+            r->done = 1;
+        } else {
+            if (internal->sdist.precision) {
+                err = sdist_sample(&internal->sdist, w_hit->burst, distance);
+                E_IF(err, -1);
+            }
+            err = s->sink->sample(s->sink, w_hit->burst, &w_hit->ref, ref,
+                                  s->line_size_lg2);
+            E_IF(err, -1);
+        }
         free(w_hit);
     }
 
@@ -305,28 +447,146 @@ sampler_watchpoint_insert(sampler_t *s, usf_access_t *ref)
     int      err;
     unsigned line = ref->addr >> s->line_size_lg2;
 
-    err = watchpoint_insert(&internal->hash, internal->burst, line, ref);
+    err = watchpoint_insert(&internal->hash, internal->burst, 0, line, ref);
     E_IF(err, -1);
+    internal->no_watchpoints++;
+    internal->adapt_samples++;
+
+    if (s->sink && s->sink->watch) {
+        err = s->sink->watch(s->sink, internal->burst, ref);
+        E_IF(err, -1);
+    }
 
     return 0;
 }
 
+int
+sampler_watchpoint_check(sampler_t *s, usf_addr_t addr)
+{
+    sampler_internal_t *internal = (sampler_internal_t *)s->_internal;
+
+    return watchpoint_check(&internal->hash, addr >> s->line_size_lg2);
+}
+
+/*
+ * Scale the sample period by how far the metric of the last burst was
+ * from the target. All metrics are roughly proportional to the rate,
+ * the step is limited to keep a single odd burst from throwing the
+ * period off.
+ */
+static void
+adapt_period(sampler_t *s)
+{
+    sampler_internal_t *internal = (sampler_internal_t *)s->_internal;
+    struct timespec now;
+    double          elapsed;
+    double          measured;
+    double          factor;
+    double          period;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - internal->adapt_time.tv_sec) +
+        (now.tv_nsec - internal->adapt_time.tv_nsec) / 1e9;
+    internal->adapt_time = now;
+
+    /* Nothing to go on before the first burst */
+    if (!internal->burst_idx) {
+        internal->adapt_samples = 0;
+        return;
+    }
+
+    switch (s->target) {
+    case SAMPLER_TARGET_SAMPLES:
+        if (elapsed <= 0)
+            return;
+        measured = internal->adapt_samples / elapsed;
+        break;
+    case SAMPLER_TARGET_WATCHPOINTS:
+        measured = internal->adapt_watchpoints;
+        break;
+    case SAMPLER_TARGET_BYTES:
+        measured = (double)internal->adapt_samples * sizeof(usf_event_t);
+        break;
+    default:
+        return;
+    }
+    internal->adapt_samples = 0;
+
+    factor = measured / s->target_value;
+    if (factor > ADAPT_MAX_STEP)
+        factor = ADAPT_MAX_STEP;
+    else if (factor < 1 / ADAPT_MAX_STEP)
+        factor = 1 / ADAPT_MAX_STEP;
+
+    period = s->sample_period * factor;
+    if (s->sample_period_max && period > s->sample_period_max)
+        period = s->sample_period_max;
+    if (period < MAX(s->sample_period_min, 1))
+        period = MAX(s->sample_period_min, 1);
+    /* The random generators take an unsigned period */
+    if (period > UINT_MAX)
+        period = UINT_MAX;
+
+    s->sample_period = (unsigned long)period;
+    LOG(1, "adaptive: measured %g, sample period %lu\n",
+        measured, s->sample_period);
+}
+
 int
 sampler_burst_begin(sampler_t *s, unsigned long time)
 {
     sampler_internal_t *internal = (sampler_internal_t *)s->_internal;
-    burst_t *burst;
-    char     path[256];
+    int err;
+
+    if (!s->sink) {
+        s->sink = sampler_sink_create(s, s->output);
+        E_IF(!s->sink, -1);
+    }
 
-    snprintf(path, 256, "%s.%lu", s->usf_base_path, internal->burst_idx++);
+    if (s->sharing_table_size && !internal->sharing_on) {
+        err = sharing_init(&internal->sharing, s->sharing_table_size);
+        E_IF(err, -1);
+        internal->sharing_on = 1;
+    }
+
+    /* The reservoir is a single burst, written by sampler_fini() */
+    if (s->reservoir_size) {
+        if (internal->reservoir)
+            return 0;
+
+        internal->reservoir = malloc(s->reservoir_size *
+                                     sizeof(reservoir_entry_t));
+        E_IF(!internal->reservoir, -1);
+        internal->reservoir_begin = time;
+        internal->reservoir_end = time;
+        internal->burst = internal->burst_idx++;
+        internal->burst_active = 1;
+        s->next_sample = time;
+        return 0;
+    }
+
+    if (s->spatial_rate > 0 && !internal->threshold) {
+        internal->threshold = s->spatial_rate >= 1 ? SPATIAL_MODULUS :
+            (uint64_t)(s->spatial_rate * SPATIAL_MODULUS);
+        if (!internal->threshold)
+            internal->threshold = 1;
+    }
 
-    burst = burst_new(s, path, time);
-    E_IF(!burst, -1);
+    if (s->target != SAMPLER_TARGET_NONE && s->target_value > 0 &&
+        s->spatial_rate <= 0)
+        adapt_period(s);
 
-    strncpy(burst->name, path, 256);
+    err = s->sink->burst_begin(s->sink, internal->burst_idx, time,
+                               sampler_rate(s));
+    E_IF(err, -1);
+    if (internal->phase.interval) {
+        err = phase_burst(&internal->phase, internal->burst_idx);
+        E_IF(err, -1);
+    }
+    LOG(2, "burst: %lu\n", internal->burst_idx);
 
-    internal->burst = burst;
-    list_push_back(&internal->list, &burst->elem);
+    internal->burst = internal->burst_idx++;
+    internal->burst_active = 1;
 
     return 0;
 }
@@ -335,7 +595,37 @@ int
 sampler_burst_end(sampler_t *s, unsigned long time)
 {
     sampler_internal_t *internal = (sampler_internal_t *)s->_internal;
-    internal->burst = NULL;
+    int err;
+
+    if (s->reservoir_size)
+        return 0;
+
+    if (internal->burst_active)
+        internal->adapt_watchpoints = internal->no_watchpoints;
+
+    if (internal->burst_active && s->sink->burst_end) {
+        err = s->sink->burst_end(s->sink, internal->burst, time);
+        E_IF(err, -1);
+    }
+
+    internal->burst_active = 0;
+    return 0;
+}
+
+int
+sampler_burst_resume(sampler_t *s, unsigned long sampled, unsigned long time)
+{
+    unsigned long next = 0;
+    int err;
+
+    err = sampler_burst_begin(s, time);
+    E_IF(err, -1);
+
+    /* The gaps count sampled accesses, see sampler_ref_skip(). The
+     * first access of the burst is always sampled. */
+    while (next < sampled)
+        next += MAX(SAMPLE_RND(s), 1);
+    s->next_sample = time + next - sampled;
     return 0;
 }
 
@@ -343,17 +633,129 @@ int
 sampler_burst_active(sampler_t *s)
 {
     sampler_internal_t *internal = (sampler_internal_t *)s->_internal;
-    return internal->burst != NULL;
+    return internal->burst_active;
+}
+
+int
+sampler_addr_match(sampler_t *s, usf_addr_t addr)
+{
+    sampler_internal_t *internal = (sampler_internal_t *)s->_internal;
+    return !internal->nranges ||
+        addr_range_match(internal, addr, s->line_size_lg2);
 }
 
 /*
  * High level API
  */
 
+/* Lines are mapped to [0, SPATIAL_MODULUS) */
+static inline uint64_t
+spatial_hash(uint64_t line)
+{
+    line ^= line >> 33;
+    line *= 0xff51afd7ed558ccdULL;
+    line ^= line >> 33;
+    line *= 0xc4ceb9fe1a85ec53ULL;
+    line ^= line >> 33;
+    return line & (SPATIAL_MODULUS - 1);
+}
+
+static int
+hash_comp_u64(const void *p1, const void *p2)
+{
+    const uint64_t h1 = *(const uint64_t *)p1;
+    const uint64_t h2 = *(const uint64_t *)p2;
+    return h1 < h2 ? -1 : h1 > h2;
+}
+
+/*
+ * Lower the threshold until 7/8 of the budget is used and drop the
+ * watchpoints of the lines that are no longer sampled. Their reuses
+ * are unknown, so they are not reported as dangling. A new burst is
+ * started since the rate changed.
+ */
+static int
+spatial_lower(sampler_t *s, unsigned long time)
+{
+    sampler_internal_t *internal = (sampler_internal_t *)s->_internal;
+    unsigned long  keep = s->spatial_budget - s->spatial_budget / 8;
+    unsigned long  n = 0;
+    uint64_t      *hashes;
+    hash_elem_t   *iter_h;
+    int            err;
+
+    hashes = malloc(internal->no_watchpoints * sizeof(uint64_t));
+    E_IF(!hashes, -1);
+
+    HASH_FOR(&internal->hash, iter_h) {
+        watchpoint_t *w = HASH_STRUCT(watchpoint_t, elem, iter_h);
+        hashes[n++] = spatial_hash(w->line);
+    }
+    qsort(hashes, n, sizeof(uint64_t), hash_comp_u64);
+
+    if (keep < n)
+        internal->threshold = hashes[keep];
+    free(hashes);
+
+    HASH_FOR_S(&internal->hash, iter_h) {
+        watchpoint_t *w = HASH_STRUCT(watchpoint_t, elem, iter_h);
+
+        if (spatial_hash(w->line) >= internal->threshold) {
+            hash_remove(&internal->hash, iter_h);
+            internal->no_watchpoints--;
+            if (s->sink && s->sink->unwatch)
+                err = s->sink->unwatch(s->sink, w->burst, &w->ref);
+            else
+                err = 0;
+            free(w);
+            E_IF(err, -1);
+        }
+    } HASH_FOR_S_END;
+
+    LOG(1, "spatial rate: %g\n", sampler_rate(s));
+
+    if (internal->burst_active) {
+        err = sampler_burst_end(s, time);
+        E_IF(err, -1);
+        err = sampler_burst_begin(s, time);
+        E_IF(err, -1);
+    }
+    return 0;
+}
+
+/*
+ * Accesses that competed for the reservoir. Tools with a fast path
+ * only call sampler_ref() at sampler_next_event(), so they are
+ * counted from the time span instead of one by one.
+ */
+static unsigned long
+reservoir_seen(sampler_internal_t *internal)
+{
+    if (!internal->reservoir)
+        return 0;
+    return internal->reservoir_end - internal->reservoir_begin + 1 -
+        internal->reservoir_skipped;
+}
+
+double
+sampler_rate(sampler_t *s)
+{
+    sampler_internal_t *internal = (sampler_internal_t *)s->_internal;
+
+    if (s->reservoir_size) {
+        unsigned long seen = reservoir_seen(internal);
+        return seen > s->reservoir_size ?
+            (double)s->reservoir_size / seen : 1.0;
+    }
+    if (s->spatial_rate > 0)
+        return (double)internal->threshold / SPATIAL_MODULUS;
+    return s->sample_period ? 1.0 / s->sample_period : 1.0;
+}
+
 unsigned
 sampler_rnd_exp(unsigned period)
 {
-    double r = (double)rand() / RAND_MAX;
+    double r = drand48();
     return (unsigned)(period * -log(1 - r));
 }
 
@@ -363,6 +765,215 @@ sampler_rnd_const(unsigned period)
     return period;
 }
 
+/* Non-zero if the current phase already has enough bursts */
+static int
+phase_sampled(sampler_t *s)
+{
+    sampler_internal_t *internal = (sampler_internal_t *)s->_internal;
+    phase_detector_t   *p = &internal->phase;
+
+    if (!p->interval || p->current == PHASE_NONE)
+        return 0;
+    return p->phases[p->current].no_bursts >= MAX(s->phase_bursts, 1);
+}
+
+static int
+phase_file_write(sampler_t *s)
+{
+    sampler_internal_t *internal = (sampler_internal_t *)s->_internal;
+    char  path[256];
+    FILE *f;
+    int   err;
+
+    /* The last interval is usually incomplete */
+    err = phase_interval_end(&internal->phase);
+    E_IF(err, -1);
+
+    snprintf(path, 256, "%s.phases", s->usf_base_path);
+    f = fopen(path, "w");
+    E_IF(!f, -1);
+
+    err = phase_write(&internal->phase, f);
+    if (fclose(f))
+        err = -1;
+    E_IF(err, -1);
+    return 0;
+}
+
+static int
+sharing_file_write(sampler_t *s)
+{
+    sampler_internal_t *internal = (sampler_internal_t *)s->_internal;
+    char  path[256];
+    FILE *f;
+    int   err;
+
+    snprintf(path, 256, "%s.sharing", s->usf_base_path);
+    f = fopen(path, "w");
+    E_IF(!f, -1);
+
+    err = sharing_write(&internal->sharing, f, s->line_size_lg2);
+    if (fclose(f))
+        err = -1;
+    E_IF(err, -1);
+    return 0;
+}
+
+static int
+sdist_file_write(sampler_t *s)
+{
+    sampler_internal_t *internal = (sampler_internal_t *)s->_internal;
+    char  path[256];
+    FILE *f;
+    int   err;
+
+    snprintf(path, 256, "%s.sdist", s->usf_base_path);
+    f = fopen(path, "w");
+    E_IF(!f, -1);
+
+    err = sdist_write(&internal->sdist, f);
+    if (fclose(f))
+        err = -1;
+    E_IF(err, -1);
+    return 0;
+}
+
+/* Uniform in (0, 1] */
+static inline double
+rnd_open(sampler_t *s)
+{
+    return 1 - rnd_uniform(s);
+}
+
+/* Accesses to skip before the next one enters the reservoir */
+static unsigned long
+reservoir_skip(sampler_t *s)
+{
+    sampler_internal_t *internal = (sampler_internal_t *)s->_internal;
+    double skip = floor(log(rnd_open(s)) / log(1 - internal->reservoir_w));
+
+    return skip < ULONG_MAX / 2 ? (unsigned long)skip : ULONG_MAX / 2;
+}
+
+/*
+ * Reservoir sampling using Li's Algorithm L. The first reservoir_size
+ * accesses fill the reservoir, after that the gap to the next access
+ * that replaces a random slot is drawn directly, so the cost doesn't
+ * grow with the run length. Every access ends up in the reservoir
+ * with the same probability. A replaced slot that is still waiting
+ * for its reuse loses its watchpoint.
+ */
+static int
+reservoir_ref(sampler_t *s, usf_access_t *ref)
+{
+    sampler_internal_t *internal = (sampler_internal_t *)s->_internal;
+    unsigned long  k = s->reservoir_size;
+    unsigned long  slot;
+    unsigned       line = ref->addr >> s->line_size_lg2;
+    int            err;
+
+    if (!internal->burst_active) {
+        err = sampler_burst_begin(s, ref->time);
+        E_IF(err, -1);
+    }
+    if (ref->time > internal->reservoir_end)
+        internal->reservoir_end = ref->time;
+
+    if (s->next_sample != ref->time)
+        return 0;
+
+    if (internal->reservoir_used < k) {
+        slot = internal->reservoir_used++;
+    } else {
+        reservoir_entry_t *r;
+
+        slot = (unsigned long)(rnd_open(s) * k);
+        if (slot >= k)
+            slot = k - 1;
+
+        r = &internal->reservoir[slot];
+        if (!r->done) {
+            watchpoint_t *w;
+
+            w = watchpoint_lookup(&internal->hash,
+                                  r->begin.addr >> s->line_size_lg2);
+            if (w) {
+                internal->no_watchpoints--;
+                free(w);
+            }
+        }
+    }
+
+    internal->reservoir[slot].begin = *ref;
+    internal->reservoir[slot].done  = 0;
+    err = watchpoint_insert(&internal->hash, internal->burst, slot, line, ref);
+    E_IF(err, -1);
+    internal->no_watchpoints++;
+
+    if (internal->reservoir_used < k) {
+        s->next_sample = ref->time + 1;
+        return 0;
+    }
+
+    if (internal->reservoir_w == 0)
+        internal->reservoir_w = exp(log(rnd_open(s)) / k);
+    else
+        internal->reservoir_w *= exp(log(rnd_open(s)) / k);
+    s->next_sample = ref->time + reservoir_skip(s) + 1;
+    return 0;
+}
+
+static int
+reservoir_entry_comp(const void *p1, const void *p2)
+{
+    const reservoir_entry_t *r1 = (const reservoir_entry_t *)p1;
+    const reservoir_entry_t *r2 = (const reservoir_entry_t *)p2;
+    return r1->begin.time < r2->begin.time ? -1 :
+        r1->begin.time > r2->begin.time;
+}
+
+/* Write the reservoir as one burst, in the order the samples began */
+static int
+reservoir_write(sampler_t *s)
+{
+    sampler_internal_t *internal = (sampler_internal_t *)s->_internal;
+    int err;
+
+    if (!s->sink)
+        return 0;
+
+    qsort(internal->reservoir, internal->reservoir_used,
+          sizeof(reservoir_entry_t), reservoir_entry_comp);
+
+    err = s->sink->burst_begin(s->sink, internal->burst,
+                               internal->reservoir_begin, sampler_rate(s));
+    E_IF(err, -1);
+
+    for (unsigned long i = 0; i < internal->reservoir_used; i++) {
+        reservoir_entry_t *r = &internal->reservoir[i];
+
+        if (r->done)
+            err = s->sink->sample(s->sink, internal->burst, &r->begin,
+                                  &r->end, s->line_size_lg2);
+        else
+            err = s->sink->dangling(s->sink, internal->burst, &r->begin,
+                                    s->line_size_lg2);
+        E_IF(err, -1);
+
+        if (internal->sdist.precision && r->done)
+            err = sdist_sample(&internal->sdist, internal->burst, r->distance);
+        else if (internal->sdist.precision)
+            err = sdist_dangling(&internal->sdist, internal->burst);
+        E_IF(err, -1);
+    }
+
+    if (s->sink->burst_end) {
+        err = s->sink->burst_end(s->sink, internal->burst,
+                                 internal->reservoir_end);
+        E_IF(err, -1);
+    }
+    return 0;
+}
 
 int
 sampler_ref(sampler_t *s, usf_access_t *ref)
@@ -371,9 +982,41 @@ sampler_ref(sampler_t *s, usf_access_t *ref)
     unsigned long time = ref->time;
     sampler_internal_t *internal = (sampler_internal_t *)s->_internal;
 
+    if (s->phase_interval) {
+        if (!internal->phase.interval) {
+            err = phase_init(&internal->phase, s->phase_interval,
+                             s->phase_threshold > 0 ? s->phase_threshold :
+                             PHASE_DEFAULT_THRESHOLD);
+            E_IF(err, -1);
+        }
+        err = phase_ref(&internal->phase, ref->pc);
+        E_IF(err, -1);
+    }
+
+    if (s->sdist_precision) {
+        if (!internal->sdist.precision) {
+            err = sdist_init(&internal->sdist, s->sdist_precision,
+                             s->sdist_bucket ? s->sdist_bucket :
+                             SDIST_DEFAULT_BUCKET);
+            E_IF(err, -1);
+        }
+        err = sdist_ref(&internal->sdist, ref->addr >> s->line_size_lg2,
+                        time);
+        E_IF(err, -1);
+    }
+
+    /* Accesses outside the ranges can't hit a watchpoint */
+    if (!sampler_addr_match(s, ref->addr)) {
+        sampler_ref_skip(s, time);
+        return 0;
+    }
+
     err = sampler_watchpoint_lookup(s, ref);
     E_IF(err, -1);
 
+    if (s->reservoir_size)
+        return reservoir_ref(s, ref);
+
     if (s->burst_size) {
         if (s->burst_end == time) {
             err = sampler_burst_end(s, time);
@@ -382,7 +1025,10 @@ sampler_ref(sampler_t *s, usf_access_t *ref)
             s->burst_begin = time + BURST_RND(s);
         }
 
-        if (s->burst_begin == time) {
+        if (s->burst_begin == time && phase_sampled(s)) {
+            phase_skip(&internal->phase);
+            s->burst_begin = time + MAX(BURST_RND(s), 1);
+        } else if (s->burst_begin == time) {
             err = sampler_burst_begin(s, time);
             E_IF(err, -1);
 
@@ -391,7 +1037,20 @@ sampler_ref(sampler_t *s, usf_access_t *ref)
         }
     }
 
-    if (internal->burst && s->next_sample == time) {
+    if (s->spatial_rate > 0) {
+        /* Every access to a sampled line gets a watchpoint */
+        if (!internal->burst_active ||
+            spatial_hash(ref->addr >> s->line_size_lg2) >= internal->threshold)
+            return 0;
+
+        err = sampler_watchpoint_insert(s, ref);
+        E_IF(err, -1);
+
+        if (s->spatial_budget && internal->no_watchpoints > s->spatial_budget) {
+            err = spatial_lower(s, time);
+            E_IF(err, -1);
+        }
+    } else if (internal->burst_active && s->next_sample == time) {
         err = sampler_watchpoint_insert(s, ref);
         E_IF(err, -1);
     
@@ -401,6 +1060,57 @@ sampler_ref(sampler_t *s, usf_access_t *ref)
     return 0;
 }
 
+void
+sampler_start(sampler_t *s, unsigned long time)
+{
+    if (s->burst_size)
+        s->burst_begin = time + BURST_RND(s);
+    else
+        s->next_sample = time + SAMPLE_RND(s);
+}
+
+void
+sampler_ref_skip(sampler_t *s, unsigned long time)
+{
+    sampler_internal_t *internal = (sampler_internal_t *)s->_internal;
+
+    /* Move the pending events forward instead of consuming them */
+    if (internal->burst_active)
+        s->next_sample++;
+    if (internal->reservoir && internal->burst_active) {
+        internal->reservoir_skipped++;
+        if (time > internal->reservoir_end)
+            internal->reservoir_end = time;
+    }
+    if (s->burst_size && s->burst_begin == time)
+        s->burst_begin++;
+    if (s->burst_size && s->burst_end == time)
+        s->burst_end++;
+}
+
+unsigned long
+sampler_next_event(sampler_t *s)
+{
+    sampler_internal_t *internal = (sampler_internal_t *)s->_internal;
+    unsigned long next = ULONG_MAX;
+
+    if (s->reservoir_size)
+        return internal->burst_active ? s->next_sample : 0;
+
+    /* Any access can be to a sampled line, or every access is needed
+     * for the phase signature or the stack distance sketches */
+    if (s->spatial_rate > 0 || s->phase_interval || s->sdist_precision)
+        return 0;
+
+    if (s->burst_size)
+        next = internal->burst_active ? s->burst_end : s->burst_begin;
+
+    if (internal->burst_active && s->next_sample < next)
+        next = s->next_sample;
+
+    return next;
+}
+
 /*
  * Local Variables:
  * mode: c
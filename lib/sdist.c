@@ -0,0 +1,277 @@
+/*
+ * Copyright (C) 2009-2011, David Eklöv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <inttypes.h>
+
+#include "util.h"
+#include "sdist.h"
+
+int
+sdist_init(sdist_t *sd, unsigned precision, unsigned long width)
+{
+    bzero(sd, sizeof(sdist_t));
+    E_IF(precision < 4 || precision > 16 || !width, -1);
+
+    sd->precision = precision;
+    sd->no_regs   = 1 << precision;
+    sd->width     = width;
+
+    sd->merged = malloc(sd->no_regs);
+    E_IF(!sd->merged, -1);
+    return 0;
+}
+
+void
+sdist_fini(sdist_t *sd)
+{
+    for (unsigned i = 0; i < sd->no_buckets; i++)
+        free(sd->buckets[i]);
+    free(sd->buckets);
+    free(sd->merged);
+    free(sd->bursts);
+}
+
+/* Merge bucket i + 1 into bucket i */
+static void
+bucket_merge(sdist_t *sd, unsigned i)
+{
+    sdist_bucket_t *a = sd->buckets[i];
+    sdist_bucket_t *b = sd->buckets[i + 1];
+
+    for (unsigned r = 0; r < sd->no_regs; r++)
+        a->regs[r] = MAX(a->regs[r], b->regs[r]);
+    a->level++;
+    free(b);
+
+    memmove(&sd->buckets[i + 1], &sd->buckets[i + 2],
+            (sd->no_buckets - i - 2) * sizeof(sdist_bucket_t *));
+    sd->no_buckets--;
+}
+
+int
+sdist_bucket_new(sdist_t *sd, unsigned long time)
+{
+    sdist_bucket_t *b;
+
+    if (sd->no_buckets == sd->max_buckets) {
+        unsigned max = sd->max_buckets ? 2 * sd->max_buckets : 32;
+        sdist_bucket_t **buckets;
+
+        buckets = realloc(sd->buckets, max * sizeof(sdist_bucket_t *));
+        E_IF(!buckets, -1);
+        sd->buckets = buckets;
+        sd->max_buckets = max;
+    }
+
+    b = malloc(sizeof(sdist_bucket_t) + sd->no_regs);
+    E_IF(!b, -1);
+    b->begin = time;
+    b->level = 0;
+    bzero(b->regs, sd->no_regs);
+    sd->buckets[sd->no_buckets++] = b;
+    sd->no_refs = 0;
+
+    /* Levels don't increase from the oldest bucket to the newest, so
+     * the two oldest buckets of a level are adjacent. */
+    for (unsigned level = 0; ; level++) {
+        unsigned first = sd->no_buckets;
+        unsigned count = 0;
+
+        for (unsigned i = sd->no_buckets; i-- > 0; ) {
+            if (sd->buckets[i]->level > level)
+                break;
+            if (sd->buckets[i]->level == level) {
+                first = i;
+                count++;
+            }
+        }
+        if (count <= SDIST_PER_LEVEL)
+            break;
+        bucket_merge(sd, first);
+    }
+    return 0;
+}
+
+static void
+regs_merge(sdist_t *sd, const uint8_t *regs)
+{
+    for (unsigned r = 0; r < sd->no_regs; r++)
+        sd->merged[r] = MAX(sd->merged[r], regs[r]);
+}
+
+static double
+regs_estimate(sdist_t *sd)
+{
+    double   m = sd->no_regs;
+    double   alpha;
+    double   sum = 0;
+    unsigned zeros = 0;
+    double   e;
+
+    for (unsigned r = 0; r < sd->no_regs; r++) {
+        sum += ldexp(1.0, -sd->merged[r]);
+        zeros += !sd->merged[r];
+    }
+
+    switch (sd->no_regs) {
+    case 16: alpha = 0.673; break;
+    case 32: alpha = 0.697; break;
+    case 64: alpha = 0.709; break;
+    default: alpha = 0.7213 / (1 + 1.079 / m); break;
+    }
+
+    e = alpha * m * m / sum;
+    /* Linear counting is better for small cardinalities */
+    if (e <= 2.5 * m && zeros)
+        e = m * log(m / zeros);
+    return e;
+}
+
+double
+sdist_estimate(sdist_t *sd, unsigned long time)
+{
+    unsigned       first = 0;
+    unsigned long  end;
+    double         after = 0;
+    double         all;
+    double         frac;
+
+    if (!sd->no_buckets)
+        return 0;
+
+    for (unsigned i = sd->no_buckets; i-- > 0; ) {
+        if (sd->buckets[i]->begin <= time) {
+            first = i;
+            break;
+        }
+    }
+
+    bzero(sd->merged, sd->no_regs);
+    for (unsigned i = first + 1; i < sd->no_buckets; i++)
+        regs_merge(sd, sd->buckets[i]->regs);
+    if (first + 1 < sd->no_buckets)
+        after = regs_estimate(sd);
+
+    regs_merge(sd, sd->buckets[first]->regs);
+    all = regs_estimate(sd);
+
+    /* Assume that the lines of the first bucket are spread evenly
+     * over it */
+    end = first + 1 < sd->no_buckets ? sd->buckets[first + 1]->begin :
+        sd->last_time + 1;
+    if (time < sd->buckets[first]->begin || end <= sd->buckets[first]->begin)
+        frac = 1;
+    else
+        frac = (double)(end - MIN(time, end)) /
+            (end - sd->buckets[first]->begin);
+
+    return after + frac * MAX(all - after, 0.0);
+}
+
+static sdist_burst_t *
+burst_get(sdist_t *sd, unsigned long burst)
+{
+    if (burst >= sd->no_bursts) {
+        unsigned long no = sd->no_bursts ? 2 * sd->no_bursts : 16;
+        sdist_burst_t *bursts;
+
+        while (no <= burst)
+            no *= 2;
+        bursts = realloc(sd->bursts, no * sizeof(sdist_burst_t));
+        E_IF(!bursts, NULL);
+        bzero(bursts + sd->no_bursts,
+              (no - sd->no_bursts) * sizeof(sdist_burst_t));
+        sd->bursts = bursts;
+        sd->no_bursts = no;
+    }
+    return &sd->bursts[burst];
+}
+
+int
+sdist_sample(sdist_t *sd, unsigned long burst, double distance)
+{
+    sdist_burst_t *b = burst_get(sd, burst);
+    int            bin;
+
+    E_IF(!b, -1);
+    bin = distance < 1 ? 0 : ilogb(distance + 1);
+    b->hist[MIN(bin, SDIST_HIST_SIZE - 1)]++;
+    b->no_samples++;
+    return 0;
+}
+
+int
+sdist_dangling(sdist_t *sd, unsigned long burst)
+{
+    sdist_burst_t *b = burst_get(sd, burst);
+
+    E_IF(!b, -1);
+    b->no_dangling++;
+    return 0;
+}
+
+int
+sdist_write(sdist_t *sd, FILE *f)
+{
+    fprintf(f, "# precision: %u bucket: %lu buckets: %u\n",
+            sd->precision, sd->width, sd->no_buckets);
+    fprintf(f, "# Histogram entries are log2(stack distance + 1):count.\n");
+    fprintf(f, "# burst samples dangling histogram\n");
+
+    for (unsigned long i = 0; i < sd->no_bursts; i++) {
+        sdist_burst_t *b = &sd->bursts[i];
+
+        if (!b->no_samples && !b->no_dangling)
+            continue;
+
+        fprintf(f, "%lu %" PRIu64 " %" PRIu64, i, b->no_samples,
+                b->no_dangling);
+        for (int bin = 0; bin < SDIST_HIST_SIZE; bin++) {
+            if (b->hist[bin])
+                fprintf(f, " %d:%" PRIu64, bin, b->hist[bin]);
+        }
+        fprintf(f, "\n");
+    }
+
+    return ferror(f) ? -1 : 0;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2009-2011, David Eklöv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SDIST_H
+#define SDIST_H
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Stack distance estimation. Every access is added to a HyperLogLog
+ * sketch of the time bucket it falls in. Buckets are merged pairwise
+ * as they get older, at most SDIST_PER_LEVEL buckets are kept per
+ * size, so the memory grows with the log of the run length. The
+ * distinct lines since an access are estimated by merging the sketches
+ * of the buckets after its bucket and interpolating over the part of
+ * its own bucket that follows it.
+ */
+
+#define SDIST_PER_LEVEL 4
+#define SDIST_HIST_SIZE 64
+
+typedef struct {
+    unsigned long   begin;      /* Time of the first access */
+    unsigned        level;      /* Covers 2^level base buckets */
+    uint8_t         regs[];
+} sdist_bucket_t;
+
+typedef struct {
+    uint64_t        hist[SDIST_HIST_SIZE];  /* log2(distance + 1) */
+    uint64_t        no_samples;
+    uint64_t        no_dangling;
+} sdist_burst_t;
+
+typedef struct {
+    unsigned        precision;
+    unsigned        no_regs;
+    unsigned long   width;      /* Accesses per base bucket */
+
+    /* Oldest first */
+    sdist_bucket_t **buckets;
+    unsigned        no_buckets;
+    unsigned        max_buckets;
+    unsigned long   no_refs;    /* In the newest bucket */
+    unsigned long   last_time;
+    uint8_t        *merged;
+
+    sdist_burst_t  *bursts;
+    unsigned long   no_bursts;
+} sdist_t;
+
+int  uart_sampler_sdist_init(sdist_t *sd, unsigned precision,
+                             unsigned long width);
+void uart_sampler_sdist_fini(sdist_t *sd);
+
+/* Start a new bucket at time */
+int  uart_sampler_sdist_bucket_new(sdist_t *sd, unsigned long time);
+
+/* Estimated distinct lines accessed since time */
+double uart_sampler_sdist_estimate(sdist_t *sd, unsigned long time);
+
+/* Add a sample with the given distance, or a dangling sample */
+int  uart_sampler_sdist_sample(sdist_t *sd, unsigned long burst,
+                               double distance);
+int  uart_sampler_sdist_dangling(sdist_t *sd, unsigned long burst);
+
+/* Write the histogram of every burst */
+int  uart_sampler_sdist_write(sdist_t *sd, FILE *f);
+
+static inline int
+sdist_ref(sdist_t *sd, uint64_t line, unsigned long time)
+{
+    uint8_t *regs;
+    uint64_t h;
+    unsigned rank;
+
+    if (!sd->no_buckets || sd->no_refs == sd->width) {
+        if (uart_sampler_sdist_bucket_new(sd, time))
+            return -1;
+    }
+    sd->no_refs++;
+    sd->last_time = time;
+
+    h = line * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 29;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 32;
+
+    /* The top bits select the register, the rest give the rank */
+    rank = __builtin_clzll((h << sd->precision) |
+                           (1ULL << (sd->precision - 1))) + 1;
+    regs = sd->buckets[sd->no_buckets - 1]->regs;
+    if (rank > regs[h >> (64 - sd->precision)])
+        regs[h >> (64 - sd->precision)] = rank;
+    return 0;
+}
+
+#define sdist_init       uart_sampler_sdist_init
+#define sdist_fini       uart_sampler_sdist_fini
+#define sdist_bucket_new uart_sampler_sdist_bucket_new
+#define sdist_estimate   uart_sampler_sdist_estimate
+#define sdist_sample     uart_sampler_sdist_sample
+#define sdist_dangling   uart_sampler_sdist_dangling
+#define sdist_write      uart_sampler_sdist_write
+
+#endif /* SDIST_H */
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
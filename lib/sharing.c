@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2009-2011, David Eklöv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <inttypes.h>
+
+#include "util.h"
+#include "sharing.h"
+
+#define DEFAULT_TABLE_SIZE 1024
+
+static const char *kind_names[SHARING_KINDS] = { "read", "true", "false" };
+
+int
+sharing_init(sharing_t *sh, unsigned table_size)
+{
+    int err;
+
+    bzero(sh, sizeof(sharing_t));
+    if (!table_size)
+        table_size = DEFAULT_TABLE_SIZE;
+
+    err = topk_init(&sh->lines, table_size, sizeof(sharing_stats_t));
+    E_IF(err, -1);
+    err = topk_init(&sh->pairs, table_size, sizeof(sharing_stats_t));
+    if (err) {
+        topk_fini(&sh->lines);
+        return -1;
+    }
+    return 0;
+}
+
+void
+sharing_fini(sharing_t *sh)
+{
+    topk_fini(&sh->lines);
+    topk_fini(&sh->pairs);
+}
+
+static inline int
+is_write(usf_access_t *a)
+{
+    return a->type == USF_ATYPE_WR || a->type == USF_ATYPE_RW;
+}
+
+/* Bytes of the line touched by the access. Lines larger than 64 bytes
+ * are tracked with a coarser granularity. */
+static uint64_t
+line_mask(usf_access_t *a, unsigned line_size_lg2)
+{
+    uint64_t offset_mask = (1ULL << line_size_lg2) - 1;
+    unsigned gran = line_size_lg2 > 6 ? line_size_lg2 - 6 : 0;
+    uint64_t first = a->addr & offset_mask;
+    uint64_t last = first + MAX(a->len, 1) - 1;
+    unsigned n;
+
+    /* Accesses crossing the line only count up to its end */
+    if (last > offset_mask)
+        last = offset_mask;
+
+    first >>= gran;
+    last >>= gran;
+    n = last - first + 1;
+    return (n >= 64 ? ~0ULL : (1ULL << n) - 1) << first;
+}
+
+/* The key of a PC pair, collisions are unlikely enough to ignore */
+static inline uint64_t
+pair_key(uint64_t begin_pc, uint64_t end_pc)
+{
+    uint64_t k = begin_pc * 0x9e3779b97f4a7c15ULL ^ end_pc;
+    k ^= k >> 31;
+    k *= 0xbf58476d1ce4e5b9ULL;
+    return k ^ (k >> 29);
+}
+
+int
+sharing_sample(sharing_t *sh, usf_access_t *begin, usf_access_t *end,
+               unsigned line_size_lg2)
+{
+    topk_entry_t    *e;
+    sharing_stats_t *stats;
+    int              kind;
+
+    sh->no_samples++;
+    if (begin->tid == end->tid) {
+        sh->no_private++;
+        return 0;
+    }
+
+    if (!is_write(begin) && !is_write(end))
+        kind = SHARING_READ;
+    else if (line_mask(begin, line_size_lg2) & line_mask(end, line_size_lg2))
+        kind = SHARING_TRUE;
+    else
+        kind = SHARING_FALSE;
+    sh->count[kind]++;
+
+    e = topk_add(&sh->lines, begin->addr >> line_size_lg2, 1);
+    stats = TOPK_PAYLOAD(e);
+    stats->count[kind]++;
+
+    e = topk_add(&sh->pairs, pair_key(begin->pc, end->pc), 1);
+    stats = TOPK_PAYLOAD(e);
+    stats->begin_pc = begin->pc;
+    stats->end_pc = end->pc;
+    stats->count[kind]++;
+
+    return 0;
+}
+
+static int
+table_write(topk_t *t, FILE *f, int pairs, unsigned line_size_lg2)
+{
+    topk_entry_t **sorted = topk_sorted(t);
+
+    E_IF(!sorted, -1);
+
+    for (unsigned i = 0; i < t->size; i++) {
+        topk_entry_t    *e = sorted[i];
+        sharing_stats_t *stats = TOPK_PAYLOAD(e);
+
+        if (pairs)
+            fprintf(f, "pair %u 0x%" PRIx64 " 0x%" PRIx64, i + 1,
+                    stats->begin_pc, stats->end_pc);
+        else
+            fprintf(f, "line %u 0x%" PRIx64, i + 1,
+                    e->key << line_size_lg2);
+        fprintf(f, " %" PRIu64 " %" PRIu64, e->count, e->error);
+        for (int k = 0; k < SHARING_KINDS; k++)
+            fprintf(f, " %" PRIu64, stats->count[k]);
+        fprintf(f, "\n");
+    }
+
+    free(sorted);
+    return 0;
+}
+
+int
+sharing_write(sharing_t *sh, FILE *f, unsigned line_size_lg2)
+{
+    int err;
+
+    fprintf(f, "# samples: %" PRIu64 " private: %" PRIu64,
+            sh->no_samples, sh->no_private);
+    for (int k = 0; k < SHARING_KINDS; k++)
+        fprintf(f, " %s: %" PRIu64, kind_names[k], sh->count[k]);
+    fprintf(f, "\n");
+    fprintf(f, "# Only samples between threads are counted. error is the\n"
+            "# largest possible overcount of samples.\n");
+
+    fprintf(f, "# line rank addr samples error read true false\n");
+    err = table_write(&sh->lines, f, 0, line_size_lg2);
+    E_IF(err, -1);
+
+    fprintf(f, "# pair rank begin_pc end_pc samples error read true false\n");
+    err = table_write(&sh->pairs, f, 1, line_size_lg2);
+    E_IF(err, -1);
+
+    return ferror(f) ? -1 : 0;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
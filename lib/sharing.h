@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2009-2011, David Eklöv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SHARING_H
+#define SHARING_H
+#include <stdio.h>
+#include <stdint.h>
+#include <uart/usf.h>
+#include "topk.h"
+
+/*
+ * Sharing classification of the samples. A sample whose two accesses
+ * come from different threads is communication. It is read sharing if
+ * neither access writes, true sharing if the byte ranges of the two
+ * accesses overlap and false sharing otherwise. The most frequent
+ * lines and PC pairs are kept in bounded tables, see topk.h.
+ */
+
+enum {
+    SHARING_READ = 0,
+    SHARING_TRUE,
+    SHARING_FALSE,
+    SHARING_KINDS
+};
+
+typedef struct {
+    uint64_t    begin_pc;       /* PC pairs only */
+    uint64_t    end_pc;
+    uint64_t    count[SHARING_KINDS];
+} sharing_stats_t;
+
+typedef struct {
+    topk_t      lines;
+    topk_t      pairs;
+    uint64_t    no_samples;
+    uint64_t    no_private;
+    uint64_t    count[SHARING_KINDS];
+} sharing_t;
+
+int  uart_sampler_sharing_init(sharing_t *sh, unsigned table_size);
+void uart_sampler_sharing_fini(sharing_t *sh);
+
+int  uart_sampler_sharing_sample(sharing_t *sh, usf_access_t *begin,
+                                 usf_access_t *end, unsigned line_size_lg2);
+
+/* Write the lines and PC pairs ranked by the number of sharing samples */
+int  uart_sampler_sharing_write(sharing_t *sh, FILE *f,
+                                unsigned line_size_lg2);
+
+#define sharing_init   uart_sampler_sharing_init
+#define sharing_fini   uart_sampler_sharing_fini
+#define sharing_sample uart_sampler_sharing_sample
+#define sharing_write  uart_sampler_sharing_write
+
+#endif /* SHARING_H */
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
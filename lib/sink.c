@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2009-2011, David Eklöv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "util.h"
+#include "container.h"
+#include "columnar.h"
+#include "journal.h"
+#include "pcprof.h"
+#include <uart/sampler.h>
+
+/*
+ * USF sink, one file per burst, <base>.<burst>. The files are kept
+ * open until the sink is finalized since late samples can still
+ * arrive for old bursts.
+ */
+
+typedef struct {
+    sampler_sink_t    sink;
+    char             *base_path;
+    usf_flags_t       flags;
+    usf_line_sizes_t  line_sizes;
+
+    usf_file_t      **files;
+    unsigned long     no_files;
+    unsigned long     max_files;
+} sink_usf_t;
+
+static int
+sink_usf_burst_begin(sampler_sink_t *sink, unsigned long burst,
+                     unsigned long time, double rate)
+{
+    sink_usf_t  *u = (sink_usf_t *)sink;
+    usf_header_t header;
+    usf_error_t  error;
+    usf_event_t  event;
+    char         path[256];
+    char         rate_arg[64];
+    char        *argv[1] = { rate_arg };
+
+    if (burst >= u->max_files) {
+        unsigned long max = u->max_files ? 2 * u->max_files : 64;
+        usf_file_t **files;
+
+        while (max <= burst)
+            max *= 2;
+
+        files = realloc(u->files, max * sizeof(usf_file_t *));
+        E_IF(!files, -1);
+        bzero(files + u->max_files, (max - u->max_files) * sizeof(usf_file_t *));
+        u->files = files;
+        u->max_files = max;
+    }
+    E_IF(u->files[burst], -1);
+
+    header.version = USF_VERSION_CURRENT;
+    header.compression = USF_COMPRESSION_BZIP2;
+    header.flags = u->flags;
+    header.time_begin = 0;
+    header.time_end = 0;
+    header.line_sizes = u->line_sizes;
+    /* Analyses need the rate to weight the samples */
+    snprintf(rate_arg, sizeof(rate_arg), SAMPLER_RATE_ARG "%.9g", rate);
+    header.argc = 1;
+    header.argv = argv;
+
+    snprintf(path, 256, "%s.%lu", u->base_path, burst);
+    error = usf_create(&u->files[burst], path, &header);
+    E_USF(error, -1);
+    if (burst >= u->no_files)
+        u->no_files = burst + 1;
+
+    event.type = USF_EVENT_BURST;
+    event.u.burst.begin_time = time;
+
+    error = usf_append(u->files[burst], &event);
+    E_USF(error, -1);
+    return 0;
+}
+
+static int
+sink_usf_sample(sampler_sink_t *sink, unsigned long burst,
+                usf_access_t *begin, usf_access_t *end,
+                usf_line_size_2_t line_size_lg2)
+{
+    sink_usf_t  *u = (sink_usf_t *)sink;
+    usf_event_t  event;
+    usf_error_t  error;
+
+    E_IF(burst >= u->no_files || !u->files[burst], -1);
+
+    event.type = USF_EVENT_SAMPLE;
+    event.u.sample.begin = *begin;
+    event.u.sample.end = *end;
+    event.u.sample.line_size = line_size_lg2;
+
+    error = usf_append(u->files[burst], &event);
+    E_USF(error, -1);
+    return 0;
+}
+
+static int
+sink_usf_dangling(sampler_sink_t *sink, unsigned long burst,
+                  usf_access_t *begin, usf_line_size_2_t line_size_lg2)
+{
+    sink_usf_t  *u = (sink_usf_t *)sink;
+    usf_event_t  event;
+    usf_error_t  error;
+
+    E_IF(burst >= u->no_files || !u->files[burst], -1);
+
+    event.type = USF_EVENT_DANGLING;
+    event.u.dangling.begin = *begin;
+    event.u.dangling.line_size = line_size_lg2;
+
+    error = usf_append(u->files[burst], &event);
+    E_USF(error, -1);
+    return 0;
+}
+
+static void
+sink_usf_discard(sampler_sink_t *sink)
+{
+    sink_usf_t *u = (sink_usf_t *)sink;
+
+    free(u->files);
+    free(u->base_path);
+    free(u);
+}
+
+static int
+sink_usf_fini(sampler_sink_t *sink)
+{
+    sink_usf_t  *u = (sink_usf_t *)sink;
+    usf_error_t  error;
+    int          err = 0;
+
+    for (unsigned long i = 0; i < u->no_files; i++) {
+        if (!u->files[i])
+            continue;
+
+        error = usf_close(u->files[i]);
+        if (error != USF_ERROR_OK)
+            err = -1;
+    }
+
+    sink_usf_discard(sink);
+    E_IF(err, -1);
+    return 0;
+}
+
+static sampler_sink_t *
+sink_usf_new(const char *base_path, usf_flags_t flags,
+             usf_line_sizes_t line_sizes)
+{
+    sink_usf_t *u;
+
+    u = malloc(sizeof(sink_usf_t));
+    E_IF(!u, NULL);
+    bzero(u, sizeof(sink_usf_t));
+
+    u->base_path = strdup(base_path);
+    if (!u->base_path) {
+        free(u);
+        return NULL;
+    }
+    u->flags = flags;
+    u->line_sizes = line_sizes;
+
+    u->sink.burst_begin = sink_usf_burst_begin;
+    u->sink.sample = sink_usf_sample;
+    u->sink.dangling = sink_usf_dangling;
+    u->sink.fini = sink_usf_fini;
+    u->sink.discard = sink_usf_discard;
+    return &u->sink;
+}
+
+
+sampler_sink_t *
+sampler_sink_create(sampler_t *s, sampler_output_t output)
+{
+    char path[256];
+
+    switch (output) {
+    case SAMPLER_OUTPUT_USF:
+        return sink_usf_new(s->usf_base_path, s->usf_flags,
+                            1 << s->line_size_lg2);
+
+    case SAMPLER_OUTPUT_CONTAINER:
+        snprintf(path, 256, "%s.usfc", s->usf_base_path);
+        return container_sink_new(path, s->usf_flags, 1 << s->line_size_lg2);
+
+    case SAMPLER_OUTPUT_COLUMNAR:
+        snprintf(path, 256, "%s.usfx", s->usf_base_path);
+        return columnar_sink_new(path, s->usf_flags, s->line_size_lg2);
+
+    case SAMPLER_OUTPUT_JOURNAL:
+        snprintf(path, 256, "%s.usfj", s->usf_base_path);
+        return journal_sink_new(path, s->usf_flags, 1 << s->line_size_lg2,
+                                s->journal_size);
+
+    case SAMPLER_OUTPUT_PCPROF:
+        snprintf(path, 256, "%s.pcprof", s->usf_base_path);
+        return pcprof_sink_new(path, s->pc_table_size);
+
+    default:
+        return NULL;
+    }
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
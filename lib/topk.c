@@ -0,0 +1,234 @@
+/*
+ * Copyright (C) 2009-2011, David Eklöv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "topk.h"
+
+#define ENTRY(_t, _i) ((topk_entry_t *)((_t)->entries + (size_t)(_i) * (_t)->stride))
+
+static inline unsigned
+key_hash(topk_t *t, uint64_t key)
+{
+    return (unsigned)((key * 0x9e3779b97f4a7c15ULL) >> 32) & t->table_mask;
+}
+
+static unsigned
+table_find(topk_t *t, uint64_t key)
+{
+    unsigned i;
+
+    for (i = key_hash(t, key); t->table[i]; i = (i + 1) & t->table_mask) {
+        if (ENTRY(t, t->table[i] - 1)->key == key)
+            return i;
+    }
+    return i;
+}
+
+/* Backward shift deletion, keeps the probe sequences intact */
+static void
+table_remove(topk_t *t, unsigned i)
+{
+    unsigned j = i;
+
+    t->table[i] = 0;
+    for (;;) {
+        unsigned h;
+
+        j = (j + 1) & t->table_mask;
+        if (!t->table[j])
+            return;
+
+        h = key_hash(t, ENTRY(t, t->table[j] - 1)->key);
+        /* Move the entry at j to i unless h is cyclically in (i, j] */
+        if (i <= j ? (i < h && h <= j) : (i < h || h <= j))
+            continue;
+
+        t->table[i] = t->table[j];
+        t->table[j] = 0;
+        i = j;
+    }
+}
+
+static void
+heap_swap(topk_t *t, unsigned a, unsigned b)
+{
+    unsigned tmp = t->heap[a];
+
+    t->heap[a] = t->heap[b];
+    t->heap[b] = tmp;
+    ENTRY(t, t->heap[a])->heap_pos = a;
+    ENTRY(t, t->heap[b])->heap_pos = b;
+}
+
+static void
+heap_down(topk_t *t, unsigned pos)
+{
+    for (;;) {
+        unsigned l = 2 * pos + 1, r = l + 1, min = pos;
+
+        if (l < t->size &&
+            ENTRY(t, t->heap[l])->count < ENTRY(t, t->heap[min])->count)
+            min = l;
+        if (r < t->size &&
+            ENTRY(t, t->heap[r])->count < ENTRY(t, t->heap[min])->count)
+            min = r;
+        if (min == pos)
+            return;
+
+        heap_swap(t, pos, min);
+        pos = min;
+    }
+}
+
+static void
+heap_up(topk_t *t, unsigned pos)
+{
+    while (pos) {
+        unsigned parent = (pos - 1) / 2;
+
+        if (ENTRY(t, t->heap[parent])->count <= ENTRY(t, t->heap[pos])->count)
+            return;
+        heap_swap(t, pos, parent);
+        pos = parent;
+    }
+}
+
+int
+uart_sampler_topk_init(topk_t *t, unsigned capacity, size_t payload_size)
+{
+    unsigned table_size = 1;
+
+    bzero(t, sizeof(*t));
+    if (!capacity)
+        return 1;
+
+    while (table_size < 2 * capacity)
+        table_size <<= 1;
+
+    t->capacity = capacity;
+    t->stride = (sizeof(topk_entry_t) + payload_size + 7) & ~(size_t)7;
+    t->entries = malloc(capacity * t->stride);
+    t->heap = malloc(capacity * sizeof(unsigned));
+    t->table = calloc(table_size, sizeof(unsigned));
+    t->table_mask = table_size - 1;
+
+    if (!t->entries || !t->heap || !t->table) {
+        topk_fini(t);
+        return 1;
+    }
+    return 0;
+}
+
+void
+uart_sampler_topk_fini(topk_t *t)
+{
+    free(t->entries);
+    free(t->heap);
+    free(t->table);
+    bzero(t, sizeof(*t));
+}
+
+topk_entry_t *
+uart_sampler_topk_add(topk_t *t, uint64_t key, uint64_t weight)
+{
+    unsigned      slot = table_find(t, key);
+    topk_entry_t *e;
+    unsigned      idx;
+
+    if (t->table[slot]) {
+        e = ENTRY(t, t->table[slot] - 1);
+        e->count += weight;
+        heap_down(t, e->heap_pos);
+        return e;
+    }
+
+    if (t->size < t->capacity) {
+        idx = t->size++;
+        e = ENTRY(t, idx);
+        bzero(e, t->stride);
+        e->heap_pos = idx;
+        t->heap[idx] = idx;
+    } else {
+        /* Replace the entry with the lowest count */
+        idx = t->heap[0];
+        e = ENTRY(t, idx);
+        table_remove(t, table_find(t, e->key));
+        slot = table_find(t, key);
+
+        e->error = e->count;
+        bzero(TOPK_PAYLOAD(e), t->stride - sizeof(topk_entry_t));
+    }
+
+    e->key = key;
+    e->count += weight;
+    t->table[slot] = idx + 1;
+
+    heap_up(t, e->heap_pos);
+    heap_down(t, e->heap_pos);
+    return e;
+}
+
+static int
+entry_comp(const void *p1, const void *p2)
+{
+    const topk_entry_t *e1 = *(topk_entry_t **)p1;
+    const topk_entry_t *e2 = *(topk_entry_t **)p2;
+
+    if (e1->count != e2->count)
+        return e1->count < e2->count ? 1 : -1;
+    return e1->key < e2->key ? -1 : e1->key > e2->key;
+}
+
+topk_entry_t **
+uart_sampler_topk_sorted(topk_t *t)
+{
+    topk_entry_t **sorted;
+
+    sorted = malloc((t->size ? t->size : 1) * sizeof(topk_entry_t *));
+    if (!sorted)
+        return NULL;
+
+    for (unsigned i = 0; i < t->size; i++)
+        sorted[i] = ENTRY(t, i);
+    qsort(sorted, t->size, sizeof(topk_entry_t *), entry_comp);
+    return sorted;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
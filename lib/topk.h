@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2009-2011, David Eklöv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TOPK_H
+#define TOPK_H
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Bounded heavy hitter table (Space-Saving). Keeps at most capacity
+ * keys. A key that isn't in a full table replaces the key with the
+ * lowest count and inherits that count, which is remembered as the
+ * maximum overestimation. Every entry has a payload of payload_size
+ * bytes that is zeroed when the entry is (re)used.
+ */
+
+typedef struct {
+    uint64_t  key;
+    uint64_t  count;
+    uint64_t  error;
+    unsigned  heap_pos;
+} topk_entry_t;
+
+typedef struct {
+    unsigned   capacity;
+    unsigned   size;
+    size_t     stride;
+    uint8_t   *entries;
+    unsigned  *heap;        /* Min-heap of entries by count */
+    unsigned  *table;       /* Open addressing, entry index + 1 */
+    unsigned   table_mask;
+} topk_t;
+
+#define TOPK_PAYLOAD(_e) ((void *)((topk_entry_t *)(_e) + 1))
+
+int  uart_sampler_topk_init(topk_t *t, unsigned capacity, size_t payload_size);
+void uart_sampler_topk_fini(topk_t *t);
+
+/* Add weight to key, returns the entry of key */
+topk_entry_t *uart_sampler_topk_add(topk_t *t, uint64_t key, uint64_t weight);
+
+/* Entries sorted by decreasing count, the array is allocated with
+ * malloc() and has topk->size elements. */
+topk_entry_t **uart_sampler_topk_sorted(topk_t *t);
+
+#define topk_init   uart_sampler_topk_init
+#define topk_fini   uart_sampler_topk_fini
+#define topk_add    uart_sampler_topk_add
+#define topk_sorted uart_sampler_topk_sorted
+
+#endif /* TOPK_H */
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2009-2011, David Eklöv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef UTIL_H
+#define UTIL_H
+#include <stdio.h>
+
+#define MAX(_a, _b) ({                          \
+            __typeof__(_a) __a = _a;            \
+            __typeof__(_b) __b = _b;            \
+            __a < __b ? __b : __a;              \
+        })
+
+#define MIN(_a, _b) ({                          \
+            __typeof__(_a) __a = _a;            \
+            __typeof__(_b) __b = _b;            \
+            __a < __b ? __a : __b;              \
+        })
+
+#define E_IF(_cond, _ret) do {                  \
+        if (_cond) {                            \
+            _LOG("error: %s", #_cond);          \
+            return _ret;                        \
+        }                                       \
+    } while (0)
+#define E_USF(error, _ret) E_IF((error) != USF_ERROR_OK, _ret) 
+
+
+#ifdef DEBUG
+static int log_level = 0;
+#define _LOG(_fmt, _args...) do {                                       \
+        printf("%s:%d: " _fmt "\n", __FUNCTION__, __LINE__, ##_args);   \
+    } while (0)
+
+#define LOG(_l, _fmt, _args...) do {            \
+        if (_l <= log_level)                    \
+            _LOG(_fmt, ##_args);                \
+    } while (0)
+#else
+#define _LOG(_fmt, _args...)
+#define LOG(_l, _fmt, _args...)
+#endif
+
+#endif /* UTIL_H */
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2009-2011, Andreas Sandberg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <iostream>
+#include <vector>
+#include <utility>
+#include <stdlib.h>
+
+#include "pin.H"
+#include "pin_filter.h"
+
+using namespace std;
+
+KNOB<string> knob_img_incl(KNOB_MODE_APPEND, "pintool", "img_incl", "",
+			   "Only instrument images whose name contains this");
+
+KNOB<string> knob_img_excl(KNOB_MODE_APPEND, "pintool", "img_excl", "",
+			   "Don't instrument images whose name contains this");
+
+KNOB<string> knob_rtn_incl(KNOB_MODE_APPEND, "pintool", "rtn_incl", "",
+			   "Only instrument the named routine");
+
+KNOB<string> knob_rtn_excl(KNOB_MODE_APPEND, "pintool", "rtn_excl", "",
+			   "Don't instrument the named routine");
+
+KNOB<string> knob_pc_incl(KNOB_MODE_APPEND, "pintool", "pc_incl", "",
+			  "Only instrument code in the PC range BEGIN:END");
+
+KNOB<string> knob_pc_excl(KNOB_MODE_APPEND, "pintool", "pc_excl", "",
+			  "Don't instrument code in the PC range BEGIN:END");
+
+KNOB<BOOL> knob_skip_stack(KNOB_MODE_WRITEONCE, "pintool", "skip_stack", "0",
+			   "Don't instrument stack pointer relative accesses");
+
+
+typedef vector<pair<ADDRINT, ADDRINT> > range_list_t;
+
+static range_list_t pc_incl;
+static range_list_t pc_excl;
+
+/* Image and routine decisions are made once per routine. */
+static ADDRINT last_rtn_addr = 0;
+static BOOL last_rtn_ok = FALSE;
+
+
+static int
+parse_ranges(KNOB<string> &knob, range_list_t &ranges)
+{
+    for (UINT32 i = 0; i < knob.NumberOfValues(); i++) {
+	const string &str = knob.Value(i);
+	ADDRINT begin, end;
+
+	if (str == "")
+	    continue;
+
+	if (!filter_parse_range(str, begin, end)) {
+	    cerr << "Illegal PC range: " << str << endl;
+	    return 1;
+	}
+
+	ranges.push_back(make_pair(begin, end));
+    }
+
+    return 0;
+}
+
+static BOOL
+in_ranges(const range_list_t &ranges, ADDRINT addr)
+{
+    for (range_list_t::const_iterator it = ranges.begin();
+	 it != ranges.end(); ++it) {
+	if (addr >= it->first && addr < it->second)
+	    return TRUE;
+    }
+
+    return FALSE;
+}
+
+static BOOL
+knob_empty(KNOB<string> &knob)
+{
+    for (UINT32 i = 0; i < knob.NumberOfValues(); i++) {
+	if (knob.Value(i) != "")
+	    return FALSE;
+    }
+    return TRUE;
+}
+
+static BOOL
+knob_match(KNOB<string> &knob, const string &name, BOOL substr)
+{
+    for (UINT32 i = 0; i < knob.NumberOfValues(); i++) {
+	const string &pattern = knob.Value(i);
+
+	if (pattern == "")
+	    continue;
+
+	if (substr ? name.find(pattern) != string::npos : name == pattern)
+	    return TRUE;
+    }
+
+    return FALSE;
+}
+
+static BOOL
+filter_rtn(ADDRINT addr, RTN rtn)
+{
+    const BOOL valid = RTN_Valid(rtn);
+    IMG img = valid ? SEC_Img(RTN_Sec(rtn)) : IMG_FindByAddress(addr);
+
+    if (IMG_Valid(img)) {
+	const string &name = IMG_Name(img);
+
+	if (!knob_empty(knob_img_incl) && !knob_match(knob_img_incl, name, TRUE))
+	    return FALSE;
+	if (knob_match(knob_img_excl, name, TRUE))
+	    return FALSE;
+    } else if (!knob_empty(knob_img_incl))
+	return FALSE;
+
+    if (valid) {
+	const string &name = RTN_Name(rtn);
+	const string plain = PIN_UndecorateSymbolName(name, UNDECORATION_NAME_ONLY);
+
+	if (!knob_empty(knob_rtn_incl) &&
+	    !knob_match(knob_rtn_incl, name, FALSE) &&
+	    !knob_match(knob_rtn_incl, plain, FALSE))
+	    return FALSE;
+	if (knob_match(knob_rtn_excl, name, FALSE) ||
+	    knob_match(knob_rtn_excl, plain, FALSE))
+	    return FALSE;
+    } else if (!knob_empty(knob_rtn_incl))
+	return FALSE;
+
+    return TRUE;
+}
+
+BOOL
+filter_parse_range(const string &str, ADDRINT &begin, ADDRINT &end)
+{
+    char *p;
+
+    begin = strtoull(str.c_str(), &p, 0);
+    if (*p != ':')
+	return FALSE;
+
+    end = strtoull(p + 1, &p, 0);
+    return *p == '\0' && begin < end;
+}
+
+int
+filter_init()
+{
+    if (parse_ranges(knob_pc_incl, pc_incl) ||
+	parse_ranges(knob_pc_excl, pc_excl))
+	return 1;
+
+    return 0;
+}
+
+BOOL
+filter_code(ADDRINT addr, RTN rtn)
+{
+    if (!pc_incl.empty() && !in_ranges(pc_incl, addr))
+	return FALSE;
+    if (in_ranges(pc_excl, addr))
+	return FALSE;
+
+    if (RTN_Valid(rtn)) {
+	if (RTN_Address(rtn) != last_rtn_addr) {
+	    last_rtn_addr = RTN_Address(rtn);
+	    last_rtn_ok = filter_rtn(addr, rtn);
+	}
+	return last_rtn_ok;
+    }
+
+    return filter_rtn(addr, rtn);
+}
+
+BOOL
+filter_memop(INS ins, UINT32 op)
+{
+    if (!knob_skip_stack)
+	return TRUE;
+
+    const UINT32 idx = INS_MemoryOperandIndexToOperandIndex(ins, op);
+    return INS_OperandMemoryBaseReg(ins, idx) != REG_STACK_PTR;
+}
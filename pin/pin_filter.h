@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2009-2011, Andreas Sandberg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PIN_FILTER_H
+#define PIN_FILTER_H
+
+#include "pin.H"
+
+/*
+ * Static instrumentation filters shared by the Pin tools. The filters
+ * are applied when code is instrumented, code that doesn't pass them
+ * doesn't get any analysis calls at all.
+ */
+
+/* Parse an address range on the form BEGIN:END. */
+BOOL filter_parse_range(const std::string &str, ADDRINT &begin, ADDRINT &end);
+
+/* Parse the filter knobs, returns non-zero on error. */
+int filter_init();
+
+/* TRUE if the code at addr, belonging to rtn (which may be invalid),
+ * should be instrumented. */
+BOOL filter_code(ADDRINT addr, RTN rtn);
+
+/* TRUE if memory operand op of ins should be instrumented. */
+BOOL filter_memop(INS ins, UINT32 op);
+
+#endif /* PIN_FILTER_H */
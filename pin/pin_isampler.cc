@@ -34,13 +34,15 @@
 #include "pin.H"
 #include <uart/sampler.h>
 
+#include "pin_filter.h"
+
 using namespace std;
 
 KNOB<string> knob_smp_base(KNOB_MODE_WRITEONCE, "pintool", "o", "sample",
 			   "Output file base name.");
 
 KNOB<unsigned long> knob_smp_period(KNOB_MODE_WRITEONCE, "pintool", "p", "100000",
-				    "Average time between samples");
+				    "Average number of fetched lines between samples");
 
 KNOB<string> knob_smp_rnd(KNOB_MODE_WRITEONCE, "pintool", "r", "exp",
 			  "Random generator exp/const");
@@ -63,47 +65,114 @@ KNOB<unsigned> knob_seed(KNOB_MODE_WRITEONCE, "pintool", "s", "0",
 KNOB<int> knob_log_level(KNOB_MODE_WRITEONCE, "pintool", "v", "0",
 			 "Log level");
 
+KNOB<string> knob_output(KNOB_MODE_WRITEONCE, "pintool", "output", "usf",
+			 "Output format (usf/container/columnar/journal/pcprof)");
+
+KNOB<unsigned long> knob_journal_size(KNOB_MODE_WRITEONCE, "pintool",
+				      "journal_size", "64",
+				      "Size of the journal in MB");
+
+KNOB<unsigned> knob_pc_table_size(KNOB_MODE_WRITEONCE, "pintool",
+				  "pc_table_size", "1024",
+				  "Number of PCs kept by the PC profile");
+
+KNOB<double> knob_spatial_rate(KNOB_MODE_WRITEONCE, "pintool",
+			       "spatial_rate", "0",
+			       "Sample all accesses to this fraction of the lines");
+
+KNOB<unsigned long> knob_spatial_budget(KNOB_MODE_WRITEONCE, "pintool",
+					"spatial_budget", "0",
+					"Max watchpoints with -spatial_rate");
+
+KNOB<string> knob_target(KNOB_MODE_WRITEONCE, "pintool", "target", "none",
+			 "Adapt the sample period to a target, none/samples/"
+			 "watchpoints/bytes");
+
+KNOB<double> knob_target_value(KNOB_MODE_WRITEONCE, "pintool",
+			       "target_value", "0",
+			       "Samples per second, live watchpoints or bytes per burst");
+
+KNOB<unsigned long> knob_reservoir_size(KNOB_MODE_WRITEONCE, "pintool",
+					"reservoir_size", "0",
+					"Keep this many samples from the whole run");
+
+KNOB<unsigned long> knob_phase_interval(KNOB_MODE_WRITEONCE, "pintool",
+					"phase_interval", "0",
+					"Skip bursts in already sampled phases, "
+					"accesses per phase interval");
+
+KNOB<double> knob_phase_threshold(KNOB_MODE_WRITEONCE, "pintool",
+				  "phase_threshold", "0",
+				  "Max signature distance within a phase");
+
+KNOB<unsigned> knob_phase_bursts(KNOB_MODE_WRITEONCE, "pintool",
+				 "phase_bursts", "1",
+				 "Bursts to sample per phase");
+
+KNOB<unsigned> knob_sdist_precision(KNOB_MODE_WRITEONCE, "pintool",
+				    "sdist_precision", "0",
+				    "Estimate stack distances with 2^N register sketches");
+
+KNOB<unsigned long> knob_sdist_bucket(KNOB_MODE_WRITEONCE, "pintool",
+				      "sdist_bucket", "0",
+				      "Accesses per stack distance sketch");
+
+KNOB<unsigned> knob_sharing(KNOB_MODE_WRITEONCE, "pintool", "sharing", "0",
+			    "Classify sharing, report this many lines and PC pairs");
+
 
 sampler_t sampler;
 usf_atime_t access_counter = 0;
+unsigned long next_event = 0;
 
 
+/*
+ * Instruction fetches are modeled per basic block. A block is a run
+ * of consecutive fetch lines and generates one access per line it
+ * touches. Only accesses at next_event need to go through
+ * sampler_ref(), all other lines are just checked for watchpoints.
+ */
 static VOID
-trace_instr(VOID *ip, UINT32 size, THREADID tid)
+trace_bbl(ADDRINT addr, UINT32 size, THREADID tid)
 {
-    usf_access_t access = {
-	(usf_addr_t)ip,
-	(usf_addr_t)ip,
-	access_counter,
-	tid,
-	size,
-	USF_ATYPE_INSTRUCTION
-    };
-
-    sampler_ref(&sampler, &access);
-}
-
-static VOID PIN_FAST_ANALYSIS_CALL
-trace_update_access_counter(THREADID tid)
-{
-    ++access_counter;
+    const ADDRINT end = addr + size;
+    const ADDRINT line_size = 1 << sampler.line_size_lg2;
+
+    while (addr < end) {
+	const ADDRINT line_end = (addr | (line_size - 1)) + 1;
+	usf_access_t access = {
+	    (usf_addr_t)addr,
+	    (usf_addr_t)addr,
+	    access_counter,
+	    (usf_tid_t)tid,
+	    (usf_alen_t)((line_end < end ? line_end : end) - addr),
+	    USF_ATYPE_INSTRUCTION
+	};
+
+	if (access_counter >= next_event) {
+	    sampler_ref(&sampler, &access);
+	    next_event = sampler_next_event(&sampler);
+	} else
+	    sampler_watchpoint_lookup(&sampler, &access);
+
+	++access_counter;
+	addr = line_end;
+    }
 }
 
 static VOID
-instrument(INS ins, VOID *v)
+instrument(TRACE trace, VOID *v)
 {
-    INS_InsertCall(
-	ins, IPOINT_BEFORE, (AFUNPTR)trace_instr,
-	IARG_INST_PTR,
-	IARG_UINT32,
-	INS_Size(ins),
-	IARG_THREAD_ID,
-	IARG_END);
-
-    INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)trace_update_access_counter,
-		   IARG_FAST_ANALYSIS_CALL,
-		   IARG_THREAD_ID,
-		   IARG_END);
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl)) {
+	if (!filter_code(BBL_Address(bbl), INS_Rtn(BBL_InsHead(bbl))))
+	    continue;
+
+	BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)trace_bbl,
+		       IARG_ADDRINT, BBL_Address(bbl),
+		       IARG_UINT32, BBL_Size(bbl),
+		       IARG_THREAD_ID,
+		       IARG_END);
+    }
 }
 
 static int
@@ -112,6 +181,9 @@ init()
     if (sampler_init(&sampler))
         return 1;
 
+    if (filter_init())
+	return 1;
+
     sampler.usf_base_path   = (char *)knob_smp_base.Value().c_str();
     sampler.usf_flags      |= USF_FLAG_INSTRUCTIONS;
     sampler.sample_period   = knob_smp_period;
@@ -120,6 +192,52 @@ init()
     sampler.line_size_lg2   = knob_smp_line_size_lg2;
     sampler.seed            = knob_seed;
     sampler.log_level       = knob_log_level;
+    sampler.journal_size    = knob_journal_size << 20;
+    sampler.pc_table_size   = knob_pc_table_size;
+    sampler.spatial_rate    = knob_spatial_rate;
+    sampler.spatial_budget  = knob_spatial_budget;
+    sampler.target_value    = knob_target_value;
+    sampler.reservoir_size  = knob_reservoir_size;
+    sampler.phase_interval  = knob_phase_interval;
+    sampler.phase_threshold = knob_phase_threshold;
+    sampler.phase_bursts    = knob_phase_bursts;
+    sampler.sdist_precision = knob_sdist_precision;
+    sampler.sdist_bucket    = knob_sdist_bucket;
+    sampler.sharing_table_size = knob_sharing;
+
+    if (knob_output.Value() == "usf")
+	sampler.output = SAMPLER_OUTPUT_USF;
+    else if (knob_output.Value() == "container")
+	sampler.output = SAMPLER_OUTPUT_CONTAINER;
+    else if (knob_output.Value() == "columnar")
+	sampler.output = SAMPLER_OUTPUT_COLUMNAR;
+    else if (knob_output.Value() == "journal")
+	sampler.output = SAMPLER_OUTPUT_JOURNAL;
+    else if (knob_output.Value() == "pcprof")
+	sampler.output = SAMPLER_OUTPUT_PCPROF;
+    else {
+	cerr << "Illegal output format specified." << endl;
+	return 1;
+    }
+
+    if (knob_target.Value() == "none")
+	sampler.target = SAMPLER_TARGET_NONE;
+    else if (knob_target.Value() == "samples")
+	sampler.target = SAMPLER_TARGET_SAMPLES;
+    else if (knob_target.Value() == "watchpoints")
+	sampler.target = SAMPLER_TARGET_WATCHPOINTS;
+    else if (knob_target.Value() == "bytes")
+	sampler.target = SAMPLER_TARGET_BYTES;
+    else {
+	cerr << "Illegal target specified." << endl;
+	return 1;
+    }
+
+    /* The period is only adapted when a burst begins */
+    if (sampler.target != SAMPLER_TARGET_NONE && !sampler.burst_size) {
+	cerr << "A target needs a burst size." << endl;
+	return 1;
+    }
 
     if (knob_burst_rnd.Value() == "const")
         sampler.burst_rnd = sampler_rnd_const;
@@ -164,6 +282,7 @@ usage()
 int
 main(int argc, char *argv[])
 {
+    PIN_InitSymbols();
     if (PIN_Init(argc, argv)) {
 	usage();
         return 1;
@@ -172,7 +291,7 @@ main(int argc, char *argv[])
     if (init())
 	return 1;
 
-    INS_AddInstrumentFunction(instrument, 0);
+    TRACE_AddInstrumentFunction(instrument, 0);
     PIN_AddFiniFunction(fini, 0);
 
     PIN_StartProgram();
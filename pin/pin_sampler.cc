@@ -29,11 +29,19 @@
  */
 
 #include <iostream>
+#include <sstream>
+#include <vector>
+#include <stdio.h>
 #include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "pin.H"
 #include <uart/sampler.h>
 
+#include "pin_filter.h"
+
 using namespace std;
 
 KNOB<string> knob_smp_base(KNOB_MODE_WRITEONCE, "pintool", "o", "sample",
@@ -63,10 +71,181 @@ KNOB<unsigned> knob_seed(KNOB_MODE_WRITEONCE, "pintool", "s", "0",
 KNOB<int> knob_log_level(KNOB_MODE_WRITEONCE, "pintool", "v", "0",
 			 "Log level");
 
+KNOB<string> knob_output(KNOB_MODE_WRITEONCE, "pintool", "output", "usf",
+			 "Output format (usf/container/columnar/journal/pcprof)");
+
+KNOB<unsigned long> knob_journal_size(KNOB_MODE_WRITEONCE, "pintool",
+				      "journal_size", "64",
+				      "Size of the journal in MB");
+
+KNOB<unsigned> knob_pc_table_size(KNOB_MODE_WRITEONCE, "pintool",
+				  "pc_table_size", "1024",
+				  "Number of PCs kept by the PC profile");
+
+KNOB<double> knob_spatial_rate(KNOB_MODE_WRITEONCE, "pintool",
+			       "spatial_rate", "0",
+			       "Sample all accesses to this fraction of the lines");
+
+KNOB<unsigned long> knob_spatial_budget(KNOB_MODE_WRITEONCE, "pintool",
+					"spatial_budget", "0",
+					"Max watchpoints with -spatial_rate");
+
+KNOB<string> knob_target(KNOB_MODE_WRITEONCE, "pintool", "target", "none",
+			 "Adapt the sample period to a target, none/samples/"
+			 "watchpoints/bytes");
+
+KNOB<double> knob_target_value(KNOB_MODE_WRITEONCE, "pintool",
+			       "target_value", "0",
+			       "Samples per second, live watchpoints or bytes per burst");
+
+KNOB<unsigned long> knob_reservoir_size(KNOB_MODE_WRITEONCE, "pintool",
+					"reservoir_size", "0",
+					"Keep this many samples from the whole run");
+
+KNOB<unsigned long> knob_phase_interval(KNOB_MODE_WRITEONCE, "pintool",
+					"phase_interval", "0",
+					"Skip bursts in already sampled phases, "
+					"accesses per phase interval");
+
+KNOB<double> knob_phase_threshold(KNOB_MODE_WRITEONCE, "pintool",
+				  "phase_threshold", "0",
+				  "Max signature distance within a phase");
+
+KNOB<unsigned> knob_phase_bursts(KNOB_MODE_WRITEONCE, "pintool",
+				 "phase_bursts", "1",
+				 "Bursts to sample per phase");
+
+KNOB<unsigned> knob_sdist_precision(KNOB_MODE_WRITEONCE, "pintool",
+				    "sdist_precision", "0",
+				    "Estimate stack distances with 2^N register sketches");
+
+KNOB<unsigned long> knob_sdist_bucket(KNOB_MODE_WRITEONCE, "pintool",
+				      "sdist_bucket", "0",
+				      "Accesses per stack distance sketch");
+
+KNOB<unsigned> knob_sharing(KNOB_MODE_WRITEONCE, "pintool", "sharing", "0",
+			    "Classify sharing, report this many lines and PC pairs");
+
+KNOB<UINT64> knob_skip_ins(KNOB_MODE_WRITEONCE, "pintool", "skip_ins", "0",
+			   "Instructions to fast-forward before sampling");
+
+KNOB<UINT64> knob_skip_acc(KNOB_MODE_WRITEONCE, "pintool", "skip_acc", "0",
+			   "Memory accesses to fast-forward before sampling");
+
+KNOB<BOOL> knob_roi_marker(KNOB_MODE_WRITEONCE, "pintool", "roi_marker", "0",
+			   "Sample between uart_sampler_roi_begin/end calls");
+
+KNOB<string> knob_roi_rtn(KNOB_MODE_WRITEONCE, "pintool", "roi_rtn", "",
+			  "Only sample while executing the named routine");
+
+KNOB<BOOL> knob_roi_signal(KNOB_MODE_WRITEONCE, "pintool", "roi_signal", "0",
+			   "Start sampling on SIGUSR1, stop on SIGUSR2");
+
+KNOB<string> knob_addr_range(KNOB_MODE_APPEND, "pintool", "addr_range", "",
+			     "Only sample data accesses in the range BEGIN:END");
+
+KNOB<BOOL> knob_pid(KNOB_MODE_WRITEONCE, "pintool", "pid", "0",
+		    "Append the process id to the output base name");
+
 
 sampler_t sampler;
 usf_atime_t access_counter = 0;
 
+/* Pin's own command line, used to start Pin in exec()'d images */
+static vector<const CHAR *> exec_argv;
+
+static string base_path;
+static BOOL sampler_done = FALSE;
+
+/* Set by follow_exec() until the exec() is known to have failed */
+static BOOL exec_pending = FALSE;
+static THREADID exec_tid;
+static BOOL exec_roi_want;
+
+/*
+ * Region of interest. Memory accesses are only instrumented while
+ * roi_active is set, i.e. when the fast-forward is done and the ROI
+ * triggers (markers, routine or signals) want sampling. Every change
+ * throws away the code cache so that the fast-forward runs without
+ * any memory instrumentation. Time only advances inside the ROI.
+ */
+static BOOL roi_active = TRUE;
+static BOOL roi_want = TRUE;
+static UINT64 ff_left = 0;
+static UINT32 roi_rtn_depth = 0;
+
+
+static VOID
+roi_update()
+{
+    BOOL active = roi_want && !ff_left;
+
+    if (active == roi_active)
+	return;
+
+    roi_active = active;
+    PIN_RemoveInstrumentation();
+}
+
+static VOID
+roi_begin()
+{
+    roi_want = TRUE;
+    roi_update();
+}
+
+static VOID
+roi_end()
+{
+    roi_want = FALSE;
+    roi_update();
+}
+
+static VOID
+roi_rtn_enter()
+{
+    if (roi_rtn_depth++ == 0)
+	roi_begin();
+}
+
+static VOID
+roi_rtn_exit()
+{
+    if (roi_rtn_depth && --roi_rtn_depth == 0)
+	roi_end();
+}
+
+static BOOL
+roi_signal(THREADID tid, INT32 sig, CONTEXT *ctxt, BOOL has_handler,
+	   const EXCEPTION_INFO *info, VOID *v)
+{
+    if (sig == SIGUSR1)
+	roi_begin();
+    else
+	roi_end();
+
+    /* The signals belong to the tool, don't deliver them. */
+    return FALSE;
+}
+
+static ADDRINT PIN_FAST_ANALYSIS_CALL
+ff_count(UINT32 n)
+{
+    if (ff_left > n) {
+	ff_left -= n;
+	return 0;
+    }
+
+    ff_left = 0;
+    return 1;
+}
+
+static VOID
+ff_done()
+{
+    roi_update();
+}
+
 
 static VOID
 trace_mem(ADDRINT ip, ADDRINT addr, UINT32 size, THREADID tid, UINT32 ref_type)
@@ -80,7 +259,8 @@ trace_mem(ADDRINT ip, ADDRINT addr, UINT32 size, THREADID tid, UINT32 ref_type)
 	(usf_atype_t)ref_type
     };
 
-    sampler_ref(&sampler, &access);
+    if (!sampler_done)
+	sampler_ref(&sampler, &access);
 }
 
 static VOID PIN_FAST_ANALYSIS_CALL
@@ -95,12 +275,18 @@ instrument(INS ins, VOID *v)
     BOOL rd = INS_IsMemoryRead(ins);
     BOOL wr = INS_IsMemoryWrite(ins);
 
-    if (!rd && !wr)
+    if (!roi_active || (!rd && !wr))
+	return;
+
+    if (!filter_code(INS_Address(ins), INS_Rtn(ins)))
 	return;
 
     UINT32 no_ops = INS_MemoryOperandCount(ins);
 
     for (UINT32 op = 0; op < no_ops; op++) {
+	if (!filter_memop(ins, op))
+	    continue;
+
         const UINT32 size = INS_MemoryOperandSize(ins, op);
 	const bool is_rd = INS_MemoryOperandIsRead(ins, op);
 	const bool is_wr = INS_MemoryOperandIsWritten(ins, op);
@@ -123,19 +309,179 @@ instrument(INS ins, VOID *v)
     }
 }
 
+static VOID
+instrument_ff(TRACE trace, VOID *v)
+{
+    if (!ff_left)
+	return;
+
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl)) {
+	UINT32 n = 0;
+
+	if (knob_skip_acc) {
+	    for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+		n += INS_MemoryOperandCount(ins);
+	} else
+	    n = BBL_NumIns(bbl);
+
+	if (!n)
+	    continue;
+
+	BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR)ff_count,
+			 IARG_FAST_ANALYSIS_CALL,
+			 IARG_UINT32, n,
+			 IARG_END);
+	BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR)ff_done,
+			   IARG_END);
+    }
+}
+
+static VOID
+roi_insert_call(IMG img, const char *name, IPOINT ipoint, AFUNPTR func)
+{
+    RTN rtn = RTN_FindByName(img, name);
+
+    if (!RTN_Valid(rtn))
+	return;
+
+    RTN_Open(rtn);
+    RTN_InsertCall(rtn, ipoint, func, IARG_END);
+    RTN_Close(rtn);
+}
+
+static VOID
+instrument_img(IMG img, VOID *v)
+{
+    if (knob_roi_marker) {
+	roi_insert_call(img, "uart_sampler_roi_begin", IPOINT_BEFORE,
+			(AFUNPTR)roi_begin);
+	roi_insert_call(img, "uart_sampler_roi_end", IPOINT_BEFORE,
+			(AFUNPTR)roi_end);
+    }
+
+    if (knob_roi_rtn.Value() != "") {
+	const char *name = knob_roi_rtn.Value().c_str();
+
+	roi_insert_call(img, name, IPOINT_BEFORE, (AFUNPTR)roi_rtn_enter);
+	roi_insert_call(img, name, IPOINT_AFTER, (AFUNPTR)roi_rtn_exit);
+    }
+}
+
+/*
+ * Every process gets its own sampler. Children created by fork() and
+ * images started by exec() always have the pid appended to the output
+ * base name (follow_exec() passes -pid to the new image), with a
+ * serial number if a previous image with the same pid already used
+ * that name. The serial is returned in serial.
+ */
+static string
+make_base_path(BOOL child, int &serial)
+{
+    serial = 0;
+    if (!child && !knob_pid)
+	return knob_smp_base.Value();
+
+    ostringstream base;
+    base << knob_smp_base.Value() << "." << PIN_GetPid();
+
+    for (int i = 0; ; i++) {
+	ostringstream path;
+
+	path << base.str();
+	if (i)
+	    path << "-" << i;
+
+	if (access((path.str() + ".0").c_str(), F_OK) &&
+	    access((path.str() + ".usfc").c_str(), F_OK) &&
+	    access((path.str() + ".usfx").c_str(), F_OK) &&
+	    access((path.str() + ".usfj").c_str(), F_OK) &&
+	    access((path.str() + ".pcprof").c_str(), F_OK)) {
+	    serial = i;
+	    return path.str();
+	}
+    }
+}
+
 static int
-init()
+sampler_setup(BOOL child)
 {
+    int serial;
+
     if (sampler_init(&sampler))
         return 1;
 
-    sampler.usf_base_path   = (char *)knob_smp_base.Value().c_str();
+    for (UINT32 i = 0; i < knob_addr_range.NumberOfValues(); i++) {
+	const string &str = knob_addr_range.Value(i);
+	ADDRINT begin, end;
+
+	if (str == "")
+	    continue;
+
+	if (!filter_parse_range(str, begin, end) ||
+	    sampler_addr_range_add(&sampler, begin, end)) {
+	    cerr << "Illegal address range: " << str << endl;
+	    return 1;
+	}
+    }
+
+    base_path = make_base_path(child, serial);
+
+    sampler.usf_base_path   = (char *)base_path.c_str();
     sampler.sample_period   = knob_smp_period;
     sampler.burst_period    = knob_burst_period;
     sampler.burst_size      = knob_burst_size;
     sampler.line_size_lg2   = knob_smp_line_size_lg2;
-    sampler.seed            = knob_seed;
+    /* Every process, and every image exec()'d by the same process,
+     * gets a stream of its own */
+    sampler.seed            = child || knob_pid ?
+	knob_seed + PIN_GetPid() + serial * 0x9e3779b9U : knob_seed;
     sampler.log_level       = knob_log_level;
+    sampler.journal_size    = knob_journal_size << 20;
+    sampler.pc_table_size   = knob_pc_table_size;
+    sampler.spatial_rate    = knob_spatial_rate;
+    sampler.spatial_budget  = knob_spatial_budget;
+    sampler.target_value    = knob_target_value;
+    sampler.reservoir_size  = knob_reservoir_size;
+    sampler.phase_interval  = knob_phase_interval;
+    sampler.phase_threshold = knob_phase_threshold;
+    sampler.phase_bursts    = knob_phase_bursts;
+    sampler.sdist_precision = knob_sdist_precision;
+    sampler.sdist_bucket    = knob_sdist_bucket;
+    sampler.sharing_table_size = knob_sharing;
+
+    if (knob_output.Value() == "usf")
+	sampler.output = SAMPLER_OUTPUT_USF;
+    else if (knob_output.Value() == "container")
+	sampler.output = SAMPLER_OUTPUT_CONTAINER;
+    else if (knob_output.Value() == "columnar")
+	sampler.output = SAMPLER_OUTPUT_COLUMNAR;
+    else if (knob_output.Value() == "journal")
+	sampler.output = SAMPLER_OUTPUT_JOURNAL;
+    else if (knob_output.Value() == "pcprof")
+	sampler.output = SAMPLER_OUTPUT_PCPROF;
+    else {
+	cerr << "Illegal output format specified." << endl;
+	return 1;
+    }
+
+    if (knob_target.Value() == "none")
+	sampler.target = SAMPLER_TARGET_NONE;
+    else if (knob_target.Value() == "samples")
+	sampler.target = SAMPLER_TARGET_SAMPLES;
+    else if (knob_target.Value() == "watchpoints")
+	sampler.target = SAMPLER_TARGET_WATCHPOINTS;
+    else if (knob_target.Value() == "bytes")
+	sampler.target = SAMPLER_TARGET_BYTES;
+    else {
+	cerr << "Illegal target specified." << endl;
+	return 1;
+    }
+
+    /* The period is only adapted when a burst begins */
+    if (sampler.target != SAMPLER_TARGET_NONE && !sampler.burst_size) {
+	cerr << "A target needs a burst size." << endl;
+	return 1;
+    }
 
     if (knob_burst_rnd.Value() == "const")
         sampler.burst_rnd = sampler_rnd_const;
@@ -162,17 +508,108 @@ init()
     return 0;
 }
 
+static int
+init()
+{
+    if (filter_init())
+	return 1;
+
+    if (knob_skip_ins && knob_skip_acc) {
+	cerr << "Only one of -skip_ins and -skip_acc may be specified." << endl;
+	return 1;
+    }
+
+    ff_left    = knob_skip_ins ? knob_skip_ins : knob_skip_acc;
+    roi_want   = !knob_roi_marker && knob_roi_rtn.Value() == "" &&
+		 !knob_roi_signal;
+    roi_active = roi_want && !ff_left;
+
+    return sampler_setup(FALSE);
+}
+
+static VOID
+fork_before(THREADID tid, const CONTEXT *ctxt, VOID *v)
+{
+    /* Don't let the child inherit buffered output. */
+    fflush(NULL);
+}
+
+static VOID
+fork_child(THREADID tid, const CONTEXT *ctxt, VOID *v)
+{
+    /* The inherited sampler and its files belong to the parent, the
+     * parent flushes its own outstanding watchpoints. */
+    sampler_discard(&sampler);
+    access_counter = 0;
+
+    if (sampler_setup(TRUE)) {
+	cerr << "Failed to initialize the sampler in child." << endl;
+	PIN_ExitProcess(1);
+    }
+}
+
+static BOOL
+follow_exec(CHILD_PROCESS child, VOID *v)
+{
+    /* The fini function isn't called for an image that is replaced
+     * by exec(), flush the samples now. The new image starts its own
+     * sampler, this one starts a new sampler if the exec() fails, see
+     * syscall_exit(). */
+    if (!sampler_done) {
+	exec_pending = TRUE;
+	exec_tid = PIN_ThreadId();
+	exec_roi_want = roi_want;
+	sampler_done = TRUE;
+	roi_end();
+	sampler_fini(&sampler);
+    }
+
+    /* The new image would otherwise write to the same base name as
+     * the root process. */
+    if (!knob_pid)
+	CHILD_PROCESS_SetPinCommandLine(child, exec_argv.size(),
+					&exec_argv[0]);
+
+    return TRUE;
+}
+
+/*
+ * A successful exec() doesn't return to the old image, so a system
+ * call that returns in the thread that followed the exec() means that
+ * the exec() failed.
+ */
+static VOID
+syscall_exit(THREADID tid, CONTEXT *ctxt, SYSCALL_STANDARD std, VOID *v)
+{
+    if (!exec_pending || tid != exec_tid)
+	return;
+
+    exec_pending = FALSE;
+    if (sampler_setup(TRUE)) {
+	cerr << "exec() failed, failed to restart the sampler, "
+	     << "sampling stopped." << endl;
+	return;
+    }
+    cerr << "exec() failed, sampling goes on in " << base_path << endl;
+
+    sampler_done = FALSE;
+    roi_want = exec_roi_want;
+    roi_update();
+}
+
 static VOID
 fini(INT32 code, VOID *v)
 {
-    sampler_fini(&sampler);
+    if (!sampler_done)
+	sampler_fini(&sampler);
 }
 
 static void
 usage()
 {
     cerr << "This tool samples an application's memory accesses." << endl
-	 << endl;
+	 << "Run Pin with -follow_execv to sample exec()'d processes too."
+	 << endl << endl;
     cerr << KNOB_BASE::StringKnobSummary();
     cerr << endl;
 }
@@ -180,6 +617,7 @@ usage()
 int
 main(int argc, char *argv[])
 {
+    PIN_InitSymbols();
     if (PIN_Init(argc, argv)) {
 	usage();
         return 1;
@@ -188,8 +626,27 @@ main(int argc, char *argv[])
     if (init())
 	return 1;
 
+    for (int i = 0; i < argc && strcmp(argv[i], "--"); i++)
+	exec_argv.push_back(argv[i]);
+    exec_argv.push_back("-pid");
+    exec_argv.push_back("1");
+    exec_argv.push_back("--");
+
     INS_AddInstrumentFunction(instrument, 0);
+    TRACE_AddInstrumentFunction(instrument_ff, 0);
+    IMG_AddInstrumentFunction(instrument_img, 0);
     PIN_AddFiniFunction(fini, 0);
+    PIN_AddForkFunction(FPOINT_BEFORE, fork_before, 0);
+    PIN_AddForkFunction(FPOINT_AFTER_IN_CHILD, fork_child, 0);
+    PIN_AddFollowChildProcessFunction(follow_exec, 0);
+    PIN_AddSyscallExitFunction(syscall_exit, 0);
+
+    if (knob_roi_signal) {
+	PIN_InterceptSignal(SIGUSR1, roi_signal, 0);
+	PIN_InterceptSignal(SIGUSR2, roi_signal, 0);
+	PIN_UnblockSignal(SIGUSR1, TRUE);
+	PIN_UnblockSignal(SIGUSR2, TRUE);
+    }
 
     PIN_StartProgram();
     return 0;
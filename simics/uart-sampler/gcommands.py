@@ -9,7 +9,9 @@ def new_uart_sampler_conf_cmd(name,
                               burst_rnd_type,
                               burst_size,
                               line_size_lg2,
-                              master):
+                              master,
+                              shared,
+                              seed):
     real_name = new_object_name(name, "sampler-conf")
     if real_name == None:
         print "An object called '%s' already exists." % name
@@ -32,6 +34,8 @@ def new_uart_sampler_conf_cmd(name,
     conf.burst_size = burst_size
     conf.line_size_lg2 = line_size_lg2
     conf.master = master
+    conf.shared = shared
+    conf.seed = seed
     return (conf,)
 
 new_command("new-uart-sampler-conf", new_uart_sampler_conf_cmd,
@@ -43,7 +47,9 @@ new_command("new-uart-sampler-conf", new_uart_sampler_conf_cmd,
              arg(str_t, "burst_rnd_type",  "?", None),
              arg(int_t, "burst_size",    "?", 0),
              arg(int_t, "line_size_lg2", "?", 6),
-             arg(int_t, "master", "?", 1)],
+             arg(int_t, "master", "?", 1),
+             arg(int_t, "shared", "?", 0),
+             arg(int_t, "seed", "?", 0)],
             type = "",
             see_also = [],
             short = "create new uart-sampler-conf",
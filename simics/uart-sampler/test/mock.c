@@ -0,0 +1,294 @@
+/*
+ * Simics API mock, see mock.h.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "mock.h"
+
+#define MAX_CLASSES 4
+#define MAX_ATTRS   32
+#define MAX_IFCS    4
+#define MAX_HAPS    4
+#define MAX_HAP_CBS 8
+
+typedef struct {
+    const char *name;
+    get_attr_t  get;
+    set_attr_t  set;
+} attr_t;
+
+typedef struct {
+    const char *name;
+    void       *ifc;
+} ifc_t;
+
+struct conf_class {
+    const char   *name;
+    class_data_t  data;
+    attr_t        attrs[MAX_ATTRS];
+    int           no_attrs;
+    ifc_t         ifcs[MAX_IFCS];
+    int           no_ifcs;
+};
+
+typedef struct {
+    const char *name;
+    hap_func_t  func;
+    void       *data;
+} hap_cb_t;
+
+static conf_class_t classes[MAX_CLASSES];
+static int          no_classes;
+static const char  *haps[MAX_HAPS];
+static hap_type_t   no_haps;
+static hap_cb_t     hap_cbs[MAX_HAP_CBS];
+static int          no_hap_cbs;
+
+unsigned long mock_exceptions;
+unsigned long mock_ifc_lookups;
+unsigned long mock_pc_reads;
+
+static void
+fail(const char *what, const char *name)
+{
+    fprintf(stderr, "mock: %s: %s\n", what, name);
+    exit(1);
+}
+
+static conf_class_t *
+class_find(const char *name)
+{
+    for (int i = 0; i < no_classes; i++) {
+        if (!strcmp(classes[i].name, name))
+            return &classes[i];
+    }
+    fail("no such class", name);
+    return NULL;
+}
+
+static attr_t *
+attr_find(const char *cls, const char *name)
+{
+    conf_class_t *c = class_find(cls);
+
+    for (int i = 0; i < c->no_attrs; i++) {
+        if (!strcmp(c->attrs[i].name, name))
+            return &c->attrs[i];
+    }
+    fail("no such attribute", name);
+    return NULL;
+}
+
+conf_class_t *
+SIM_register_class(const char *name, class_data_t *data)
+{
+    conf_class_t *c;
+
+    if (no_classes == MAX_CLASSES)
+        fail("too many classes", name);
+    c = &classes[no_classes++];
+    c->name = name;
+    c->data = *data;
+    return c;
+}
+
+int
+SIM_register_interface(conf_class_t *cls, const char *name, void *ifc)
+{
+    if (cls->no_ifcs == MAX_IFCS)
+        fail("too many interfaces", name);
+    cls->ifcs[cls->no_ifcs].name = name;
+    cls->ifcs[cls->no_ifcs].ifc = ifc;
+    cls->no_ifcs++;
+    return 0;
+}
+
+int
+SIM_register_typed_attribute(conf_class_t *cls, const char *name,
+                             get_attr_t get, void *get_arg,
+                             set_attr_t set, void *set_arg,
+                             attr_attr_t attr, const char *type,
+                             const char *idx_type, const char *doc)
+{
+    if (cls->no_attrs == MAX_ATTRS)
+        fail("too many attributes", name);
+    cls->attrs[cls->no_attrs].name = name;
+    cls->attrs[cls->no_attrs].get = get;
+    cls->attrs[cls->no_attrs].set = set;
+    cls->no_attrs++;
+    return 0;
+}
+
+static logical_address_t
+get_program_counter(conf_object_t *obj)
+{
+    mock_pc_reads++;
+    return ((mock_cpu_t *)obj)->pc;
+}
+
+static processor_interface_t processor_ifc = { get_program_counter };
+
+void *
+SIM_get_interface(conf_object_t *obj, const char *name)
+{
+    mock_ifc_lookups++;
+    if (strcmp(name, PROCESSOR_INTERFACE) || !((mock_cpu_t *)obj)->has_ifc)
+        return NULL;
+    return &processor_ifc;
+}
+
+attr_value_t
+SIM_get_attribute(conf_object_t *obj, const char *name)
+{
+    if (strcmp(name, "cpuid_physical_apic_id"))
+        fail("no such CPU attribute", name);
+    return SIM_make_attr_integer(((mock_cpu_t *)obj)->apic_id);
+}
+
+attr_value_t
+SIM_make_attr_integer(int64_t i)
+{
+    attr_value_t v = { Sim_Val_Integer };
+
+    v.u.integer = i;
+    return v;
+}
+
+attr_value_t
+SIM_make_attr_string(const char *str)
+{
+    attr_value_t v = { Sim_Val_String };
+
+    v.u.string = str;
+    return v;
+}
+
+attr_value_t
+SIM_make_attr_object(conf_object_t *obj)
+{
+    attr_value_t v = { Sim_Val_Object };
+
+    v.u.object = obj;
+    return v;
+}
+
+attr_value_t
+SIM_make_attr_nil(void)
+{
+    attr_value_t v = { Sim_Val_Nil };
+
+    return v;
+}
+
+attr_value_t
+SIM_alloc_attr_list(int size)
+{
+    attr_value_t v = { Sim_Val_List };
+
+    v.u.list.size = size;
+    v.u.list.vector = calloc(size ? size : 1, sizeof(attr_value_t));
+    return v;
+}
+
+void
+SIM_log_constructor(log_object_t *log, parse_object_t *parse_obj)
+{
+}
+
+void
+SIM_log_info(int level, log_object_t *log, int group, const char *fmt, ...)
+{
+}
+
+void
+SIM_frontend_exception(sim_exception_t exc, const char *msg)
+{
+    mock_exceptions++;
+}
+
+hap_type_t
+SIM_hap_add_type(const char *name, const char *params,
+                 const char *param_desc, const char *idx,
+                 const char *desc, int old_hap_obj)
+{
+    if (no_haps == MAX_HAPS)
+        fail("too many haps", name);
+    haps[no_haps] = name;
+    return no_haps++;
+}
+
+int
+SIM_hap_add_callback(const char *name, hap_func_t func, void *data)
+{
+    if (no_hap_cbs == MAX_HAP_CBS)
+        fail("too many hap callbacks", name);
+    hap_cbs[no_hap_cbs].name = name;
+    hap_cbs[no_hap_cbs].func = func;
+    hap_cbs[no_hap_cbs].data = data;
+    return no_hap_cbs++;
+}
+
+void
+SIM_c_hap_occurred(hap_type_t hap, conf_object_t *obj, int64_t value, ...)
+{
+    for (int i = 0; i < no_hap_cbs; i++) {
+        if (!strcmp(hap_cbs[i].name, haps[hap]))
+            hap_cbs[i].func(hap_cbs[i].data, obj);
+    }
+}
+
+void
+mock_haps_reset(void)
+{
+    no_hap_cbs = 0;
+}
+
+conf_object_t *
+mock_new(const char *cls)
+{
+    return class_find(cls)->data.new_instance(NULL);
+}
+
+void
+mock_finalize(const char *cls, conf_object_t *obj)
+{
+    class_find(cls)->data.finalize_instance(obj);
+}
+
+void *
+mock_interface(const char *cls, const char *name)
+{
+    conf_class_t *c = class_find(cls);
+
+    for (int i = 0; i < c->no_ifcs; i++) {
+        if (!strcmp(c->ifcs[i].name, name))
+            return c->ifcs[i].ifc;
+    }
+    fail("no such interface", name);
+    return NULL;
+}
+
+set_error_t
+mock_set(const char *cls, conf_object_t *obj, const char *name,
+         attr_value_t val)
+{
+    return attr_find(cls, name)->set(NULL, obj, &val, NULL);
+}
+
+attr_value_t
+mock_get(const char *cls, conf_object_t *obj, const char *name)
+{
+    return attr_find(cls, name)->get(NULL, obj, NULL);
+}
+
+void
+mock_cpu_init(mock_cpu_t *cpu, int apic_id, int has_ifc)
+{
+    memset(cpu, 0, sizeof(*cpu));
+    cpu->obj.name = "cpu";
+    cpu->apic_id = apic_id;
+    cpu->has_ifc = has_ifc;
+}
@@ -0,0 +1,34 @@
+/*
+ * Test side of the Simics API mock. Classes, attributes and interfaces
+ * registered by the module are kept in tables and reached by name, the
+ * CPUs are plain objects with a PC and an APIC id.
+ */
+#ifndef MOCK_H
+#define MOCK_H
+#include <simics/api.h>
+
+typedef struct {
+    conf_object_t     obj;
+    int               apic_id;
+    int               has_ifc;  /* Implements the processor interface */
+    logical_address_t pc;
+} mock_cpu_t;
+
+/* Calls made by the module */
+extern unsigned long mock_exceptions;
+extern unsigned long mock_ifc_lookups;
+extern unsigned long mock_pc_reads;
+
+conf_object_t *mock_new(const char *cls);
+void mock_finalize(const char *cls, conf_object_t *obj);
+void *mock_interface(const char *cls, const char *name);
+set_error_t mock_set(const char *cls, conf_object_t *obj, const char *name,
+                     attr_value_t val);
+attr_value_t mock_get(const char *cls, conf_object_t *obj, const char *name);
+
+void mock_cpu_init(mock_cpu_t *cpu, int apic_id, int has_ifc);
+
+/* Drop the hap callbacks, e.g. of the objects of a finished test */
+void mock_haps_reset(void);
+
+#endif /* MOCK_H */
@@ -0,0 +1,7 @@
+#ifndef MOCK_SIMICS_ALLOC_H
+#define MOCK_SIMICS_ALLOC_H
+#include <stdlib.h>
+
+#define MM_ZALLOC(_n, _type) ((_type *)calloc((_n), sizeof(_type)))
+
+#endif /* MOCK_SIMICS_ALLOC_H */
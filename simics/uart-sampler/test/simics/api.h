@@ -0,0 +1,134 @@
+/*
+ * Minimal stand-in for the Simics API, only what the uart-sampler
+ * module uses. See ../mock.c.
+ */
+#ifndef MOCK_SIMICS_API_H
+#define MOCK_SIMICS_API_H
+#include <stdint.h>
+
+typedef struct conf_object {
+    const char *name;
+} conf_object_t;
+
+typedef struct {
+    conf_object_t obj;
+} log_object_t;
+
+typedef struct parse_object parse_object_t;
+typedef struct conf_class conf_class_t;
+typedef struct map_list map_list_t;
+
+typedef int64_t  cycles_t;
+typedef uint64_t logical_address_t;
+typedef uint64_t physical_address_t;
+
+typedef enum {
+    Sim_Val_Invalid,
+    Sim_Val_Integer,
+    Sim_Val_String,
+    Sim_Val_Object,
+    Sim_Val_List,
+    Sim_Val_Nil,
+} attr_kind_t;
+
+typedef struct attr_value {
+    attr_kind_t kind;
+    union {
+        int64_t        integer;
+        const char    *string;
+        conf_object_t *object;
+        struct {
+            int                size;
+            struct attr_value *vector;
+        } list;
+    } u;
+} attr_value_t;
+
+typedef enum {
+    Sim_Set_Ok,
+    Sim_Set_Illegal_Value,
+    Sim_Set_Interface_Not_Found,
+} set_error_t;
+
+typedef enum {
+    Sim_Attr_Required,
+    Sim_Attr_Optional,
+    Sim_Attr_Pseudo,
+} attr_attr_t;
+
+typedef enum {
+    SimExc_General,
+} sim_exception_t;
+
+typedef int hap_type_t;
+
+typedef struct {
+    conf_object_t *(*new_instance)(parse_object_t *parse_obj);
+    void           (*finalize_instance)(conf_object_t *obj);
+    const char     *description;
+} class_data_t;
+
+/* The memory operation flags are plain fields in the mock */
+typedef struct {
+    conf_object_t      *ini_ptr;
+    physical_address_t  physical_address;
+    unsigned            size;
+    int                 read;
+    int                 prefetch;
+    int                 control;
+    int                 instruction;
+} generic_transaction_t;
+
+typedef struct {
+    cycles_t (*operate)(conf_object_t *obj, conf_object_t *space,
+                        map_list_t *map_list, generic_transaction_t *mem_op);
+} timing_model_interface_t;
+
+#define PROCESSOR_INTERFACE "processor_info"
+
+typedef struct {
+    logical_address_t (*get_program_counter)(conf_object_t *cpu);
+} processor_interface_t;
+
+typedef attr_value_t (*get_attr_t)(void *arg, conf_object_t *obj,
+                                   attr_value_t *idx);
+typedef set_error_t (*set_attr_t)(void *arg, conf_object_t *obj,
+                                  attr_value_t *val, attr_value_t *idx);
+typedef void (*hap_func_t)(void *data, conf_object_t *obj);
+
+conf_class_t *SIM_register_class(const char *name, class_data_t *data);
+int SIM_register_interface(conf_class_t *cls, const char *name, void *ifc);
+int SIM_register_typed_attribute(conf_class_t *cls, const char *name,
+                                 get_attr_t get, void *get_arg,
+                                 set_attr_t set, void *set_arg,
+                                 attr_attr_t attr, const char *type,
+                                 const char *idx_type, const char *doc);
+
+void *SIM_get_interface(conf_object_t *obj, const char *name);
+attr_value_t SIM_get_attribute(conf_object_t *obj, const char *name);
+
+attr_value_t SIM_make_attr_integer(int64_t i);
+attr_value_t SIM_make_attr_string(const char *str);
+attr_value_t SIM_make_attr_object(conf_object_t *obj);
+attr_value_t SIM_make_attr_nil(void);
+attr_value_t SIM_alloc_attr_list(int size);
+
+void SIM_log_constructor(log_object_t *log, parse_object_t *parse_obj);
+void SIM_log_info(int level, log_object_t *log, int group,
+                  const char *fmt, ...);
+void SIM_frontend_exception(sim_exception_t exc, const char *msg);
+
+hap_type_t SIM_hap_add_type(const char *name, const char *params,
+                            const char *param_desc, const char *idx,
+                            const char *desc, int old_hap_obj);
+int SIM_hap_add_callback(const char *name, hap_func_t func, void *data);
+void SIM_c_hap_occurred(hap_type_t hap, conf_object_t *obj,
+                        int64_t value, ...);
+
+#define SIM_mem_op_is_read(_op)      ((_op)->read)
+#define SIM_mem_op_is_prefetch(_op)  ((_op)->prefetch)
+#define SIM_mem_op_is_control(_op)   ((_op)->control)
+#define SIM_mem_op_is_data(_op)      (!(_op)->instruction)
+#define SIM_mem_op_is_from_cpu(_op)  ((_op)->ini_ptr != NULL)
+
+#endif /* MOCK_SIMICS_API_H */
@@ -0,0 +1,4 @@
+#ifndef MOCK_SIMICS_UTILS_H
+#define MOCK_SIMICS_UTILS_H
+
+#endif /* MOCK_SIMICS_UTILS_H */
@@ -0,0 +1,535 @@
+/*
+ * Test of the timing model's operate() against the Simics API mock.
+ * The fast path, which only builds an access at sample and burst
+ * boundaries or when the line is watched, must give the same bursts
+ * and samples as passing every access on: to sampler_ref() in shared
+ * mode, to the master and slave code of the module before the fast
+ * path otherwise.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <simics/api.h>
+#include "mock.h"
+#include "uart-sampler.h"
+
+#define CLASS      "uart-sampler"
+#define CONF_CLASS "uart-sampler-conf"
+
+#define NO_ACCESSES  30000
+/* Master and slave sample every access in a burst */
+#define NO_MS_ACCESSES 2000
+#define MAX_EVENTS   4096
+#define LINE_SIZE_LG2 6
+
+extern void init_local(void);
+
+typedef struct {
+    sampler_sink_t sink;
+    usf_access_t   begin[MAX_EVENTS];
+    usf_access_t   end[MAX_EVENTS];
+    unsigned long  burst[MAX_EVENTS];
+    unsigned long  no_samples;
+    unsigned long  no_dangling;
+    unsigned long  bursts[MAX_EVENTS][2];  /* begin, end */
+    unsigned long  no_bursts;
+} capture_t;
+
+static int failed;
+
+#define CHECK(_cond, ...) do {                          \
+    if (!(_cond)) {                                     \
+        fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+        fprintf(stderr, __VA_ARGS__);                   \
+        fprintf(stderr, "\n");                          \
+        failed = 1;                                     \
+    }                                                   \
+} while (0)
+
+static int
+cap_burst_begin(sampler_sink_t *sink, unsigned long burst,
+                unsigned long time, double rate)
+{
+    capture_t *c = (capture_t *)sink;
+
+    if (c->no_bursts == MAX_EVENTS)
+        return -1;
+    c->bursts[c->no_bursts][0] = time;
+    c->bursts[c->no_bursts][1] = 0;
+    c->no_bursts++;
+    return 0;
+}
+
+static int
+cap_burst_end(sampler_sink_t *sink, unsigned long burst, unsigned long time)
+{
+    capture_t *c = (capture_t *)sink;
+
+    if (burst >= c->no_bursts)
+        return -1;
+    c->bursts[burst][1] = time;
+    return 0;
+}
+
+static int
+cap_sample(sampler_sink_t *sink, unsigned long burst,
+           usf_access_t *begin, usf_access_t *end,
+           usf_line_size_2_t line_size_lg2)
+{
+    capture_t *c = (capture_t *)sink;
+
+    if (c->no_samples == MAX_EVENTS)
+        return -1;
+    c->begin[c->no_samples] = *begin;
+    c->end[c->no_samples] = *end;
+    c->burst[c->no_samples] = burst;
+    c->no_samples++;
+    return 0;
+}
+
+static int
+cap_dangling(sampler_sink_t *sink, unsigned long burst,
+             usf_access_t *begin, usf_line_size_2_t line_size_lg2)
+{
+    ((capture_t *)sink)->no_dangling++;
+    return 0;
+}
+
+static int
+cap_fini(sampler_sink_t *sink)
+{
+    return 0;
+}
+
+static capture_t *
+capture_new(void)
+{
+    capture_t *c = calloc(1, sizeof(capture_t));
+
+    if (!c) {
+        perror("calloc");
+        exit(1);
+    }
+    c->sink.burst_begin = cap_burst_begin;
+    c->sink.burst_end = cap_burst_end;
+    c->sink.sample = cap_sample;
+    c->sink.dangling = cap_dangling;
+    c->sink.fini = cap_fini;
+    return c;
+}
+
+/* Every line is reused 64 accesses later */
+static uint64_t
+access_addr(unsigned long i)
+{
+    return 0x100000 + (i % 64) * (1 << LINE_SIZE_LG2) + (i % 3) * 8;
+}
+
+typedef enum {
+    MODE_SHARED,
+    MODE_MASTER,
+    MODE_SLAVE,
+} conf_mode_t;
+
+static conf_object_t *
+conf_new(conf_mode_t mode, int with_ranges)
+{
+    conf_object_t *conf = mock_new(CONF_CLASS);
+
+    mock_set(CONF_CLASS, conf, "shared",
+             SIM_make_attr_integer(mode == MODE_SHARED));
+    mock_set(CONF_CLASS, conf, "master",
+             SIM_make_attr_integer(mode == MODE_MASTER));
+    mock_set(CONF_CLASS, conf, "sample_period", SIM_make_attr_integer(4));
+    mock_set(CONF_CLASS, conf, "sample_rnd_type",
+             SIM_make_attr_string("exp"));
+    mock_set(CONF_CLASS, conf, "burst_period", SIM_make_attr_integer(3000));
+    mock_set(CONF_CLASS, conf, "burst_rnd_type",
+             SIM_make_attr_string("exp"));
+    mock_set(CONF_CLASS, conf, "burst_size", SIM_make_attr_integer(300));
+    mock_set(CONF_CLASS, conf, "line_size_lg2",
+             SIM_make_attr_integer(LINE_SIZE_LG2));
+    mock_set(CONF_CLASS, conf, "seed", SIM_make_attr_integer(7));
+
+    if (with_ranges) {
+        attr_value_t ranges = SIM_alloc_attr_list(1);
+        attr_value_t range = SIM_alloc_attr_list(2);
+
+        /* The first half of the lines */
+        range.u.list.vector[0] = SIM_make_attr_integer(0x100000);
+        range.u.list.vector[1] = SIM_make_attr_integer(0x100800);
+        ranges.u.list.vector[0] = range;
+        mock_set(CONF_CLASS, conf, "addr_ranges", ranges);
+    }
+    return conf;
+}
+
+/* With bursts the sampler doesn't create its sink before the first
+ * access, so the capture sink can be put in after finalize. */
+static uart_sampler_t *
+sampler_new(conf_object_t *conf, capture_t *cap)
+{
+    conf_object_t  *obj = mock_new(CLASS);
+    uart_sampler_t *s = (uart_sampler_t *)obj;
+
+    mock_set(CLASS, obj, "conf", SIM_make_attr_object(conf));
+    mock_finalize(CLASS, obj);
+    s->sampler.sink = &cap->sink;
+    mock_get(CLASS, obj, "start");
+    return s;
+}
+
+/* The same configuration with every access going through sampler_ref() */
+static void
+reference_run(uart_sampler_conf_t *c, mock_cpu_t *cpu, capture_t *cap)
+{
+    sampler_t s;
+
+    if (sampler_init(&s)) {
+        fprintf(stderr, "sampler_init failed\n");
+        exit(1);
+    }
+    s.sample_period = c->sample_period;
+    s.burst_period = c->burst_period;
+    s.burst_size = c->burst_size;
+    s.line_size_lg2 = c->line_size_lg2;
+    s.seed = c->seed;
+    s.sample_rnd = sampler_rnd_exp;
+    s.burst_rnd = sampler_rnd_exp;
+    s.sink = &cap->sink;
+    for (int i = 0; i < c->no_addr_ranges; i++)
+        sampler_addr_range_add(&s, c->addr_ranges[i][0], c->addr_ranges[i][1]);
+
+    for (unsigned long i = 0; i < NO_ACCESSES; i++) {
+        usf_access_t ref;
+
+        ref.pc = cpu->pc;
+        ref.addr = access_addr(i);
+        ref.time = i;
+        ref.tid = cpu->apic_id;
+        ref.len = 8;
+        ref.type = USF_ATYPE_RD;
+        if (sampler_ref(&s, &ref)) {
+            fprintf(stderr, "sampler_ref failed\n");
+            exit(1);
+        }
+    }
+
+    if (sampler_fini(&s)) {
+        fprintf(stderr, "sampler_fini failed\n");
+        exit(1);
+    }
+}
+
+static int
+access_equal(const usf_access_t *a1, const usf_access_t *a2)
+{
+    return a1->pc == a2->pc && a1->addr == a2->addr && a1->time == a2->time &&
+        a1->tid == a2->tid && a1->len == a2->len && a1->type == a2->type;
+}
+
+static void
+capture_compare(const char *name, capture_t *got, capture_t *exp)
+{
+    CHECK(exp->no_samples > 0, "%s: no reference samples", name);
+    CHECK(exp->no_bursts > 1, "%s: no reference bursts", name);
+    CHECK(got->no_samples == exp->no_samples, "%s: %lu samples, expected %lu",
+          name, got->no_samples, exp->no_samples);
+    CHECK(got->no_dangling == exp->no_dangling,
+          "%s: %lu dangling, expected %lu",
+          name, got->no_dangling, exp->no_dangling);
+    CHECK(got->no_bursts == exp->no_bursts, "%s: %lu bursts, expected %lu",
+          name, got->no_bursts, exp->no_bursts);
+
+    for (unsigned long i = 0; i < got->no_bursts && i < exp->no_bursts; i++) {
+        CHECK(got->bursts[i][0] == exp->bursts[i][0] &&
+              got->bursts[i][1] == exp->bursts[i][1],
+              "%s: burst %lu is %lu-%lu, expected %lu-%lu", name, i,
+              got->bursts[i][0], got->bursts[i][1],
+              exp->bursts[i][0], exp->bursts[i][1]);
+    }
+
+    for (unsigned long i = 0; i < got->no_samples && i < exp->no_samples;
+         i++) {
+        CHECK(access_equal(&got->begin[i], &exp->begin[i]) &&
+              access_equal(&got->end[i], &exp->end[i]) &&
+              got->burst[i] == exp->burst[i],
+              "%s: sample %lu is %lu-%lu, expected %lu-%lu", name, i,
+              (unsigned long)got->begin[i].time,
+              (unsigned long)got->end[i].time,
+              (unsigned long)exp->begin[i].time,
+              (unsigned long)exp->end[i].time);
+    }
+}
+
+static void
+test_fast_path(int with_ranges)
+{
+    const char *name = with_ranges ? "ranges" : "fast path";
+    timing_model_interface_t *ifc = mock_interface(CLASS, "timing-model");
+    conf_object_t  *conf = conf_new(MODE_SHARED, with_ranges);
+    capture_t      *got = capture_new();
+    capture_t      *exp = capture_new();
+    uart_sampler_t *s = sampler_new(conf, got);
+    mock_cpu_t      cpu;
+    unsigned long   pc_reads;
+
+    mock_cpu_init(&cpu, 3, 1);
+    cpu.pc = 0x400123;
+    mock_exceptions = 0;
+    mock_pc_reads = 0;
+
+    for (unsigned long i = 0; i < NO_ACCESSES; i++) {
+        generic_transaction_t op;
+
+        memset(&op, 0, sizeof(op));
+        op.ini_ptr = &cpu.obj;
+        op.physical_address = access_addr(i);
+        op.size = 8;
+        op.read = 1;
+        ifc->operate(&s->log.obj, NULL, NULL, &op);
+    }
+    pc_reads = mock_pc_reads;
+    CHECK(s->time == NO_ACCESSES, "%s: time is %lu", name, s->time);
+
+    mock_get(CLASS, &s->log.obj, "close");
+    CHECK(!mock_exceptions, "%s: %lu exceptions", name, mock_exceptions);
+
+    reference_run((uart_sampler_conf_t *)conf, &cpu, exp);
+    capture_compare(name, got, exp);
+
+    /* Only sample begins, watchpoint hits and burst boundaries need
+     * the PC */
+    CHECK(pc_reads <= 2 * exp->no_samples + exp->no_dangling +
+          2 * exp->no_bursts,
+          "%s: %lu PC reads for %lu samples", name, pc_reads,
+          exp->no_samples);
+
+    free(got);
+    free(exp);
+}
+
+/*
+ * The master and slave code before the fast path. Every access is
+ * built and passed to operate_master() or operate_slave(), the master
+ * begins and ends the bursts of the slave through the haps.
+ */
+typedef struct {
+    sampler_t     sampler;
+    unsigned long time;
+    unsigned long burst_begin;
+    unsigned long burst_end;
+    unsigned long next_sample;
+    unsigned long burst_size;   /* Master only */
+} ref_sampler_t;
+
+static void
+ref_check(int err, const char *what)
+{
+    if (err) {
+        fprintf(stderr, "reference: %s failed\n", what);
+        exit(1);
+    }
+}
+
+static void
+ref_init(ref_sampler_t *r, uart_sampler_conf_t *c, int master,
+         capture_t *cap)
+{
+    memset(r, 0, sizeof(*r));
+    ref_check(sampler_init(&r->sampler), "sampler_init");
+    r->sampler.sample_period = c->sample_period;
+    r->sampler.burst_period = c->burst_period;
+    r->sampler.burst_size = c->burst_size;
+    r->sampler.line_size_lg2 = c->line_size_lg2;
+    r->sampler.seed = c->seed;
+    r->sampler.sink = &cap->sink;
+    r->burst_size = master ? c->burst_size : 0;
+    for (int i = 0; i < c->no_addr_ranges; i++)
+        ref_check(sampler_addr_range_add(&r->sampler, c->addr_ranges[i][0],
+                                         c->addr_ranges[i][1]),
+                  "sampler_addr_range_add");
+}
+
+static void
+ref_operate(ref_sampler_t *r, ref_sampler_t *slave, usf_access_t *ref)
+{
+    unsigned long time = r->time++;
+
+    if (!sampler_addr_match(&r->sampler, ref->addr)) {
+        if (sampler_burst_active(&r->sampler))
+            r->next_sample++;
+        if (r->burst_begin == time)
+            r->burst_begin++;
+        if (r->burst_end == time)
+            r->burst_end++;
+        return;
+    }
+
+    ref_check(sampler_watchpoint_lookup(&r->sampler, ref),
+              "sampler_watchpoint_lookup");
+
+    if (r->burst_size) {
+        if (r->burst_end == time) {
+            ref_check(sampler_burst_end(&r->sampler, time),
+                      "sampler_burst_end");
+            r->burst_begin = time;
+            ref_check(sampler_burst_end(&slave->sampler, slave->time),
+                      "sampler_burst_end");
+        }
+
+        if (r->burst_begin == time) {
+            ref_check(sampler_burst_begin(&r->sampler, time),
+                      "sampler_burst_begin");
+            r->next_sample = time;
+            r->burst_end = time + r->burst_size;
+            ref_check(sampler_burst_begin(&slave->sampler, slave->time),
+                      "sampler_burst_begin");
+            slave->next_sample = slave->time;
+        }
+    }
+
+    if (sampler_burst_active(&r->sampler) && r->next_sample == time) {
+        ref_check(sampler_watchpoint_insert(&r->sampler, ref),
+                  "sampler_watchpoint_insert");
+        r->next_sample = time + 1;
+    }
+}
+
+static void
+ms_access(generic_transaction_t *op, usf_access_t *ref, mock_cpu_t *cpu,
+          unsigned long i, unsigned long time)
+{
+    memset(op, 0, sizeof(*op));
+    op->ini_ptr = &cpu->obj;
+    op->physical_address = access_addr(i);
+    op->size = 8;
+    op->read = 1;
+
+    ref->pc = cpu->pc;
+    ref->addr = access_addr(i);
+    ref->time = time;
+    ref->tid = cpu->apic_id;
+    ref->len = 8;
+    ref->type = USF_ATYPE_RD;
+}
+
+/* A master with bursts and a slave on another CPU, which take turns */
+static void
+test_master_slave(int with_ranges)
+{
+    const char *name = with_ranges ? "master ranges" : "master";
+    const char *slave_name = with_ranges ? "slave ranges" : "slave";
+    timing_model_interface_t *ifc = mock_interface(CLASS, "timing-model");
+    conf_object_t  *master_conf = conf_new(MODE_MASTER, with_ranges);
+    conf_object_t  *slave_conf = conf_new(MODE_SLAVE, with_ranges);
+    capture_t      *got_master = capture_new();
+    capture_t      *got_slave = capture_new();
+    capture_t      *exp_master = capture_new();
+    capture_t      *exp_slave = capture_new();
+    uart_sampler_t *master = sampler_new(master_conf, got_master);
+    uart_sampler_t *slave = sampler_new(slave_conf, got_slave);
+    ref_sampler_t   ref_master, ref_slave;
+    mock_cpu_t      master_cpu, slave_cpu;
+
+    mock_cpu_init(&master_cpu, 1, 1);
+    mock_cpu_init(&slave_cpu, 2, 1);
+    master_cpu.pc = 0x400123;
+    slave_cpu.pc = 0x400456;
+    mock_exceptions = 0;
+
+    ref_init(&ref_master, (uart_sampler_conf_t *)master_conf, 1, exp_master);
+    ref_init(&ref_slave, (uart_sampler_conf_t *)slave_conf, 0, exp_slave);
+
+    for (unsigned long i = 0; i < NO_MS_ACCESSES; i++) {
+        generic_transaction_t op;
+        usf_access_t          ref;
+
+        ms_access(&op, &ref, &master_cpu, i, i);
+        ifc->operate(&master->log.obj, NULL, NULL, &op);
+        ref_operate(&ref_master, &ref_slave, &ref);
+
+        /* Another set of lines than the master's */
+        ms_access(&op, &ref, &slave_cpu, i + 32, i);
+        ifc->operate(&slave->log.obj, NULL, NULL, &op);
+        ref_operate(&ref_slave, NULL, &ref);
+    }
+    CHECK(master->time == NO_MS_ACCESSES, "%s: time is %lu", name,
+          master->time);
+    CHECK(slave->time == NO_MS_ACCESSES, "%s: time is %lu", slave_name,
+          slave->time);
+
+    mock_get(CLASS, &master->log.obj, "close");
+    mock_get(CLASS, &slave->log.obj, "close");
+    CHECK(!mock_exceptions, "%s: %lu exceptions", name, mock_exceptions);
+    ref_check(sampler_fini(&ref_master.sampler), "sampler_fini");
+    ref_check(sampler_fini(&ref_slave.sampler), "sampler_fini");
+
+    capture_compare(name, got_master, exp_master);
+    capture_compare(slave_name, got_slave, exp_slave);
+
+    mock_haps_reset();
+    free(got_master);
+    free(got_slave);
+    free(exp_master);
+    free(exp_slave);
+}
+
+/* Accesses from a CPU without the processor interface advance time
+ * and don't block sampling, the error is reported once. */
+static void
+test_bad_cpu(void)
+{
+    timing_model_interface_t *ifc = mock_interface(CLASS, "timing-model");
+    conf_object_t  *conf = conf_new(MODE_SHARED, 0);
+    capture_t      *got = capture_new();
+    uart_sampler_t *s = sampler_new(conf, got);
+    mock_cpu_t      good, bad;
+
+    mock_cpu_init(&good, 1, 1);
+    mock_cpu_init(&bad, 2, 0);
+    mock_exceptions = 0;
+    mock_ifc_lookups = 0;
+
+    for (unsigned long i = 0; i < NO_ACCESSES; i++) {
+        generic_transaction_t op;
+
+        memset(&op, 0, sizeof(op));
+        op.ini_ptr = i % 2 ? &good.obj : &bad.obj;
+        op.physical_address = access_addr(i / 2);
+        op.size = 8;
+        op.read = 1;
+        ifc->operate(&s->log.obj, NULL, NULL, &op);
+    }
+
+    CHECK(s->time == NO_ACCESSES, "bad cpu: time is %lu", s->time);
+    CHECK(mock_exceptions == 1, "bad cpu: %lu exceptions", mock_exceptions);
+    CHECK(mock_ifc_lookups == 2, "bad cpu: %lu interface lookups",
+          mock_ifc_lookups);
+    CHECK(got->no_samples > 0, "bad cpu: no samples");
+    for (unsigned long i = 0; i < got->no_samples; i++) {
+        CHECK(got->begin[i].tid == 1 && got->end[i].tid == 1,
+              "bad cpu: sample %lu from CPU %d", i, (int)got->begin[i].tid);
+    }
+
+    mock_get(CLASS, &s->log.obj, "close");
+    free(got);
+}
+
+int
+main(int argc, char **argv)
+{
+    init_local();
+
+    test_fast_path(0);
+    test_fast_path(1);
+    test_master_slave(0);
+    test_master_slave(1);
+    test_bad_cpu();
+
+    if (failed)
+        return 1;
+    printf("PASS\n");
+    return 0;
+}
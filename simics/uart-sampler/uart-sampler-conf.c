@@ -49,6 +49,8 @@ GETSET(burst_period,   integer)
 GETSET(burst_size,     integer)
 GETSET(line_size_lg2,  integer)
 GETSET(master,         integer)
+GETSET(shared,         integer)
+GETSET(seed,           integer)
 
 
 #define GETSET_STR(_name, _len)                                     \
@@ -75,6 +77,53 @@ GETSET_STR(file_base_name,  FILE_BASE_NAME_LEN)
 GETSET_STR(sample_rnd_type, RND_TYPE_NAME_LEN)
 GETSET_STR(burst_rnd_type,  RND_TYPE_NAME_LEN)
 
+static attr_value_t
+get_addr_ranges(void          *arg,
+                conf_object_t *self,
+                attr_value_t  *idx)
+{
+    uart_sampler_conf_t *conf = (uart_sampler_conf_t *)self;
+    attr_value_t ret = SIM_alloc_attr_list(conf->no_addr_ranges);
+
+    for (int i = 0; i < conf->no_addr_ranges; i++) {
+        attr_value_t range = SIM_alloc_attr_list(2);
+
+        range.u.list.vector[0] = SIM_make_attr_integer(conf->addr_ranges[i][0]);
+        range.u.list.vector[1] = SIM_make_attr_integer(conf->addr_ranges[i][1]);
+        ret.u.list.vector[i] = range;
+    }
+    return ret;
+}
+
+static set_error_t
+set_addr_ranges(void          *arg,
+                conf_object_t *self,
+                attr_value_t  *val,
+                attr_value_t  *idx)
+{
+    uart_sampler_conf_t *conf = (uart_sampler_conf_t *)self;
+
+    if (val->u.list.size > MAX_ADDR_RANGES)
+        return Sim_Set_Illegal_Value;
+
+    for (int i = 0; i < val->u.list.size; i++) {
+        attr_value_t *range = val->u.list.vector[i].u.list.vector;
+
+        if (range[0].u.integer >= range[1].u.integer)
+            return Sim_Set_Illegal_Value;
+    }
+
+    for (int i = 0; i < val->u.list.size; i++) {
+        attr_value_t *range = val->u.list.vector[i].u.list.vector;
+
+        conf->addr_ranges[i][0] = range[0].u.integer;
+        conf->addr_ranges[i][1] = range[1].u.integer;
+    }
+    conf->no_addr_ranges = val->u.list.size;
+
+    return Sim_Set_Ok;
+}
+
 void
 conf_init_local(void)
 {
@@ -100,7 +149,15 @@ conf_init_local(void)
     REGISTER(burst_size,      "i", "XXX");
     REGISTER(line_size_lg2,   "i", "XXX");
     REGISTER(master,          "b", "XXX");
+    REGISTER(shared,          "b",
+             "Use one sampler, with one timeline and one set of "
+             "watchpoints, for all CPUs connected to it. The master "
+             "flag is ignored.");
+    REGISTER(seed,            "i", "Random seed");
     REGISTER(file_base_name,  "s", "XXX");
     REGISTER(sample_rnd_type, "s", "XXX");
     REGISTER(burst_rnd_type,  "s", "XXX");
+    REGISTER(addr_ranges,     "[[ii]*]",
+             "List of [begin, end] physical address ranges to sample, "
+             "empty means everything");
 }
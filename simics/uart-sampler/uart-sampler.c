@@ -27,22 +27,83 @@ static void hap_cb_begin(void *not_used, conf_object_t *self);
 static void hap_cb_end(void *not_used, conf_object_t *self);
 
 
-static inline uint64_t
-eip(conf_object_t *cpu)
+/*
+ * The identity and processor interface of every CPU is looked up once
+ * and cached, the memory operation path only uses the cache and the
+ * processor interface. A CPU without the processor interface stays in
+ * the cache with a NULL ifc, so the error is only reported once.
+ */
+static uart_sampler_cpu_t *
+cpu_add(uart_sampler_t *s, conf_object_t *obj)
 {
+    uart_sampler_cpu_t *cpu;
     attr_value_t attr;
 
-    attr = SIM_get_attribute(cpu, "eip");
-    return (uint64_t)attr.u.integer;
+    if (s->no_cpus >= MAX_CPUS) {
+        if (!s->cpus_full)
+            SIM_frontend_exception(SimExc_General, "Too many CPUs");
+        s->cpus_full = 1;
+        return NULL;
+    }
+    cpu = &s->cpus[s->no_cpus++];
+
+    cpu->obj = obj;
+    cpu->ifc = SIM_get_interface(obj, PROCESSOR_INTERFACE);
+    E_IF(!cpu->ifc, "CPU doesn't implement the processor interface", cpu);
+
+    attr = SIM_get_attribute(obj, "cpuid_physical_apic_id");
+    cpu->id = (int)attr.u.integer;
+
+    return cpu;
+}
+
+/* NULL if the CPU can't be used, see cpu_add() */
+static inline uart_sampler_cpu_t *
+cpu_get(uart_sampler_t *s, conf_object_t *obj)
+{
+    if (s->last_cpu && s->last_cpu->obj == obj)
+        return s->last_cpu->ifc ? s->last_cpu : NULL;
+
+    for (int i = 0; i < s->no_cpus; i++) {
+        if (s->cpus[i].obj == obj) {
+            s->last_cpu = &s->cpus[i];
+            return s->last_cpu->ifc ? s->last_cpu : NULL;
+        }
+    }
+
+    s->last_cpu = cpu_add(s, obj);
+    return s->last_cpu && s->last_cpu->ifc ? s->last_cpu : NULL;
+}
+
+/* Let an access pass without consuming a sample slot */
+static inline void
+access_skip(uart_sampler_t *s, uart_sampler_conf_t *c)
+{
+    if (c->shared) {
+        sampler_ref_skip(&s->sampler, s->time);
+    } else {
+        if (sampler_burst_active(&s->sampler))
+            s->next_sample++;
+        if (s->burst_begin == s->time)
+            s->burst_begin++;
+        if (s->burst_end == s->time)
+            s->burst_end++;
+    }
 }
 
+/* Non-zero if the access at the current time is a sample or burst
+ * boundary and has to go through operate_master/slave. */
 static inline int
-cpuid(conf_object_t *cpu)
+event_pending(uart_sampler_t *s, uart_sampler_conf_t *c)
 {
-    attr_value_t attr;
+    if (c->shared)
+        return sampler_next_event(&s->sampler) <= s->time;
+
+    if (c->master && c->burst_size &&
+        (s->burst_begin == s->time || s->burst_end == s->time))
+        return 1;
 
-    attr = SIM_get_attribute(cpu, "cpuid_physical_apic_id");
-    return (int)attr.u.integer;
+    return s->next_sample == s->time && sampler_burst_active(&s->sampler);
 }
 
 static conf_object_t *
@@ -69,7 +130,13 @@ finalize_instance(conf_object_t *self)
     s->sampler.burst_period = c->burst_period;
     s->sampler.burst_size = c->burst_size;
     s->sampler.line_size_lg2 = c->line_size_lg2;
-    s->sampler.seed = 0;
+    s->sampler.seed = c->seed;
+
+    for (int i = 0; i < c->no_addr_ranges; i++) {
+        err = sampler_addr_range_add(&s->sampler, c->addr_ranges[i][0],
+                                     c->addr_ranges[i][1]);
+        E_IF(err, "sampler_addr_range_add", E_VOID);
+    }
 
     if (!strncmp(c->burst_rnd_type, "const", 5)) {
         s->sampler.burst_rnd = sampler_rnd_const;
@@ -88,7 +155,7 @@ finalize_instance(conf_object_t *self)
         E_IF(err, "sampler_burst_begin", E_VOID);
     }
 
-    if (!c->master) {
+    if (!c->shared && !c->master) {
         SIM_hap_add_callback("Uart_Sampler_Burst_Begin", hap_cb_begin, s);
         SIM_hap_add_callback("Uart_Sampler_Burst_End", hap_cb_end, s);
     }
@@ -178,6 +245,22 @@ operate_slave(uart_sampler_t *s, uart_sampler_conf_t *c, usf_access_t *ref)
 }
 
 
+/*
+ * Shared mode, one sampler serves all CPUs connected to it. The high
+ * level API takes care of bursts and sample gaps, and cross-CPU reuse
+ * is seen since there is only one set of watchpoints.
+ */
+static int
+operate_shared(uart_sampler_t *s, usf_access_t *ref)
+{
+    int err;
+
+    err = sampler_ref(&s->sampler, ref);
+    E_IF(err, "sampler_ref", 0);
+
+    return 0;
+}
+
 static cycles_t
 operate(conf_object_t         *self,
         conf_object_t         *mem_space,
@@ -186,7 +269,9 @@ operate(conf_object_t         *self,
 {
     uart_sampler_t *s = (uart_sampler_t *)self;
     uart_sampler_conf_t *c = (uart_sampler_conf_t *)s->conf;
+    uart_sampler_cpu_t *cpu;
     usf_access_t ref;
+    uint64_t addr;
 
     if (!s->active)
         return 0;
@@ -202,14 +287,41 @@ operate(conf_object_t         *self,
     assert(SIM_mem_op_is_data(mem_op));
     assert(SIM_mem_op_is_from_cpu(mem_op));
    
-    ref.pc   = eip((mem_op)->ini_ptr);
-    ref.addr = mem_op->physical_address;
+    addr = mem_op->physical_address;
+
+    if (!sampler_addr_match(&s->sampler, addr)) {
+        access_skip(s, c);
+        s->time++;
+        return 0;
+    }
+
+    /* Most accesses are neither sampled nor hit a watchpoint, don't
+     * bother building the access for them. */
+    if (!event_pending(s, c) &&
+        !sampler_watchpoint_check(&s->sampler, addr)) {
+        s->time++;
+        return 0;
+    }
+
+    /* Accesses from a CPU that can't be identified are passed over
+     * like the ones outside the address ranges */
+    cpu = cpu_get(s, mem_op->ini_ptr);
+    if (!cpu) {
+        access_skip(s, c);
+        s->time++;
+        return 0;
+    }
+
+    ref.pc   = cpu->ifc->get_program_counter(cpu->obj);
+    ref.addr = addr;
     ref.time = s->time;
-    ref.tid  = cpuid((mem_op)->ini_ptr);
+    ref.tid  = cpu->id;
     ref.len  = mem_op->size;
     ref.type = SIM_mem_op_is_read(mem_op) ? USF_ATYPE_RD : USF_ATYPE_WR;
- 
-    if (c->master)
+
+    if (c->shared)
+        operate_shared(s, &ref);
+    else if (c->master)
         operate_master(s, c, &ref);
     else
         operate_slave(s, c, &ref);
@@ -238,6 +350,42 @@ set_conf(void          *arg,
     return Sim_Set_Ok;
 }
 
+static attr_value_t
+get_cpus(void          *arg,
+         conf_object_t *self,
+         attr_value_t  *idx)
+{
+    uart_sampler_t *s = (uart_sampler_t *)self;
+    attr_value_t ret = SIM_alloc_attr_list(s->no_cpus);
+
+    for (int i = 0; i < s->no_cpus; i++)
+        ret.u.list.vector[i] = SIM_make_attr_object(s->cpus[i].obj);
+    return ret;
+}
+
+static set_error_t
+set_cpus(void          *arg,
+         conf_object_t *self,
+         attr_value_t  *val,
+         attr_value_t  *idx)
+{
+    uart_sampler_t *s = (uart_sampler_t *)self;
+
+    if (val->u.list.size > MAX_CPUS)
+        return Sim_Set_Illegal_Value;
+
+    s->no_cpus   = 0;
+    s->cpus_full = 0;
+    s->last_cpu  = NULL;
+    for (int i = 0; i < val->u.list.size; i++) {
+        uart_sampler_cpu_t *cpu = cpu_add(s, val->u.list.vector[i].u.object);
+
+        if (!cpu || !cpu->ifc)
+            return Sim_Set_Interface_Not_Found;
+    }
+    return Sim_Set_Ok;
+}
+
 static attr_value_t
 get_start(void          *arg,
           conf_object_t *self,
@@ -303,6 +451,15 @@ init_local(void)
                                  "o", NULL,
                                  "XXX: doc");
  
+    SIM_register_typed_attribute(class, "cpus",
+                                 get_cpus, NULL,
+                                 set_cpus, NULL,
+                                 Sim_Attr_Optional,
+                                 "[o*]", NULL,
+                                 "CPUs connected to the sampler. CPUs that "
+                                 "aren't listed are added on their first "
+                                 "access.");
+
     SIM_register_typed_attribute(class, "start",
                                  get_start, NULL,
                                  set_null,  NULL,
@@ -1,9 +1,11 @@
-#ifndef UART_SAMPLER_H
-#define UART_SAMPLER_H
+#ifndef UART_SAMPLER_SIMICS_H
+#define UART_SAMPLER_SIMICS_H
 #include <uart/sampler.h>
 
 #define FILE_BASE_NAME_LEN  256
 #define RND_TYPE_NAME_LEN   32
+#define MAX_ADDR_RANGES     16
+#define MAX_CPUS            256
 
 typedef struct {
     log_object_t   log;
@@ -19,8 +21,19 @@ typedef struct {
     unsigned short line_size_lg2;
 
     int            master;
+    int            shared;
+    unsigned       seed;
+
+    uint64_t       addr_ranges[MAX_ADDR_RANGES][2];
+    int            no_addr_ranges;
 } uart_sampler_conf_t;
 
+typedef struct {
+    conf_object_t         *obj;
+    processor_interface_t *ifc;     /* NULL if the CPU can't be used */
+    int                    id;
+} uart_sampler_cpu_t;
+
 typedef struct {
     log_object_t   log;
 
@@ -32,8 +45,13 @@ typedef struct {
     unsigned long  burst_begin;
     unsigned long  burst_end;
     unsigned long  next_sample;
+
+    uart_sampler_cpu_t  cpus[MAX_CPUS];
+    int                 no_cpus;
+    int                 cpus_full;  /* "Too many CPUs" was reported */
+    uart_sampler_cpu_t *last_cpu;
 } uart_sampler_t;
 
 void conf_init_local(void);
 
-#endif /* UART_SAMPLER_H */
+#endif /* UART_SAMPLER_SIMICS_H */
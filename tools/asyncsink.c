@@ -0,0 +1,331 @@
+/*
+ * Copyright (C) 2009-2011, David Eklöv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "blockq.h"
+#include "asyncsink.h"
+
+#define BATCH_SIZE 1024
+#define QUEUE_SIZE 8
+
+typedef enum {
+    EV_BURST_BEGIN,
+    EV_BURST_END,
+    EV_SAMPLE,
+    EV_DANGLING,
+    EV_WATCH,
+    EV_UNWATCH,
+    EV_FLUSH,
+} event_type_t;
+
+typedef struct {
+    event_type_t      type;
+    unsigned long     burst;
+    unsigned long     time;
+    double            rate;
+    usf_line_size_2_t line_size_lg2;
+    usf_access_t      begin;
+    usf_access_t      end;
+} event_t;
+
+typedef struct {
+    event_t           events[BATCH_SIZE];
+    unsigned          no_events;
+} batch_t;
+
+typedef struct {
+    sampler_sink_t    sink;
+    sampler_sink_t   *inner;
+
+    pthread_t         thread;
+    blockq_t          queue;
+    batch_t          *batch;     /* Being filled */
+    volatile int      failed;
+} async_t;
+
+static int
+event_run(sampler_sink_t *inner, event_t *e)
+{
+    switch (e->type) {
+    case EV_BURST_BEGIN:
+        return inner->burst_begin(inner, e->burst, e->time, e->rate);
+    case EV_BURST_END:
+        return inner->burst_end(inner, e->burst, e->time);
+    case EV_SAMPLE:
+        return inner->sample(inner, e->burst, &e->begin, &e->end,
+                             e->line_size_lg2);
+    case EV_DANGLING:
+        return inner->dangling(inner, e->burst, &e->begin, e->line_size_lg2);
+    case EV_WATCH:
+        return inner->watch(inner, e->burst, &e->begin);
+    case EV_UNWATCH:
+        return inner->unwatch(inner, e->burst, &e->begin);
+    case EV_FLUSH:
+        return inner->flush(inner);
+    default:
+        return -1;
+    }
+}
+
+static void *
+writer_main(void *arg)
+{
+    async_t *a = (async_t *)arg;
+    batch_t *b;
+
+    while ((b = blockq_pop(&a->queue))) {
+        /* Drop the rest after an error, the sampler gets to know at
+         * its next call */
+        for (unsigned i = 0; i < b->no_events && !a->failed; i++) {
+            if (event_run(a->inner, &b->events[i]))
+                a->failed = 1;
+        }
+        free(b);
+    }
+    return NULL;
+}
+
+static int
+batch_send(async_t *a)
+{
+    if (a->batch && a->batch->no_events) {
+        blockq_push(&a->queue, a->batch);
+        a->batch = NULL;
+    }
+    return a->failed ? -1 : 0;
+}
+
+static event_t *
+event_new(async_t *a, event_type_t type, unsigned long burst)
+{
+    event_t *e;
+
+    if (a->failed)
+        return NULL;
+
+    if (!a->batch) {
+        a->batch = malloc(sizeof(batch_t));
+        if (!a->batch)
+            return NULL;
+        a->batch->no_events = 0;
+    }
+
+    e = &a->batch->events[a->batch->no_events++];
+    e->type = type;
+    e->burst = burst;
+    return e;
+}
+
+static inline int
+event_queue(async_t *a)
+{
+    if (a->batch->no_events == BATCH_SIZE)
+        return batch_send(a);
+    return 0;
+}
+
+static int
+sink_burst_begin(sampler_sink_t *sink, unsigned long burst,
+                 unsigned long time, double rate)
+{
+    async_t *a = (async_t *)sink;
+    event_t *e = event_new(a, EV_BURST_BEGIN, burst);
+
+    if (!e)
+        return -1;
+    e->time = time;
+    e->rate = rate;
+    return event_queue(a);
+}
+
+static int
+sink_burst_end(sampler_sink_t *sink, unsigned long burst,
+               unsigned long time)
+{
+    async_t *a = (async_t *)sink;
+    event_t *e = event_new(a, EV_BURST_END, burst);
+
+    if (!e)
+        return -1;
+    e->time = time;
+    return event_queue(a);
+}
+
+static int
+sink_sample(sampler_sink_t *sink, unsigned long burst,
+            usf_access_t *begin, usf_access_t *end,
+            usf_line_size_2_t line_size_lg2)
+{
+    async_t *a = (async_t *)sink;
+    event_t *e = event_new(a, EV_SAMPLE, burst);
+
+    if (!e)
+        return -1;
+    e->begin = *begin;
+    e->end = *end;
+    e->line_size_lg2 = line_size_lg2;
+    return event_queue(a);
+}
+
+static int
+sink_dangling(sampler_sink_t *sink, unsigned long burst,
+              usf_access_t *begin, usf_line_size_2_t line_size_lg2)
+{
+    async_t *a = (async_t *)sink;
+    event_t *e = event_new(a, EV_DANGLING, burst);
+
+    if (!e)
+        return -1;
+    e->begin = *begin;
+    e->line_size_lg2 = line_size_lg2;
+    return event_queue(a);
+}
+
+static int
+sink_watch(sampler_sink_t *sink, unsigned long burst, usf_access_t *begin)
+{
+    async_t *a = (async_t *)sink;
+    event_t *e = event_new(a, EV_WATCH, burst);
+
+    if (!e)
+        return -1;
+    e->begin = *begin;
+    return event_queue(a);
+}
+
+static int
+sink_unwatch(sampler_sink_t *sink, unsigned long burst, usf_access_t *begin)
+{
+    async_t *a = (async_t *)sink;
+    event_t *e = event_new(a, EV_UNWATCH, burst);
+
+    if (!e)
+        return -1;
+    e->begin = *begin;
+    return event_queue(a);
+}
+
+static int
+sink_flush(sampler_sink_t *sink)
+{
+    async_t *a = (async_t *)sink;
+
+    if (!event_new(a, EV_FLUSH, 0))
+        return -1;
+    return batch_send(a);
+}
+
+static void
+async_free(async_t *a)
+{
+    blockq_fini(&a->queue);
+    free(a->batch);
+    free(a);
+}
+
+static int
+sink_fini(sampler_sink_t *sink)
+{
+    async_t *a = (async_t *)sink;
+    int      err;
+
+    batch_send(a);
+    blockq_push(&a->queue, NULL);
+    pthread_join(a->thread, NULL);
+
+    err = a->inner->fini(a->inner);
+    if (a->failed)
+        err = -1;
+
+    async_free(a);
+    return err;
+}
+
+/* The writer thread doesn't exist in a forked child */
+static void
+sink_discard(sampler_sink_t *sink)
+{
+    async_t *a = (async_t *)sink;
+
+    if (a->inner->discard)
+        a->inner->discard(a->inner);
+    async_free(a);
+}
+
+sampler_sink_t *
+async_sink_new(sampler_sink_t *inner)
+{
+    async_t *a;
+
+    if (!inner)
+        return NULL;
+
+    a = calloc(1, sizeof(async_t));
+    if (!a)
+        goto err_inner;
+
+    a->inner = inner;
+    if (blockq_init(&a->queue, QUEUE_SIZE))
+        goto err_free;
+    if (pthread_create(&a->thread, NULL, writer_main, a)) {
+        blockq_fini(&a->queue);
+        goto err_free;
+    }
+
+    a->sink.burst_begin = sink_burst_begin;
+    a->sink.burst_end = inner->burst_end ? sink_burst_end : NULL;
+    a->sink.sample = sink_sample;
+    a->sink.dangling = sink_dangling;
+    a->sink.watch = inner->watch ? sink_watch : NULL;
+    a->sink.unwatch = inner->unwatch ? sink_unwatch : NULL;
+    a->sink.flush = inner->flush ? sink_flush : NULL;
+    a->sink.fini = sink_fini;
+    a->sink.discard = sink_discard;
+    return &a->sink;
+
+err_free:
+    free(a);
+err_inner:
+    if (inner->discard)
+        inner->discard(inner);
+    return NULL;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
@@ -0,0 +1,527 @@
+/*
+ * Copyright (C) 2009-2011, David Eklöv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <uart/rawtrace.h>
+
+#include "blockq.h"
+#include "input.h"
+#include "traceindex.h"
+
+/* Accesses per block passed from a decoder thread */
+#define SOURCE_BLOCK_SIZE 4096
+/* Blocks queued per decoder thread */
+#define SOURCE_QUEUE_SIZE 8
+
+typedef struct {
+    usf_access_t    accesses[SOURCE_BLOCK_SIZE];
+    unsigned        no_accesses;
+    /* Set in the last block of the source, USF_ERROR_EOF at the end.
+     * A NULL block is the last one if out of memory. */
+    usf_error_t     error;
+} source_block_t;
+
+struct input_source {
+    usf_file_t     *file;
+    const char     *path;
+    usf_atime_t     begin_time;
+    usf_atime_t     end_time;       /* 0 for no limit */
+
+    trace_index_t   index;
+    unsigned long   next_chunk;     /* With an index */
+
+    /* Raw trace, see uart/rawtrace.h */
+    void           *map;
+    size_t          map_size;
+    usf_access_t   *records;
+    unsigned long   raw_pos;
+    unsigned long   raw_end;
+
+    /* Decoder thread, with several sources */
+    pthread_t       thread;
+    blockq_t        queue;
+    int             threaded;
+    volatile int    stop;
+    source_block_t *block;          /* Being consumed */
+    unsigned        pos;
+    int             done;           /* Got the last block */
+    usf_error_t     error;
+
+    usf_access_t    next;           /* Next access in time order */
+};
+
+static int
+trace_open(usf_file_t **file, const char *path)
+{
+    const usf_header_t *header;
+    usf_error_t         error;
+
+    error = usf_open(file, path);
+    if (error != USF_ERROR_OK) {
+        fprintf(stderr, "%s: %s\n", path, usf_strerror(error));
+        *file = NULL;
+        return -1;
+    }
+
+    error = usf_header(&header, *file);
+    if (error != USF_ERROR_OK) {
+        fprintf(stderr, "%s: %s\n", path, usf_strerror(error));
+        goto err;
+    }
+
+    if (!(header->flags & USF_FLAG_TRACE)) {
+        fprintf(stderr, "%s: is not a trace file.\n", path);
+        goto err;
+    }
+
+    return 0;
+
+err:
+    usf_close(*file);
+    *file = NULL;
+    return -1;
+}
+
+/* Open the next chunk of the index, file is NULL after the last one */
+static int
+chunk_next(input_source_t *src)
+{
+    trace_chunk_t *chunk;
+
+    src->file = NULL;
+    if (src->next_chunk == src->index.no_chunks)
+        return 0;
+
+    chunk = &src->index.chunks[src->next_chunk++];
+    if (src->end_time && chunk->begin >= src->end_time)
+        return 0;
+    return trace_open(&src->file, chunk->path);
+}
+
+/* First record at or after time */
+static unsigned long
+raw_find(usf_access_t *records, unsigned long no_records, usf_atime_t time)
+{
+    unsigned long lo = 0;
+    unsigned long hi = no_records;
+
+    while (lo < hi) {
+        unsigned long mid = lo + (hi - lo) / 2;
+
+        if (records[mid].time < time)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Map path if it is a raw trace, 1 if it isn't one */
+static int
+raw_open(input_source_t *src, const char *path)
+{
+    sampler_raw_header_t header;
+    struct stat          st;
+    int                  fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return 1;
+
+    if (read(fd, &header, sizeof(header)) != sizeof(header) ||
+        memcmp(header.magic, SAMPLER_RAW_MAGIC, sizeof(SAMPLER_RAW_MAGIC))) {
+        close(fd);
+        return 1;
+    }
+
+    if (fstat(fd, &st) ||
+        header.version != SAMPLER_RAW_VERSION ||
+        header.record_size != sizeof(usf_access_t) ||
+        !header.no_records || !(header.flags & USF_FLAG_TRACE) ||
+        header.records_offset + header.no_records * header.record_size >
+        st.st_size) {
+        fprintf(stderr, "%s: is not a complete raw trace.\n", path);
+        close(fd);
+        return -1;
+    }
+
+    /* Private and writable, the sampler takes accesses that aren't
+     * const but doesn't write them */
+    src->map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                    fd, 0);
+    close(fd);
+    if (src->map == MAP_FAILED) {
+        src->map = NULL;
+        perror(path);
+        return -1;
+    }
+    src->map_size = st.st_size;
+    madvise(src->map, src->map_size, MADV_SEQUENTIAL);
+
+    /* No index needed, the window is found by its time */
+    src->records = (usf_access_t *)((char *)src->map + header.records_offset);
+    src->raw_pos = raw_find(src->records, header.no_records, src->begin_time);
+    src->raw_end = src->end_time ?
+        raw_find(src->records, header.no_records, src->end_time) :
+        header.no_records;
+    return 0;
+}
+
+static int
+source_open(input_source_t *src, const char *path, const char *index_path,
+            usf_atime_t begin_time, usf_atime_t end_time)
+{
+    src->path = path;
+    src->begin_time = begin_time;
+    src->end_time = end_time;
+
+    switch (raw_open(src, path)) {
+    case 0:
+        return 0;
+    case 1:
+        break;
+    default:
+        return -1;
+    }
+
+    if (trace_open(&src->file, path))
+        return -1;
+
+    if (!begin_time)
+        return 0;
+
+    /* Without an index, everything before the window is decoded and
+     * skipped */
+    if (trace_index_load(&src->index, path, index_path)) {
+        if (index_path) {
+            fprintf(stderr, "%s: Can't load index.\n", index_path);
+            return -1;
+        }
+        return 0;
+    }
+
+    usf_close(src->file);
+    src->next_chunk = trace_index_find(&src->index, begin_time);
+    return chunk_next(src);
+}
+
+static usf_error_t
+source_read(input_source_t *src, usf_access_t *access)
+{
+    usf_error_t error;
+    usf_event_t event;
+
+    if (src->records) {
+        if (src->raw_pos == src->raw_end)
+            return USF_ERROR_EOF;
+        *access = src->records[src->raw_pos++];
+        return USF_ERROR_OK;
+    }
+
+    while (src->file) {
+        error = usf_read(src->file, &event);
+        if (error == USF_ERROR_EOF && src->index.no_chunks) {
+            usf_close(src->file);
+            if (chunk_next(src))
+                return USF_ERROR_FILE;
+            continue;
+        }
+        if (error != USF_ERROR_OK)
+            return error;
+        if (event.type != USF_EVENT_TRACE)
+            return USF_ERROR_FILE;
+
+        if (event.u.trace.access.time < src->begin_time)
+            continue;
+        if (src->end_time && event.u.trace.access.time >= src->end_time) {
+            usf_close(src->file);
+            src->file = NULL;
+            break;
+        }
+
+        *access = event.u.trace.access;
+        return USF_ERROR_OK;
+    }
+
+    return USF_ERROR_EOF;
+}
+
+static void *
+decoder_main(void *arg)
+{
+    input_source_t *src = (input_source_t *)arg;
+    source_block_t *b;
+    usf_error_t     error = USF_ERROR_OK;
+
+    while (error == USF_ERROR_OK) {
+        b = malloc(sizeof(source_block_t));
+        if (!b) {
+            blockq_push(&src->queue, NULL);
+            break;
+        }
+
+        b->no_accesses = 0;
+        while (b->no_accesses < SOURCE_BLOCK_SIZE && error == USF_ERROR_OK) {
+            error = source_read(src, &b->accesses[b->no_accesses]);
+            if (error == USF_ERROR_OK)
+                b->no_accesses++;
+        }
+
+        /* Stopped by input_close() */
+        if (src->stop && error == USF_ERROR_OK)
+            error = USF_ERROR_EOF;
+
+        b->error = error;
+        blockq_push(&src->queue, b);
+    }
+
+    return NULL;
+}
+
+/* Take the next block from the decoder thread */
+static void
+block_next(input_source_t *src)
+{
+    free(src->block);
+    src->block = blockq_pop(&src->queue);
+    src->pos = 0;
+
+    if (!src->block) {
+        src->done = 1;
+        src->error = USF_ERROR_MEM;
+    } else if (src->block->error != USF_ERROR_OK) {
+        src->done = 1;
+        src->error = src->block->error;
+    }
+}
+
+static usf_error_t
+source_next(input_source_t *src)
+{
+    if (!src->threaded)
+        return source_read(src, &src->next);
+
+    while (!src->block || src->pos == src->block->no_accesses) {
+        if (src->done)
+            return src->error;
+        block_next(src);
+    }
+
+    src->next = src->block->accesses[src->pos++];
+    return USF_ERROR_OK;
+}
+
+static int
+source_close(input_source_t *src)
+{
+    int err = 0;
+
+    if (src->threaded) {
+        /* Consume the rest of the blocks, the decoder can't stop while
+         * it waits for room in the queue */
+        src->stop = 1;
+        while (!src->done)
+            block_next(src);
+        pthread_join(src->thread, NULL);
+        blockq_fini(&src->queue);
+        free(src->block);
+    }
+
+    if (src->file && usf_close(src->file) != USF_ERROR_OK)
+        err = -1;
+    if (src->map)
+        munmap(src->map, src->map_size);
+    trace_index_fini(&src->index);
+    return err;
+}
+
+static inline int
+heap_less(input_t *in, unsigned a, unsigned b)
+{
+    usf_atime_t ta = in->sources[in->heap[a]].next.time;
+    usf_atime_t tb = in->sources[in->heap[b]].next.time;
+
+    return ta < tb || (ta == tb && in->heap[a] < in->heap[b]);
+}
+
+static void
+heap_down(input_t *in, unsigned i)
+{
+    for (;;) {
+        unsigned min = i;
+        unsigned l = 2 * i + 1;
+        unsigned r = l + 1;
+        unsigned tmp;
+
+        if (l < in->heap_size && heap_less(in, l, min))
+            min = l;
+        if (r < in->heap_size && heap_less(in, r, min))
+            min = r;
+        if (min == i)
+            return;
+
+        tmp = in->heap[i];
+        in->heap[i] = in->heap[min];
+        in->heap[min] = tmp;
+        i = min;
+    }
+}
+
+int
+input_open(input_t *in, char **paths, unsigned no_paths,
+           const char *index_path, usf_atime_t begin_time,
+           usf_atime_t end_time)
+{
+    in->no_sources = 0;
+    in->heap_size = 0;
+    in->started = 0;
+    in->sources = calloc(no_paths, sizeof(input_source_t));
+    in->heap = malloc(no_paths * sizeof(unsigned));
+    if (!in->sources || !in->heap)
+        goto err;
+
+    for (; in->no_sources < no_paths; in->no_sources++) {
+        input_source_t *src = &in->sources[in->no_sources];
+
+        if (source_open(src, paths[in->no_sources], index_path, begin_time,
+                        end_time)) {
+            in->no_sources++;
+            goto err;
+        }
+    }
+
+    /* A single trace is decoded by the caller */
+    for (unsigned i = 0; no_paths > 1 && i < no_paths; i++) {
+        input_source_t *src = &in->sources[i];
+
+        if (blockq_init(&src->queue, SOURCE_QUEUE_SIZE))
+            goto err;
+        if (pthread_create(&src->thread, NULL, decoder_main, src)) {
+            blockq_fini(&src->queue);
+            goto err;
+        }
+        src->threaded = 1;
+    }
+
+    return 0;
+
+err:
+    input_close(in);
+    return -1;
+}
+
+usf_error_t
+input_read(input_t *in, usf_access_t *access)
+{
+    usf_error_t     error;
+    input_source_t *src;
+
+    if (!in->started) {
+        for (unsigned i = 0; i < in->no_sources; i++) {
+            error = source_next(&in->sources[i]);
+            if (error == USF_ERROR_OK)
+                in->heap[in->heap_size++] = i;
+            else if (error != USF_ERROR_EOF)
+                return error;
+        }
+        for (unsigned i = in->heap_size / 2; i-- > 0;)
+            heap_down(in, i);
+        in->started = 1;
+    }
+
+    if (!in->heap_size)
+        return USF_ERROR_EOF;
+
+    src = &in->sources[in->heap[0]];
+    *access = src->next;
+
+    error = source_next(src);
+    if (error == USF_ERROR_EOF)
+        in->heap[0] = in->heap[--in->heap_size];
+    else if (error != USF_ERROR_OK)
+        return error;
+    heap_down(in, 0);
+
+    return USF_ERROR_OK;
+}
+
+int
+input_mapped(input_t *in)
+{
+    return in->no_sources == 1 && in->sources[0].records;
+}
+
+unsigned long
+input_slice(input_t *in, usf_access_t **accesses, unsigned long max)
+{
+    input_source_t *src = &in->sources[0];
+    unsigned long   n = src->raw_end - src->raw_pos;
+
+    if (n > max)
+        n = max;
+    *accesses = &src->records[src->raw_pos];
+    src->raw_pos += n;
+    return n;
+}
+
+int
+input_close(input_t *in)
+{
+    int err = 0;
+
+    for (unsigned i = 0; i < in->no_sources; i++) {
+        if (source_close(&in->sources[i]))
+            err = -1;
+    }
+
+    free(in->sources);
+    free(in->heap);
+    in->sources = NULL;
+    in->no_sources = 0;
+    return err;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2009-2011, David Eklöv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INPUT_H
+#define INPUT_H
+#include <uart/usf.h>
+
+/*
+ * Trace input of usfsampler. Only the accesses in the time window
+ * [begin_time, end_time) are read. If the window doesn't start at the
+ * beginning and a trace has a seek index, see traceindex.h, reading
+ * starts at the chunk that holds begin_time instead of decoding
+ * everything before it.
+ *
+ * Several traces, e.g. one per thread, are merged by access time.
+ * Their times must come from the same clock. Every trace is then
+ * decoded by a thread of its own, accesses with the same time are
+ * taken in the order the traces were given.
+ *
+ * A trace can also be a raw trace, see uart/rawtrace.h, that is mapped
+ * instead of decoded. A single raw trace can be passed on in place,
+ * see input_slice().
+ */
+
+typedef struct input_source input_source_t;
+
+typedef struct {
+    input_source_t *sources;
+    unsigned        no_sources;
+
+    /* Sources ordered by the time of their next access */
+    unsigned       *heap;
+    unsigned        heap_size;
+    int             started;
+} input_t;
+
+/* index_path is NULL for the default index of every trace */
+int         input_open(input_t *in, char **paths, unsigned no_paths,
+                       const char *index_path, usf_atime_t begin_time,
+                       usf_atime_t end_time);
+/* Next access in time order, USF_ERROR_EOF at the end */
+usf_error_t input_read(input_t *in, usf_access_t *access);
+
+/* Non-zero if the input is a single raw trace */
+int         input_mapped(input_t *in);
+/* Up to max of the next accesses of a mapped input, in place. Returns
+ * their number, 0 at the end. They stay valid until input_close(). */
+unsigned long input_slice(input_t *in, usf_access_t **accesses,
+                          unsigned long max);
+int         input_close(input_t *in);
+
+#endif /* INPUT_H */
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
@@ -0,0 +1,577 @@
+/*
+ * Copyright (C) 2009-2011, David Eklöv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "segment.h"
+
+/* log2 of the initial size of the first access table */
+#define FIRST_SIZE_LG2 12
+
+typedef enum {
+    EV_BURST_BEGIN,
+    EV_BURST_END,
+    EV_SAMPLE,
+    EV_DANGLING,
+    EV_WATCH,
+    EV_UNWATCH,
+} event_type_t;
+
+typedef struct {
+    event_type_t      type;
+    unsigned long     burst;
+    unsigned long     time;
+    double            rate;
+    usf_line_size_2_t line_size_lg2;
+    usf_access_t      begin;
+    usf_access_t      end;
+} event_t;
+
+typedef struct {
+    event_t          *events;
+    unsigned long     no_events;
+    unsigned long     size;
+} event_list_t;
+
+/* First access to a line, key is the line + 1, 0 if unused */
+typedef struct {
+    usf_addr_t        key;
+    usf_access_t      access;
+} first_t;
+
+struct segment {
+    sampler_sink_t    sink;
+
+    unsigned long     idx;
+    unsigned long     begin_time;
+    int               continued;
+    unsigned long     no_bursts;
+    event_list_t      events;
+
+    first_t          *first;
+    unsigned long     no_first;
+    unsigned          first_lg2;
+
+    segment_t        *next;         /* Waiting to be merged */
+};
+
+struct segment_merge {
+    sampler_sink_t   *sink;
+    int               continuous;
+    pthread_mutex_t   lock;
+
+    segment_t        *pending;      /* Sorted by idx */
+    unsigned long     next_idx;
+
+    unsigned long     no_bursts;
+    int               burst_open;
+    unsigned long     open_burst;
+
+    /* Dangling samples from the merged segments */
+    event_list_t      carry;
+    int               failed;
+};
+
+static event_t *
+event_add(event_list_t *l, event_type_t type, unsigned long burst)
+{
+    event_t *e;
+
+    if (l->no_events == l->size) {
+        unsigned long size = l->size ? 2 * l->size : 1024;
+        event_t *events = realloc(l->events, size * sizeof(event_t));
+
+        if (!events)
+            return NULL;
+        l->events = events;
+        l->size = size;
+    }
+
+    e = &l->events[l->no_events++];
+    e->type = type;
+    e->burst = burst;
+    return e;
+}
+
+/* Drawn like the sampler's built-in generators, see rnd_call() */
+static unsigned long
+clock_rnd(segment_clock_t *c)
+{
+    if (c->rnd == sampler_rnd_exp)
+        return (unsigned long)(c->period * -log(1 - erand48(c->rnd_state)));
+    return c->rnd(c->period);
+}
+
+void
+segment_clock_init(segment_clock_t *c, unsigned long period,
+                   unsigned (*rnd)(unsigned), unsigned long size,
+                   unsigned seed, unsigned long time, int start)
+{
+    c->period = period;
+    c->rnd = rnd;
+    c->size = size;
+    c->rnd_state[0] = 0x330e;
+    c->rnd_state[1] = seed & 0xffff;
+    c->rnd_state[2] = seed >> 16;
+
+    c->begin = start ? time + clock_rnd(c) : time;
+    c->end = 0;
+    c->active = 0;
+    c->sampled = 0;
+    c->pending = !start;
+}
+
+int
+segment_clock_ref(segment_clock_t *c, unsigned long time, int sampled)
+{
+    int events = 0;
+
+    if (c->pending && c->begin <= time) {
+        if (!sampled) {
+            c->begin = time + 1;
+            return 0;
+        }
+        c->pending = 0;
+        c->begin = time + clock_rnd(c);
+    }
+
+    if (c->active && c->end <= time) {
+        if (!sampled) {
+            c->end = time + 1;
+            return 0;
+        }
+        c->active = 0;
+        c->begin = time + clock_rnd(c);
+        events |= SEGMENT_BURST_END;
+    }
+
+    if (!c->active && !c->pending && c->begin <= time) {
+        if (!sampled) {
+            c->begin = time + 1;
+            return events;
+        }
+        c->active = 1;
+        c->begin = time;
+        c->end = time + c->size;
+        c->sampled = 0;
+        events |= SEGMENT_BURST_BEGIN;
+    }
+
+    if (c->active && sampled)
+        c->sampled++;
+
+    return events;
+}
+
+static inline first_t *
+first_slot(first_t *table, unsigned lg2, usf_addr_t key)
+{
+    unsigned long mask = (1UL << lg2) - 1;
+    unsigned long i = (key * 0x9e3779b97f4a7c15ULL) >> (64 - lg2);
+
+    while (table[i].key && table[i].key != key)
+        i = (i + 1) & mask;
+    return &table[i];
+}
+
+static int
+first_grow(segment_t *seg)
+{
+    unsigned  lg2 = seg->first ? seg->first_lg2 + 1 : FIRST_SIZE_LG2;
+    first_t  *table = calloc(1UL << lg2, sizeof(first_t));
+
+    if (!table)
+        return -1;
+
+    if (seg->first) {
+        for (unsigned long i = 0; i < 1UL << seg->first_lg2; i++) {
+            if (seg->first[i].key)
+                *first_slot(table, lg2, seg->first[i].key) = seg->first[i];
+        }
+        free(seg->first);
+    }
+
+    seg->first = table;
+    seg->first_lg2 = lg2;
+    return 0;
+}
+
+int
+segment_ref(segment_t *seg, usf_access_t *ref, unsigned short line_size_lg2)
+{
+    usf_addr_t key = (ref->addr >> line_size_lg2) + 1;
+    first_t   *f = first_slot(seg->first, seg->first_lg2, key);
+
+    if (f->key)
+        return 0;
+
+    /* Keep the table at most half full */
+    if (2 * (seg->no_first + 1) > 1UL << seg->first_lg2) {
+        if (first_grow(seg))
+            return -1;
+        f = first_slot(seg->first, seg->first_lg2, key);
+    }
+
+    f->key = key;
+    f->access = *ref;
+    seg->no_first++;
+    return 0;
+}
+
+static first_t *
+first_lookup(segment_t *seg, usf_access_t *begin, unsigned short line_size_lg2)
+{
+    first_t *f = first_slot(seg->first, seg->first_lg2,
+                            (begin->addr >> line_size_lg2) + 1);
+
+    return f->key ? f : NULL;
+}
+
+static int
+sink_burst_begin(sampler_sink_t *sink, unsigned long burst,
+                 unsigned long time, double rate)
+{
+    segment_t *seg = (segment_t *)sink;
+    event_t   *e = event_add(&seg->events, EV_BURST_BEGIN, burst);
+
+    if (!e)
+        return -1;
+    e->time = time;
+    e->rate = rate;
+    seg->no_bursts++;
+    return 0;
+}
+
+static int
+sink_burst_end(sampler_sink_t *sink, unsigned long burst,
+               unsigned long time)
+{
+    segment_t *seg = (segment_t *)sink;
+    event_t   *e = event_add(&seg->events, EV_BURST_END, burst);
+
+    if (!e)
+        return -1;
+    e->time = time;
+    return 0;
+}
+
+static int
+sink_sample(sampler_sink_t *sink, unsigned long burst,
+            usf_access_t *begin, usf_access_t *end,
+            usf_line_size_2_t line_size_lg2)
+{
+    segment_t *seg = (segment_t *)sink;
+    event_t   *e = event_add(&seg->events, EV_SAMPLE, burst);
+
+    if (!e)
+        return -1;
+    e->begin = *begin;
+    e->end = *end;
+    e->line_size_lg2 = line_size_lg2;
+    return 0;
+}
+
+static int
+sink_dangling(sampler_sink_t *sink, unsigned long burst,
+              usf_access_t *begin, usf_line_size_2_t line_size_lg2)
+{
+    segment_t *seg = (segment_t *)sink;
+    event_t   *e = event_add(&seg->events, EV_DANGLING, burst);
+
+    if (!e)
+        return -1;
+    e->begin = *begin;
+    e->line_size_lg2 = line_size_lg2;
+    return 0;
+}
+
+static int
+sink_watch(sampler_sink_t *sink, unsigned long burst, usf_access_t *begin)
+{
+    segment_t *seg = (segment_t *)sink;
+    event_t   *e = event_add(&seg->events, EV_WATCH, burst);
+
+    if (!e)
+        return -1;
+    e->begin = *begin;
+    return 0;
+}
+
+static int
+sink_unwatch(sampler_sink_t *sink, unsigned long burst, usf_access_t *begin)
+{
+    segment_t *seg = (segment_t *)sink;
+    event_t   *e = event_add(&seg->events, EV_UNWATCH, burst);
+
+    if (!e)
+        return -1;
+    e->begin = *begin;
+    return 0;
+}
+
+/* The events are kept until the segment is merged */
+static int
+sink_fini(sampler_sink_t *sink)
+{
+    return 0;
+}
+
+segment_t *
+segment_new(unsigned long idx, unsigned long begin_time, int continued)
+{
+    segment_t *seg = calloc(1, sizeof(segment_t));
+
+    if (!seg)
+        return NULL;
+
+    if (first_grow(seg)) {
+        free(seg);
+        return NULL;
+    }
+
+    seg->idx = idx;
+    seg->begin_time = begin_time;
+    seg->continued = continued;
+
+    seg->sink.burst_begin = sink_burst_begin;
+    seg->sink.burst_end = sink_burst_end;
+    seg->sink.sample = sink_sample;
+    seg->sink.dangling = sink_dangling;
+    seg->sink.watch = sink_watch;
+    seg->sink.unwatch = sink_unwatch;
+    seg->sink.fini = sink_fini;
+    return seg;
+}
+
+void
+segment_free(segment_t *seg)
+{
+    free(seg->events.events);
+    free(seg->first);
+    free(seg);
+}
+
+sampler_sink_t *
+segment_sink(segment_t *seg)
+{
+    return &seg->sink;
+}
+
+segment_merge_t *
+segment_merge_new(sampler_sink_t *sink, int continuous)
+{
+    segment_merge_t *m;
+
+    if (!sink)
+        return NULL;
+
+    m = calloc(1, sizeof(segment_merge_t));
+    if (!m) {
+        if (sink->discard)
+            sink->discard(sink);
+        return NULL;
+    }
+
+    m->sink = sink;
+    m->continuous = continuous;
+    pthread_mutex_init(&m->lock, NULL);
+    return m;
+}
+
+static int
+merge_event(segment_merge_t *m, event_t *e, unsigned long burst)
+{
+    sampler_sink_t *sink = m->sink;
+    event_t        *c;
+
+    switch (e->type) {
+    case EV_BURST_BEGIN:
+        /* Without bursts there is a single one for the whole trace */
+        if (m->continuous && m->no_bursts)
+            return 0;
+        m->burst_open = 1;
+        m->open_burst = burst;
+        return sink->burst_begin(sink, burst, e->time, e->rate);
+    case EV_BURST_END:
+        m->burst_open = 0;
+        return sink->burst_end ? sink->burst_end(sink, burst, e->time) : 0;
+    case EV_SAMPLE:
+        return sink->sample(sink, burst, &e->begin, &e->end,
+                            e->line_size_lg2);
+    case EV_DANGLING:
+        /* Resolved by the following segments */
+        c = event_add(&m->carry, EV_DANGLING, burst);
+        if (!c)
+            return -1;
+        c->begin = e->begin;
+        c->line_size_lg2 = e->line_size_lg2;
+        return 0;
+    case EV_WATCH:
+        return sink->watch ? sink->watch(sink, burst, &e->begin) : 0;
+    case EV_UNWATCH:
+        return sink->unwatch ? sink->unwatch(sink, burst, &e->begin) : 0;
+    default:
+        return -1;
+    }
+}
+
+static int
+merge_segment(segment_merge_t *m, segment_t *seg)
+{
+    sampler_sink_t *sink = m->sink;
+    unsigned long   kept = 0;
+    unsigned long   open_burst = m->open_burst;
+    int             continued;
+    int             err;
+
+    /* Reuses that end in this segment end at the first access to the
+     * line */
+    for (unsigned long i = 0; i < m->carry.no_events; i++) {
+        event_t *c = &m->carry.events[i];
+        first_t *f = first_lookup(seg, &c->begin, c->line_size_lg2);
+
+        if (!f) {
+            m->carry.events[kept++] = *c;
+            continue;
+        }
+
+        err = sink->sample(sink, c->burst, &c->begin, &f->access,
+                           c->line_size_lg2);
+        if (err)
+            return -1;
+    }
+    m->carry.no_events = kept;
+
+    /* The first burst of a continued segment is the open one, its
+     * begin was already passed on */
+    continued = !m->continuous && m->burst_open && seg->continued;
+
+    /* Only if the schedule ended the burst between the segments */
+    if (!m->continuous && m->burst_open && !continued) {
+        m->burst_open = 0;
+        if (sink->burst_end) {
+            err = sink->burst_end(sink, m->open_burst, seg->begin_time);
+            if (err)
+                return -1;
+        }
+    }
+
+    for (unsigned long i = 0; i < seg->events.no_events; i++) {
+        event_t      *e = &seg->events.events[i];
+        unsigned long burst;
+
+        if (m->continuous)
+            burst = 0;
+        else if (continued && !e->burst)
+            burst = open_burst;
+        else
+            burst = m->no_bursts + e->burst - continued;
+
+        if (continued && !e->burst && e->type == EV_BURST_BEGIN)
+            continue;
+
+        err = merge_event(m, e, burst);
+        if (err)
+            return -1;
+    }
+    m->no_bursts += seg->no_bursts - continued;
+
+    return 0;
+}
+
+int
+segment_merge_add(segment_merge_t *m, segment_t *seg)
+{
+    segment_t **p;
+    int         err;
+
+    pthread_mutex_lock(&m->lock);
+
+    for (p = &m->pending; *p && (*p)->idx < seg->idx; p = &(*p)->next)
+        ;
+    seg->next = *p;
+    *p = seg;
+
+    while (m->pending && m->pending->idx == m->next_idx) {
+        seg = m->pending;
+        m->pending = seg->next;
+        m->next_idx++;
+
+        if (!m->failed && merge_segment(m, seg))
+            m->failed = 1;
+        segment_free(seg);
+    }
+
+    err = m->failed ? -1 : 0;
+    pthread_mutex_unlock(&m->lock);
+    return err;
+}
+
+int
+segment_merge_fini(segment_merge_t *m)
+{
+    sampler_sink_t *sink = m->sink;
+    int             err = m->failed ? -1 : 0;
+
+    /* Only after an error, there is a gap in the segments */
+    while (m->pending) {
+        segment_t *seg = m->pending;
+
+        m->pending = seg->next;
+        segment_free(seg);
+        err = -1;
+    }
+
+    for (unsigned long i = 0; i < m->carry.no_events && !err; i++) {
+        event_t *c = &m->carry.events[i];
+
+        err = sink->dangling(sink, c->burst, &c->begin, c->line_size_lg2);
+    }
+
+    if (sink->fini(sink))
+        err = -1;
+
+    pthread_mutex_destroy(&m->lock);
+    free(m->carry.events);
+    free(m);
+    return err;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2009-2011, David Eklöv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SEGMENT_H
+#define SEGMENT_H
+#include <uart/sampler.h>
+
+/*
+ * Time-segmented sampling. Every segment of the trace is sampled by a
+ * sampler of its own that writes to the segment's sink, which keeps
+ * the events in memory. The watchpoints that are still set at the end
+ * of a segment come out as dangling samples. The segment also records
+ * the first access to every line, see segment_ref().
+ *
+ * The merge passes the segments to the real sink in trace order,
+ * renumbering the bursts. A dangling sample is resolved against the
+ * first accesses of the following segments, so every reuse ends where
+ * it would in a sequential run. A burst that is still open at the end
+ * of a segment goes on in the next one.
+ *
+ * The bursts are drawn in trace time by a clock of their own, not by
+ * the samplers of the segments, so the schedule doesn't depend on
+ * where the segments begin. The reader runs the clock over the trace
+ * and hands a copy to every segment, which begins and ends the bursts
+ * of its sampler by it, see segment_clock_ref().
+ */
+
+typedef struct segment segment_t;
+typedef struct segment_merge segment_merge_t;
+
+#define SEGMENT_BURST_END   1
+#define SEGMENT_BURST_BEGIN 2
+
+/* The current burst began at begin, or the next one begins at begin */
+typedef struct {
+    unsigned long   begin;
+    unsigned long   end;
+    int             active;
+    /* Sampled accesses in the current burst so far */
+    unsigned long   sampled;
+    /* The first burst is drawn at the first sampled access */
+    int             pending;
+    unsigned long   period;
+    unsigned long   size;
+    unsigned      (*rnd)(unsigned);
+    unsigned short  rnd_state[3];
+} segment_clock_t;
+
+/* With start, the first burst is drawn from time on, like
+ * sampler_start() does. Otherwise it is drawn from the first sampled
+ * access at or after time, like in a sampler that sees the whole
+ * trace. */
+void            segment_clock_init(segment_clock_t *c, unsigned long period,
+                                   unsigned (*rnd)(unsigned),
+                                   unsigned long size, unsigned seed,
+                                   unsigned long time, int start);
+
+/* Pass an access to the clock, returns the SEGMENT_BURST_* boundaries
+ * at the access. Like in a sequential sampler, a boundary that falls
+ * on an access that isn't sampled moves to the next access, see
+ * sampler_ref_skip(). Outside bursts, accesses before the next
+ * boundary can be left out. */
+int             segment_clock_ref(segment_clock_t *c, unsigned long time,
+                                  int sampled);
+
+/* If continued, the segment begins in the middle of the burst that
+ * was open at the end of the previous segment. That burst is the
+ * first one the segment's sampler begins. */
+segment_t      *segment_new(unsigned long idx, unsigned long begin_time,
+                            int continued);
+void            segment_free(segment_t *seg);
+
+/* Sink that collects the events of the segment */
+sampler_sink_t *segment_sink(segment_t *seg);
+
+/* Record an access to the line containing ref, only the first one of
+ * every line is kept. Pass the accesses that can hit a watchpoint. */
+int             segment_ref(segment_t *seg, usf_access_t *ref,
+                            unsigned short line_size_lg2);
+
+/* If continuous, the segments are parts of one and the same burst,
+ * i.e. the sampler doesn't use bursts. The merge takes over sink. */
+segment_merge_t *segment_merge_new(sampler_sink_t *sink, int continuous);
+
+/* Thread safe, the segments can be added in any order. The merge
+ * takes over seg. */
+int             segment_merge_add(segment_merge_t *m, segment_t *seg);
+
+/* Write the samples that never were resolved as dangling, finish the
+ * sink and free the merge */
+int             segment_merge_fini(segment_merge_t *m);
+
+#endif /* SEGMENT_H */
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
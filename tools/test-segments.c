@@ -0,0 +1,260 @@
+/*
+ * Test of usfsampler --segments against a sequential run. The
+ * segments share the burst schedule of the sequential sampler, so
+ * with constant sample gaps they must give the same bursts, samples
+ * and dangling samples. Exponential sample gaps are drawn from a seed
+ * per segment and are left out.
+ *
+ *   test-segments [usfsampler]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <uart/usf.h>
+
+#define TRACE         "test-segments.usf"
+#define SEQ_BASE      "test-segments-seq"
+#define SEG_BASE      "test-segments-seg"
+
+#define NO_ACCESSES   60000
+#define LINE_SIZE_LG2 6
+
+#define SEGMENTS      "-j 3 -e 5000"
+
+typedef struct {
+    unsigned long burst;
+    int           type;
+    unsigned long begin;
+    unsigned long end;
+} record_t;
+
+typedef struct {
+    record_t      *records;
+    unsigned long  no_records;
+    unsigned long  max_records;
+    unsigned long  no_bursts;
+} output_t;
+
+/* Sampled with and without segments */
+static const char *configs[] = {
+    "-s 20 -S const -b 9000 -z 4000 -B const",
+    "-s 20 -S const -b 9000 -z 4000 -B exp -r 3",
+    "-s 20 -S const -b 9000 -z 4000 -B exp -r 5 -A data",
+    "-s 20 -S const -b 9000 -z 4000 -B exp -r 7 -A instructions",
+    "-s 20 -S const -b 9000 -z 4000 -B const -a 0x1000000:0x1004000",
+    "-s 20 -S const -b 9000 -z 4000 -B const -T 3001 -E 50000",
+    "-x 0.1",
+    "-x 0.1 -b 9000 -z 4000 -B const",
+    NULL
+};
+
+static int failed;
+
+#define CHECK(_cond, ...) do {                          \
+    if (!(_cond)) {                                     \
+        fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+        fprintf(stderr, __VA_ARGS__);                   \
+        fprintf(stderr, "\n");                          \
+        failed = 1;                                     \
+    }                                                   \
+} while (0)
+
+/* A loop of instruction fetches over 64 lines, every other fetch
+ * followed by a data access to one of 512 lines, from two threads */
+static void
+trace_write(void)
+{
+    usf_header_t  header;
+    usf_file_t   *f;
+    usf_event_t   event;
+    unsigned long pc = 0x400000;
+    unsigned      rnd = 1;
+
+    memset(&header, 0, sizeof(header));
+    header.version = USF_VERSION_CURRENT;
+    header.compression = USF_COMPRESSION_NONE;
+    header.flags = USF_FLAG_TRACE | USF_FLAG_NATIVE_ENDIAN;
+    header.line_sizes = 1 << LINE_SIZE_LG2;
+
+    if (usf_create(&f, TRACE, &header)) {
+        fprintf(stderr, "Can't create %s\n", TRACE);
+        exit(1);
+    }
+
+    memset(&event, 0, sizeof(event));
+    event.type = USF_EVENT_TRACE;
+    for (unsigned long i = 0; i < NO_ACCESSES; i++) {
+        usf_access_t *a = &event.u.trace.access;
+
+        rnd = rnd * 1103515245 + 12345;
+        a->time = i;
+        a->tid = (rnd >> 20) & 1;
+        if (i % 3 == 2) {
+            a->pc = pc;
+            a->addr = 0x1000000 + ((rnd >> 8) % 4096) * 8;
+            a->len = 8;
+            a->type = (rnd >> 24) % 3 ? USF_ATYPE_RD : USF_ATYPE_WR;
+        } else {
+            pc = pc + (1 << LINE_SIZE_LG2) < 0x401000 ?
+                pc + (1 << LINE_SIZE_LG2) : 0x400000;
+            a->pc = pc;
+            a->addr = pc;
+            a->len = 1 << LINE_SIZE_LG2;
+            a->type = USF_ATYPE_INSTRUCTION;
+        }
+
+        if (usf_append(f, &event)) {
+            fprintf(stderr, "Can't write %s\n", TRACE);
+            exit(1);
+        }
+    }
+    usf_close(f);
+}
+
+static void
+record_add(output_t *o, unsigned long burst, int type,
+           unsigned long begin, unsigned long end)
+{
+    record_t *r;
+
+    if (o->no_records == o->max_records) {
+        o->max_records = o->max_records ? 2 * o->max_records : 1024;
+        o->records = realloc(o->records, o->max_records * sizeof(record_t));
+        if (!o->records) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+
+    r = &o->records[o->no_records++];
+    r->burst = burst;
+    r->type = type;
+    r->begin = begin;
+    r->end = end;
+}
+
+static int
+record_cmp(const void *a, const void *b)
+{
+    const record_t *ra = (const record_t *)a;
+    const record_t *rb = (const record_t *)b;
+
+    if (ra->burst != rb->burst)
+        return ra->burst < rb->burst ? -1 : 1;
+    if (ra->type != rb->type)
+        return ra->type < rb->type ? -1 : 1;
+    if (ra->begin != rb->begin)
+        return ra->begin < rb->begin ? -1 : 1;
+    if (ra->end != rb->end)
+        return ra->end < rb->end ? -1 : 1;
+    return 0;
+}
+
+/* Read <base>.<burst> until a burst is missing, and remove the files.
+ * The order within a burst differs, the merge writes samples that end
+ * in later segments late. */
+static void
+output_read(output_t *o, const char *base)
+{
+    char path[256];
+
+    memset(o, 0, sizeof(*o));
+    for (;; o->no_bursts++) {
+        usf_file_t  *f;
+        usf_event_t  event;
+
+        snprintf(path, sizeof(path), "%s.%lu", base, o->no_bursts);
+        if (usf_open(&f, path))
+            break;
+
+        while (usf_read(f, &event) == USF_ERROR_OK) {
+            switch (event.type) {
+            case USF_EVENT_BURST:
+                record_add(o, o->no_bursts, event.type,
+                           event.u.burst.begin_time, 0);
+                break;
+            case USF_EVENT_SAMPLE:
+                record_add(o, o->no_bursts, event.type,
+                           event.u.sample.begin.time,
+                           event.u.sample.end.time);
+                break;
+            case USF_EVENT_DANGLING:
+                record_add(o, o->no_bursts, event.type,
+                           event.u.dangling.begin.time, 0);
+                break;
+            default:
+                break;
+            }
+        }
+        usf_close(f);
+        unlink(path);
+    }
+
+    qsort(o->records, o->no_records, sizeof(record_t), record_cmp);
+}
+
+static void
+run(const char *usfsampler, const char *base, const char *config,
+    const char *extra)
+{
+    char cmd[1024];
+
+    snprintf(cmd, sizeof(cmd), "%s -i %s -o %s %s %s", usfsampler, TRACE,
+             base, config, extra);
+    if (system(cmd)) {
+        fprintf(stderr, "Failed: %s\n", cmd);
+        exit(1);
+    }
+}
+
+static void
+test_config(const char *usfsampler, const char *config)
+{
+    output_t seq, seg;
+
+    run(usfsampler, SEQ_BASE, config, "");
+    run(usfsampler, SEG_BASE, config, SEGMENTS);
+    output_read(&seq, SEQ_BASE);
+    output_read(&seg, SEG_BASE);
+
+    CHECK(seq.no_bursts > 1 || strstr(config, "-b") == NULL,
+          "%s: %lu bursts", config, seq.no_bursts);
+    CHECK(seq.no_bursts == seg.no_bursts, "%s: %lu bursts, %lu segmented",
+          config, seq.no_bursts, seg.no_bursts);
+    CHECK(seq.no_records == seg.no_records, "%s: %lu records, %lu segmented",
+          config, seq.no_records, seg.no_records);
+
+    for (unsigned long i = 0; i < seq.no_records && i < seg.no_records; i++) {
+        record_t *a = &seq.records[i];
+        record_t *b = &seg.records[i];
+
+        if (record_cmp(a, b)) {
+            CHECK(0, "%s: burst %lu type %d %lu-%lu, segmented "
+                  "burst %lu type %d %lu-%lu", config,
+                  a->burst, a->type, a->begin, a->end,
+                  b->burst, b->type, b->begin, b->end);
+            break;
+        }
+    }
+
+    free(seq.records);
+    free(seg.records);
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *usfsampler = argc > 1 ? argv[1] : "./usfsampler";
+
+    trace_write();
+    for (int i = 0; configs[i]; i++)
+        test_config(usfsampler, configs[i]);
+    unlink(TRACE);
+
+    if (failed)
+        return 1;
+    printf("PASS\n");
+    return 0;
+}
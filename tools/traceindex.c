@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2009-2011, David Eklöv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "traceindex.h"
+
+#define LINE_SIZE 4096
+
+static int
+chunk_add(trace_index_t *index, usf_atime_t begin, usf_atime_t end,
+          const char *dir, size_t dir_len, const char *name)
+{
+    trace_chunk_t *chunk;
+    trace_chunk_t *chunks;
+
+    chunks = realloc(index->chunks,
+                     (index->no_chunks + 1) * sizeof(trace_chunk_t));
+    if (!chunks)
+        return -1;
+    index->chunks = chunks;
+
+    chunk = &chunks[index->no_chunks];
+    chunk->begin = begin;
+    chunk->end = end;
+    chunk->path = malloc(dir_len + strlen(name) + 1);
+    if (!chunk->path)
+        return -1;
+    memcpy(chunk->path, dir, dir_len);
+    strcpy(chunk->path + dir_len, name);
+
+    index->no_chunks++;
+    return 0;
+}
+
+int
+trace_index_load(trace_index_t *index, const char *trace, const char *path)
+{
+    char         default_path[LINE_SIZE];
+    char         line[LINE_SIZE];
+    char         magic[16];
+    const char  *slash;
+    struct stat  st_trace;
+    struct stat  st_index;
+    FILE        *f;
+    int          version;
+
+    index->chunks = NULL;
+    index->no_chunks = 0;
+
+    if (!path) {
+        snprintf(default_path, sizeof(default_path), "%s" TRACE_INDEX_SUFFIX,
+                 trace);
+        path = default_path;
+    }
+
+    if (stat(path, &st_index))
+        return -1;
+    if (!stat(trace, &st_trace) && st_trace.st_mtime > st_index.st_mtime) {
+        fprintf(stderr, "%s: is older than %s, ignored.\n", path, trace);
+        return -1;
+    }
+
+    f = fopen(path, "r");
+    if (!f)
+        return -1;
+
+    if (!fgets(line, sizeof(line), f) ||
+        sscanf(line, "%15s %d", magic, &version) != 2 ||
+        strcmp(magic, TRACE_INDEX_MAGIC) || version != TRACE_INDEX_VERSION)
+        goto err;
+
+    slash = strrchr(path, '/');
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long long begin, end;
+        char *name;
+        int   n;
+
+        if (sscanf(line, "%llu %llu %n", &begin, &end, &n) != 2)
+            goto err;
+        name = line + n;
+        name[strcspn(name, "\n")] = '\0';
+        /* A time that repeats across a split ends one chunk and
+         * begins the next */
+        if (!*name || (index->no_chunks &&
+                       begin < index->chunks[index->no_chunks - 1].end))
+            goto err;
+
+        if (chunk_add(index, begin, end, path, slash ? slash - path + 1 : 0,
+                      name))
+            goto err;
+    }
+
+    fclose(f);
+    return 0;
+
+err:
+    fprintf(stderr, "%s: is not a valid index.\n", path);
+    fclose(f);
+    trace_index_fini(index);
+    return -1;
+}
+
+void
+trace_index_fini(trace_index_t *index)
+{
+    for (unsigned long i = 0; i < index->no_chunks; i++)
+        free(index->chunks[i].path);
+    free(index->chunks);
+    index->chunks = NULL;
+    index->no_chunks = 0;
+}
+
+unsigned long
+trace_index_find(trace_index_t *index, usf_atime_t time)
+{
+    unsigned long lo = 0;
+    unsigned long hi = index->no_chunks;
+
+    while (lo < hi) {
+        unsigned long mid = lo + (hi - lo) / 2;
+
+        if (index->chunks[mid].end < time)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
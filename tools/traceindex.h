@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2009-2011, David Eklöv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TRACEINDEX_H
+#define TRACEINDEX_H
+#include <uart/usf.h>
+
+/*
+ * Seek index of a USF trace, written by usfindex. A compressed trace
+ * can only be decoded from the start, so the index splits it into
+ * chunks, traces of their own with the header of the original. The
+ * index lists them in time order with the times of their first and
+ * last access. A chunk can begin at the time the previous one ends,
+ * accesses can share a time:
+ *
+ *   usfindex 1
+ *   <first time> <last time> <chunk file>
+ *   ...
+ *
+ * Chunk files are relative to the directory of the index. The index
+ * of <trace> is <trace>.idx by default, its chunks <trace>.idx.<n>.
+ */
+
+#define TRACE_INDEX_MAGIC   "usfindex"
+#define TRACE_INDEX_VERSION 1
+#define TRACE_INDEX_SUFFIX  ".idx"
+
+typedef struct {
+    usf_atime_t     begin;
+    usf_atime_t     end;            /* Last access, inclusive */
+    char           *path;
+} trace_chunk_t;
+
+typedef struct {
+    trace_chunk_t  *chunks;
+    unsigned long   no_chunks;
+} trace_index_t;
+
+/* Load the index of trace from path, NULL for the default. Fails if
+ * the index is older than the trace. */
+int             trace_index_load(trace_index_t *index, const char *trace,
+                                 const char *path);
+void            trace_index_fini(trace_index_t *index);
+
+/* First chunk that has accesses at or after time, no_chunks if
+ * none */
+unsigned long   trace_index_find(trace_index_t *index, usf_atime_t time);
+
+#endif /* TRACEINDEX_H */
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2009-2011, David Eklöv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Write a seek index for a USF trace, see traceindex.h. The trace is
+ * split into chunks of a fixed number of events, that usfsampler
+ * --begin-time can start decoding at.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <stdarg.h>
+
+#include <uart/usf.h>
+
+#include "traceindex.h"
+
+/* Default events per chunk */
+#define CHUNK_SIZE (1UL << 24)
+
+typedef struct {
+    char           *i_file_name;
+    char           *o_file_name;
+    unsigned long   chunk_size;
+    int             verbose;
+} args_t;
+
+#define USF_E(_e) do {                                  \
+        usf_error_t __e = (_e);                         \
+        if (__e != USF_ERROR_OK) {                      \
+            fprintf(stderr, "%s\n", usf_strerror(__e)); \
+            return 1;                                   \
+        }                                               \
+    } while (0)
+
+static void
+usage(char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    if (fmt)
+        vfprintf(stderr, fmt, args);
+    va_end(args);
+
+    fprintf(stderr, "Usage: usfindex [OPTION...]\n");
+    fprintf(stderr, "   --help,          -h             Print this\n");
+    fprintf(stderr, "   --infile,        -i FILE        Trace file\n");
+    fprintf(stderr, "   --outfile,       -o FILE        Index file, default <infile>"
+            TRACE_INDEX_SUFFIX "\n");
+    fprintf(stderr, "   --chunk-size,    -c NUM         Events per chunk\n");
+    fprintf(stderr, "   --verbose,       -v             Print a summary\n");
+}
+
+static int
+parse_args(int argc, char **argv, args_t *args)
+{
+    int c;
+    int opt_idx = 0;
+
+    bzero(args, sizeof(*args));
+    args->chunk_size = CHUNK_SIZE;
+
+    static struct option long_opts[] = {
+        {"help",           no_argument,       NULL, 'h'},
+        {"infile",         required_argument, NULL, 'i'},
+        {"outfile",        required_argument, NULL, 'o'},
+        {"chunk-size",     required_argument, NULL, 'c'},
+        {"verbose",        no_argument,       NULL, 'v'},
+        {NULL,             0,                 NULL, 0}
+    };
+
+    while ((c = getopt_long(argc, argv, "hi:o:c:v",
+                            long_opts, &opt_idx)) != -1) {
+        switch (c) {
+        case 'i':
+            args->i_file_name = optarg;
+            break;
+        case 'o':
+            args->o_file_name = optarg;
+            break;
+        case 'c':
+            args->chunk_size = atol(optarg);
+            if (!args->chunk_size) {
+                usage("Error: Illegal chunk size: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'v':
+            args->verbose = 1;
+            break;
+        case 'h':
+        default:
+            usage(NULL);
+            return 1;
+        }
+    }
+
+    if (!args->i_file_name) {
+        usage("Error: --infile must be specified.\n");
+        return 1;
+    }
+
+    if (!args->o_file_name) {
+        size_t len = strlen(args->i_file_name) + sizeof(TRACE_INDEX_SUFFIX);
+
+        args->o_file_name = malloc(len);
+        if (!args->o_file_name)
+            return 1;
+        snprintf(args->o_file_name, len, "%s" TRACE_INDEX_SUFFIX,
+                 args->i_file_name);
+    }
+
+    return 0;
+}
+
+static void
+chunk_write(FILE *index, usf_atime_t begin, usf_atime_t end, const char *path)
+{
+    const char *name = strrchr(path, '/');
+
+    fprintf(index, "%llu %llu %s\n", (unsigned long long)begin,
+            (unsigned long long)end, name ? name + 1 : path);
+}
+
+int
+main(int argc, char **argv)
+{
+    args_t              args;
+    usf_file_t         *in;
+    usf_file_t         *chunk = NULL;
+    const usf_header_t *header;
+    usf_event_t         event;
+    usf_error_t         error;
+    usf_atime_t         begin = 0, end = 0;
+    unsigned long       no_chunks = 0;
+    unsigned long       no_events = 0;
+    char                tmp_path[4096];
+    char                path[4096];
+    FILE               *index;
+
+    if (parse_args(argc, argv, &args))
+        return 1;
+
+    USF_E(usf_open(&in, args.i_file_name));
+    USF_E(usf_header(&header, in));
+    if (!(header->flags & USF_FLAG_TRACE)) {
+        fprintf(stderr, "%s: is not a trace file.\n", args.i_file_name);
+        return 1;
+    }
+
+    /* Written under another name and renamed when complete, a
+     * partial index is never used */
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", args.o_file_name);
+    index = fopen(tmp_path, "w");
+    if (!index) {
+        perror(tmp_path);
+        return 1;
+    }
+    fprintf(index, "%s %d\n", TRACE_INDEX_MAGIC, TRACE_INDEX_VERSION);
+
+    while ((error = usf_read(in, &event)) == USF_ERROR_OK) {
+        if (event.type != USF_EVENT_TRACE)
+            continue;
+
+        if (!chunk) {
+            snprintf(path, sizeof(path), "%s.%lu", args.o_file_name,
+                     no_chunks);
+            USF_E(usf_create(&chunk, path, header));
+            begin = event.u.trace.access.time;
+            no_events = 0;
+        }
+
+        USF_E(usf_append(chunk, &event));
+        end = event.u.trace.access.time;
+
+        if (++no_events == args.chunk_size) {
+            USF_E(usf_close(chunk));
+            chunk = NULL;
+            chunk_write(index, begin, end, path);
+            no_chunks++;
+        }
+    }
+    if (error != USF_ERROR_EOF) {
+        fprintf(stderr, "%s\n", usf_strerror(error));
+        return 1;
+    }
+
+    if (chunk) {
+        USF_E(usf_close(chunk));
+        chunk_write(index, begin, end, path);
+        no_chunks++;
+    }
+    USF_E(usf_close(in));
+
+    if (fclose(index) || rename(tmp_path, args.o_file_name)) {
+        perror(args.o_file_name);
+        return 1;
+    }
+
+    if (args.verbose)
+        printf("%s: %lu chunks\n", args.o_file_name, no_chunks);
+
+    return 0;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
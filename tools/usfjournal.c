@@ -0,0 +1,356 @@
+/*
+ * Copyright (C) 2009-2011, David Eklöv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Recover USF files from a sample journal, see uart/journal.h. Every
+ * burst in the journal becomes <base>.<burst>. Watchpoints that never
+ * produced a sample or dangling sample, because the process died
+ * before sampler_fini(), are written as dangling samples.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <uart/usf.h>
+#include <uart/journal.h>
+#include <uart/sampler.h>
+
+typedef struct {
+    char *i_file_name;
+    char *o_file_name;
+    int   verbose;
+} args_t;
+
+typedef struct {
+    unsigned long bursts;
+    unsigned long samples;
+    unsigned long dangling;
+    unsigned long outstanding;
+} stats_t;
+
+#define USF_E(_e) do {                                  \
+        usf_error_t __e = (_e);                         \
+        if (__e != USF_ERROR_OK) {                      \
+            fprintf(stderr, "%s\n", usf_strerror(__e)); \
+            return 1;                                   \
+        }                                               \
+    } while (0)
+
+static void
+usage(char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    if (fmt)
+        vfprintf(stderr, fmt, args);
+    va_end(args);
+
+    fprintf(stderr, "Usage: usfjournal [OPTION...]\n");
+    fprintf(stderr, "   --help,          -h             Print this\n");
+    fprintf(stderr, "   --infile,        -i FILE        Journal file\n");
+    fprintf(stderr, "   --outfile,       -o FILE        Output file base name\n");
+    fprintf(stderr, "   --verbose,       -v             Print a summary\n");
+}
+
+static int
+parse_args(int argc, char **argv, args_t *args)
+{
+    int c;
+    int opt_idx = 0;
+
+    bzero(args, sizeof(*args));
+
+    static struct option long_opts[] = {
+        {"help",           no_argument,       NULL, 'h'},
+        {"infile",         required_argument, NULL, 'i'},
+        {"outfile",        required_argument, NULL, 'o'},
+        {"verbose",        no_argument,       NULL, 'v'},
+        {NULL,             0,                 NULL, 0}
+    };
+
+    while ((c = getopt_long(argc, argv, "hi:o:v",
+                            long_opts, &opt_idx)) != -1) {
+        switch (c) {
+        case 'i':
+            args->i_file_name = optarg;
+            break;
+        case 'o':
+            args->o_file_name = optarg;
+            break;
+        case 'v':
+            args->verbose = 1;
+            break;
+        case 'h':
+        default:
+            usage(NULL);
+            return 1;
+        }
+    }
+
+    if (!args->i_file_name) {
+        usage("Error: --infile must be specified.\n");
+        return 1;
+    }
+
+    if (!args->o_file_name) {
+        usage("Error: --outfile must be specified.\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+static int
+record_valid(const sampler_journal_record_t *r)
+{
+    return r->commit == SAMPLER_JOURNAL_COMMIT &&
+        r->checksum == sampler_journal_checksum(r) &&
+        r->type >= SAMPLER_JOURNAL_BURST_BEGIN &&
+        r->type <= SAMPLER_JOURNAL_UNWATCH;
+}
+
+static int
+record_comp(const void *p1, const void *p2)
+{
+    const sampler_journal_record_t *r1 = *(sampler_journal_record_t **)p1;
+    const sampler_journal_record_t *r2 = *(sampler_journal_record_t **)p2;
+
+    if (r1->burst != r2->burst)
+        return r1->burst < r2->burst ? -1 : 1;
+    return r1->seq < r2->seq ? -1 : r1->seq > r2->seq;
+}
+
+static int
+time_comp(const void *p1, const void *p2)
+{
+    const usf_atime_t t1 = *(usf_atime_t *)p1;
+    const usf_atime_t t2 = *(usf_atime_t *)p2;
+
+    return t1 < t2 ? -1 : t1 > t2;
+}
+
+/* Write one burst, records are sorted by sequence number */
+static int
+burst_write(const args_t *args, const sampler_journal_header_t *header,
+            sampler_journal_record_t **records, size_t no_records,
+            stats_t *stats)
+{
+    usf_file_t   *file;
+    usf_header_t  usf_header;
+    usf_event_t   event;
+    usf_atime_t  *done;
+    size_t        no_done = 0;
+    usf_atime_t   begin_time = records[0]->time;
+    double        rate = 0;
+    char          path[256];
+    char          rate_arg[64];
+    char         *argv[1] = { rate_arg };
+
+    /* Watchpoints are consumed by samples, dangling samples and
+     * unwatch records with the same begin time. */
+    done = malloc(no_records * sizeof(usf_atime_t));
+    if (!done)
+        return 1;
+
+    for (size_t i = 0; i < no_records; i++) {
+        const sampler_journal_record_t *r = records[i];
+
+        if (r->type == SAMPLER_JOURNAL_SAMPLE ||
+            r->type == SAMPLER_JOURNAL_DANGLING ||
+            r->type == SAMPLER_JOURNAL_UNWATCH)
+            done[no_done++] = r->begin.time;
+        if (r->type == SAMPLER_JOURNAL_BURST_BEGIN) {
+            begin_time = r->time;
+            rate = r->rate;
+        }
+    }
+    qsort(done, no_done, sizeof(usf_atime_t), time_comp);
+
+    bzero(&usf_header, sizeof(usf_header));
+    usf_header.version = USF_VERSION_CURRENT;
+    usf_header.compression = USF_COMPRESSION_BZIP2;
+    usf_header.flags = header->flags;
+    usf_header.line_sizes = header->line_sizes;
+    /* The rate is unknown if the burst header was overwritten */
+    if (rate > 0) {
+        snprintf(rate_arg, sizeof(rate_arg), SAMPLER_RATE_ARG "%.9g", rate);
+        usf_header.argc = 1;
+        usf_header.argv = argv;
+    }
+
+    snprintf(path, 256, "%s.%lu", args->o_file_name,
+             (unsigned long)records[0]->burst);
+    USF_E(usf_create(&file, path, &usf_header));
+
+    event.type = USF_EVENT_BURST;
+    event.u.burst.begin_time = begin_time;
+    USF_E(usf_append(file, &event));
+
+    for (size_t i = 0; i < no_records; i++) {
+        const sampler_journal_record_t *r = records[i];
+
+        switch (r->type) {
+        case SAMPLER_JOURNAL_SAMPLE:
+            event.type = USF_EVENT_SAMPLE;
+            event.u.sample.begin = r->begin;
+            event.u.sample.end = r->end;
+            event.u.sample.line_size = r->line_size;
+            stats->samples++;
+            break;
+
+        case SAMPLER_JOURNAL_DANGLING:
+            event.type = USF_EVENT_DANGLING;
+            event.u.dangling.begin = r->begin;
+            event.u.dangling.line_size = r->line_size;
+            stats->dangling++;
+            break;
+
+        case SAMPLER_JOURNAL_WATCH:
+            if (bsearch(&r->begin.time, done, no_done, sizeof(usf_atime_t),
+                        time_comp))
+                continue;
+
+            event.type = USF_EVENT_DANGLING;
+            event.u.dangling.begin = r->begin;
+            event.u.dangling.line_size = __builtin_ctzll(header->line_sizes);
+            stats->outstanding++;
+            break;
+
+        default:
+            continue;
+        }
+
+        USF_E(usf_append(file, &event));
+    }
+
+    free(done);
+    USF_E(usf_close(file));
+    stats->bursts++;
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    args_t                           args;
+    stats_t                          stats;
+    struct stat                      st;
+    const uint8_t                   *base;
+    const sampler_journal_header_t  *header;
+    const sampler_journal_record_t  *ring;
+    sampler_journal_record_t       **records;
+    size_t                           no_records = 0;
+    int                              fd, fini = 0;
+
+    if (parse_args(argc, argv, &args))
+        return 1;
+
+    fd = open(args.i_file_name, O_RDONLY);
+    if (fd == -1 || fstat(fd, &st)) {
+        perror(args.i_file_name);
+        return 1;
+    }
+
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        perror(args.i_file_name);
+        return 1;
+    }
+
+    header = (const sampler_journal_header_t *)base;
+    if (st.st_size < sizeof(*header) ||
+        memcmp(header->magic, SAMPLER_JOURNAL_MAGIC,
+               sizeof(SAMPLER_JOURNAL_MAGIC)) ||
+        header->version != SAMPLER_JOURNAL_VERSION ||
+        header->record_size != sizeof(sampler_journal_record_t) ||
+        header->records_offset +
+        header->no_records * header->record_size > st.st_size) {
+        fprintf(stderr, "%s: is not a journal file.\n", args.i_file_name);
+        return 1;
+    }
+    ring = (const sampler_journal_record_t *)(base + header->records_offset);
+
+    records = malloc(header->no_records * sizeof(sampler_journal_record_t *));
+    if (!records) {
+        fprintf(stderr, "Out of memory.\n");
+        return 1;
+    }
+
+    for (uint64_t i = 0; i < header->no_records; i++) {
+        if (!record_valid(&ring[i]))
+            continue;
+        if (ring[i].type == SAMPLER_JOURNAL_FINI) {
+            fini = 1;
+            continue;
+        }
+        records[no_records++] = (sampler_journal_record_t *)&ring[i];
+    }
+    qsort(records, no_records, sizeof(*records), record_comp);
+
+    bzero(&stats, sizeof(stats));
+    for (size_t i = 0, j; i < no_records; i = j) {
+        for (j = i + 1; j < no_records && records[j]->burst == records[i]->burst; j++)
+            ;
+
+        if (burst_write(&args, header, records + i, j - i, &stats))
+            return 1;
+    }
+
+    if (args.verbose) {
+        printf("%s: %s\n", args.i_file_name,
+               fini ? "clean shutdown" : "incomplete");
+        printf("bursts: %lu samples: %lu dangling: %lu outstanding: %lu\n",
+               stats.bursts, stats.samples, stats.dangling,
+               stats.outstanding);
+    }
+
+    free(records);
+    munmap((void *)base, st.st_size);
+    return 0;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
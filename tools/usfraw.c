@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2009-2011, David Eklöv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Convert a USF trace to a raw trace, see uart/rawtrace.h, that
+ * usfsampler can map instead of decoding it.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <stdarg.h>
+
+#include <uart/usf.h>
+#include <uart/rawtrace.h>
+
+typedef struct {
+    char *i_file_name;
+    char *o_file_name;
+    int   verbose;
+} args_t;
+
+#define USF_E(_e) do {                                  \
+        usf_error_t __e = (_e);                         \
+        if (__e != USF_ERROR_OK) {                      \
+            fprintf(stderr, "%s\n", usf_strerror(__e)); \
+            return 1;                                   \
+        }                                               \
+    } while (0)
+
+static void
+usage(char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    if (fmt)
+        vfprintf(stderr, fmt, args);
+    va_end(args);
+
+    fprintf(stderr, "Usage: usfraw [OPTION...]\n");
+    fprintf(stderr, "   --help,          -h             Print this\n");
+    fprintf(stderr, "   --infile,        -i FILE        USF trace file\n");
+    fprintf(stderr, "   --outfile,       -o FILE        Raw trace file\n");
+    fprintf(stderr, "   --verbose,       -v             Print a summary\n");
+}
+
+static int
+parse_args(int argc, char **argv, args_t *args)
+{
+    int c;
+    int opt_idx = 0;
+
+    bzero(args, sizeof(*args));
+
+    static struct option long_opts[] = {
+        {"help",           no_argument,       NULL, 'h'},
+        {"infile",         required_argument, NULL, 'i'},
+        {"outfile",        required_argument, NULL, 'o'},
+        {"verbose",        no_argument,       NULL, 'v'},
+        {NULL,             0,                 NULL, 0}
+    };
+
+    while ((c = getopt_long(argc, argv, "hi:o:v",
+                            long_opts, &opt_idx)) != -1) {
+        switch (c) {
+        case 'i':
+            args->i_file_name = optarg;
+            break;
+        case 'o':
+            args->o_file_name = optarg;
+            break;
+        case 'v':
+            args->verbose = 1;
+            break;
+        case 'h':
+        default:
+            usage(NULL);
+            return 1;
+        }
+    }
+
+    if (!args->i_file_name) {
+        usage("Error: --infile must be specified.\n");
+        return 1;
+    }
+
+    if (!args->o_file_name) {
+        usage("Error: --outfile must be specified.\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+static int
+header_write(FILE *f, sampler_raw_header_t *header)
+{
+    return fseek(f, 0, SEEK_SET) ||
+        fwrite(header, sizeof(*header), 1, f) != 1;
+}
+
+int
+main(int argc, char **argv)
+{
+    args_t                args;
+    usf_file_t           *in;
+    const usf_header_t   *trace_header;
+    usf_event_t           event;
+    usf_error_t           error;
+    usf_atime_t           last = 0;
+    sampler_raw_header_t  header;
+    FILE                 *out;
+
+    if (parse_args(argc, argv, &args))
+        return 1;
+
+    USF_E(usf_open(&in, args.i_file_name));
+    USF_E(usf_header(&trace_header, in));
+    if (!(trace_header->flags & USF_FLAG_TRACE)) {
+        fprintf(stderr, "%s: is not a trace file.\n", args.i_file_name);
+        return 1;
+    }
+
+    out = fopen(args.o_file_name, "w");
+    if (!out) {
+        perror(args.o_file_name);
+        return 1;
+    }
+
+    /* no_records is set last, an incomplete file isn't used */
+    bzero(&header, sizeof(header));
+    memcpy(header.magic, SAMPLER_RAW_MAGIC, sizeof(SAMPLER_RAW_MAGIC));
+    header.version = SAMPLER_RAW_VERSION;
+    header.flags = trace_header->flags;
+    header.line_sizes = trace_header->line_sizes;
+    header.records_offset = SAMPLER_RAW_RECORDS_OFFSET;
+    header.record_size = sizeof(usf_access_t);
+    if (header_write(out, &header) ||
+        fseek(out, header.records_offset, SEEK_SET))
+        goto err_out;
+
+    while ((error = usf_read(in, &event)) == USF_ERROR_OK) {
+        if (event.type != USF_EVENT_TRACE)
+            continue;
+
+        /* Readers search the records by time */
+        if (header.no_records && event.u.trace.access.time < last) {
+            fprintf(stderr, "%s: accesses aren't in time order.\n",
+                    args.i_file_name);
+            return 1;
+        }
+        last = event.u.trace.access.time;
+
+        if (fwrite(&event.u.trace.access, sizeof(usf_access_t), 1, out) != 1)
+            goto err_out;
+        header.no_records++;
+    }
+    if (error != USF_ERROR_EOF) {
+        fprintf(stderr, "%s\n", usf_strerror(error));
+        return 1;
+    }
+    USF_E(usf_close(in));
+
+    if (header_write(out, &header) || fclose(out))
+        goto err_out;
+
+    if (args.verbose)
+        printf("%s: %llu accesses\n", args.o_file_name,
+               (unsigned long long)header.no_records);
+
+    return 0;
+
+err_out:
+    perror(args.o_file_name);
+    return 1;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
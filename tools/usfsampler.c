@@ -35,12 +35,40 @@
 #include <getopt.h>
 #include <stdarg.h>
 #include <strings.h>
+#include <pthread.h>
 
 #include <uart/usf.h>
 #include <uart/sampler.h>
 
+#include "asyncsink.h"
+#include "blockq.h"
+#include "input.h"
+#include "segment.h"
+
+#define MAX_ADDR_RANGES 16
+#define MAX_CONFIGS     64
+#define MAX_CONFIG_ARGS 64
+#define MAX_INPUTS      256
+
+/* Accesses per block passed to the configuration workers */
+#define BLOCK_SIZE      4096
+/* Accesses per block taken in place from a raw trace */
+#define SLICE_SIZE      (1UL << 16)
+/* Blocks queued per worker */
+#define QUEUE_SIZE      16
+/* Default accesses per segment with --segments */
+#define SEGMENT_SIZE    (1UL << 24)
+
+typedef enum {
+    ACCESSES_DATA = 0,          /* Memory accesses */
+    ACCESSES_INSTRUCTIONS,      /* Instruction fetches */
+    ACCESSES_UNIFIED,           /* Both, in the same watchpoints */
+    ACCESSES_SEPARATE,          /* Both, with a sampler each */
+} accesses_t;
+
 typedef struct {
-    char *i_file_name;
+    char *i_file_names[MAX_INPUTS];
+    unsigned no_inputs;
     char *o_file_name;
 
     unsigned long   sample_period;
@@ -51,18 +79,36 @@ typedef struct {
     unsigned short  line_size_lg2;
     unsigned int    random_seed;
     int             log_level;
-} args_t;
+    sampler_output_t output;
+    double          spatial_rate;
+    unsigned long   spatial_budget;
+    sampler_target_t target;
+    double          target_value;
+    unsigned long   sample_period_min;
+    unsigned long   sample_period_max;
+    unsigned long   reservoir_size;
+    unsigned long   phase_interval;
+    double          phase_threshold;
+    unsigned        phase_bursts;
+    unsigned        sdist_precision;
+    unsigned long   sdist_bucket;
+    unsigned        sharing_table_size;
 
-#define USF_CHECK_E(_x) do {                    \
-        usf_error_t error = _x;                 \
-        USF_E(error);                           \
-    } while (0)
+    usf_addr_t      addr_ranges[MAX_ADDR_RANGES][2];
+    unsigned        no_addr_ranges;
 
-#define USF_E(_e)                                       \
-    if ((_e) != USF_ERROR_OK) {                         \
-        fprintf(stderr, "%s\n", usf_strerror(error));   \
-        goto error_out;                                 \
-    }
+    char           *configs[MAX_CONFIGS];
+    unsigned        no_configs;
+
+    unsigned        segments;
+    unsigned long   segment_size;
+
+    usf_atime_t     begin_time;
+    usf_atime_t     end_time;
+    char           *index_name;
+
+    accesses_t      accesses;
+} args_t;
 
 static void
 usage(char *fmt, ...)
@@ -76,7 +122,8 @@ usage(char *fmt, ...)
 
     fprintf(stderr, "Usage: usfsampler [OPTION...]\n");
     fprintf(stderr, "   --help,          -h             Print this\n");
-    fprintf(stderr, "   --infile,        -i FILE        Input file\n");
+    fprintf(stderr, "   --infile,        -i FILE        Input file, may be repeated to merge\n");
+    fprintf(stderr, "                                   traces by access time\n");
     fprintf(stderr, "   --outfile,       -o FILE        Output file base name\n");
     fprintf(stderr, "   --sample-period, -s NUM         Average time between samples\n");
     fprintf(stderr, "   --sample-rnd,    -S STR         Random generator exp/const\n");
@@ -86,19 +133,100 @@ usage(char *fmt, ...)
     fprintf(stderr, "   --line-size,     -l NUM         Line size\n");
     fprintf(stderr, "   --seed,          -r NUM         Random seed\n");
     fprintf(stderr, "   --verbose,       -v NUM         Verbosity\n");
+    fprintf(stderr, "   --addr-range,    -a BEGIN:END   Only sample accesses in range\n");
+    fprintf(stderr, "   --output,        -O STR         Output format usf/container/columnar/\n");
+    fprintf(stderr, "                                   journal/pcprof\n");
+    fprintf(stderr, "   --spatial-rate,  -x NUM         Sample lines with hashes below rate\n");
+    fprintf(stderr, "   --spatial-budget,-m NUM         Max watchpoints in spatial mode\n");
+    fprintf(stderr, "   --target,        -t STR=NUM     Adapt the sample period to a target\n");
+    fprintf(stderr, "                                   samples (per second)/watchpoints/bytes\n");
+    fprintf(stderr, "   --period-range,  -p MIN:MAX     Limits of the adapted sample period\n");
+    fprintf(stderr, "   --reservoir,     -k NUM         Keep NUM samples from the whole run\n");
+    fprintf(stderr, "   --phase-interval,-n NUM         Skip bursts in already sampled phases\n");
+    fprintf(stderr, "   --phase-threshold,-d NUM        Max signature distance in a phase\n");
+    fprintf(stderr, "   --phase-bursts,  -c NUM         Bursts to sample per phase\n");
+    fprintf(stderr, "   --sdist-precision,-q NUM        Estimate stack distances, log2 registers\n");
+    fprintf(stderr, "   --sdist-bucket,  -w NUM         Accesses per stack distance sketch\n");
+    fprintf(stderr, "   --sharing,       -g NUM         Report NUM top shared lines/PC pairs\n");
+    fprintf(stderr, "   --config,        -C STR         Configuration to run, may be repeated.\n");
+    fprintf(stderr, "                                   STR holds options applied on top of the\n");
+    fprintf(stderr, "                                   others, outfile defaults to <outfile>-<n>\n");
+    fprintf(stderr, "   --segments,      -j NUM         Sample time segments on NUM threads\n");
+    fprintf(stderr, "   --segment-size,  -e NUM         Accesses per segment\n");
+    fprintf(stderr, "   --begin-time,    -T NUM         Only sample accesses from NUM\n");
+    fprintf(stderr, "   --end-time,      -E NUM         Only sample accesses before NUM\n");
+    fprintf(stderr, "   --index,         -I FILE        Seek index, default <infile>.idx\n");
+    fprintf(stderr, "   --accesses,      -A STR         Accesses to sample data/instructions/\n");
+    fprintf(stderr, "                                   unified/separate, separate writes\n");
+    fprintf(stderr, "                                   <outfile>-data and <outfile>-instr\n");
 }
 
 static int
-parse_args(int argc, char **argv, args_t *args)
+parse_addr_range(char *str, args_t *args)
+{
+    char *end;
+    usf_addr_t *range;
+
+    if (args->no_addr_ranges >= MAX_ADDR_RANGES)
+        return 1;
+    range = args->addr_ranges[args->no_addr_ranges];
+
+    range[0] = strtoull(str, &end, 0);
+    if (*end != ':')
+        return 1;
+
+    range[1] = strtoull(end + 1, &end, 0);
+    if (*end != '\0' || range[1] <= range[0])
+        return 1;
+
+    args->no_addr_ranges++;
+    return 0;
+}
+
+static int
+parse_target(char *str, args_t *args)
+{
+    char *value = strchr(str, '=');
+    char *end;
+
+    if (!value)
+        return 1;
+    *value++ = '\0';
+
+    if (!strcmp(str, "samples"))
+        args->target = SAMPLER_TARGET_SAMPLES;
+    else if (!strcmp(str, "watchpoints"))
+        args->target = SAMPLER_TARGET_WATCHPOINTS;
+    else if (!strcmp(str, "bytes"))
+        args->target = SAMPLER_TARGET_BYTES;
+    else
+        return 1;
+
+    args->target_value = strtod(value, &end);
+    return *end != '\0' || args->target_value <= 0;
+}
+
+static int
+parse_period_range(char *str, args_t *args)
+{
+    char *end;
+
+    args->sample_period_min = strtoul(str, &end, 0);
+    if (*end != ':')
+        return 1;
+
+    args->sample_period_max = strtoul(end + 1, &end, 0);
+    return *end != '\0' ||
+        (args->sample_period_max &&
+         args->sample_period_max < args->sample_period_min);
+}
+
+static int
+parse_opts(int argc, char **argv, args_t *args)
 {
     int c;
     int opt_idx = 0;
 
-    bzero(args, sizeof(*args));
-    args->line_size_lg2 = 6;
-    args->sample_rnd    = "exp";
-    args->burst_rnd     = "exp";
-
     static struct option long_opts[] = {
         {"help",           no_argument,       NULL, 'h'},
         {"infile",         required_argument, NULL, 'i'},
@@ -111,14 +239,38 @@ parse_args(int argc, char **argv, args_t *args)
         {"line-size",      required_argument, NULL, 'l'},
         {"seed",           required_argument, NULL, 'r'},
         {"verbose",        required_argument, NULL, 'v'},
-
+        {"addr-range",     required_argument, NULL, 'a'},
+        {"output",         required_argument, NULL, 'O'},
+        {"spatial-rate",   required_argument, NULL, 'x'},
+        {"spatial-budget", required_argument, NULL, 'm'},
+        {"target",         required_argument, NULL, 't'},
+        {"period-range",   required_argument, NULL, 'p'},
+        {"reservoir",      required_argument, NULL, 'k'},
+        {"phase-interval", required_argument, NULL, 'n'},
+        {"phase-threshold", required_argument, NULL, 'd'},
+        {"phase-bursts",   required_argument, NULL, 'c'},
+        {"sdist-precision", required_argument, NULL, 'q'},
+        {"sdist-bucket",   required_argument, NULL, 'w'},
+        {"sharing",        required_argument, NULL, 'g'},
+        {"config",         required_argument, NULL, 'C'},
+        {"segments",       required_argument, NULL, 'j'},
+        {"segment-size",   required_argument, NULL, 'e'},
+        {"begin-time",     required_argument, NULL, 'T'},
+        {"end-time",       required_argument, NULL, 'E'},
+        {"index",          required_argument, NULL, 'I'},
+        {"accesses",       required_argument, NULL, 'A'},
+        {NULL,             0,                 NULL, 0}
     };
 
-    while ((c = getopt_long(argc, argv, "hi:o:s:S:b:B:z:l:r:v:",
+    while ((c = getopt_long(argc, argv, "hi:o:s:S:b:B:z:l:r:v:a:O:x:m:t:p:k:n:d:c:q:w:g:C:j:e:T:E:I:A:",
                             long_opts, &opt_idx)) != -1) {
         switch (c) {
         case 'i':
-            args->i_file_name = optarg;
+            if (args->no_inputs >= MAX_INPUTS) {
+                usage("Error: Too many input files\n");
+                return 1;
+            }
+            args->i_file_names[args->no_inputs++] = optarg;
             break;
         case 'o':
             args->o_file_name = optarg;
@@ -147,14 +299,204 @@ parse_args(int argc, char **argv, args_t *args)
         case 'v':
             args->log_level = atoi(optarg);
             break;
+        case 'a':
+            if (parse_addr_range(optarg, args)) {
+                usage("Error: Illegal address range: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'O':
+            if (!strcmp(optarg, "usf"))
+                args->output = SAMPLER_OUTPUT_USF;
+            else if (!strcmp(optarg, "container"))
+                args->output = SAMPLER_OUTPUT_CONTAINER;
+            else if (!strcmp(optarg, "columnar"))
+                args->output = SAMPLER_OUTPUT_COLUMNAR;
+            else if (!strcmp(optarg, "journal"))
+                args->output = SAMPLER_OUTPUT_JOURNAL;
+            else if (!strcmp(optarg, "pcprof"))
+                args->output = SAMPLER_OUTPUT_PCPROF;
+            else {
+                usage("Error: Illegal output format: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'x':
+            args->spatial_rate = atof(optarg);
+            if (args->spatial_rate <= 0 || args->spatial_rate > 1) {
+                usage("Error: Illegal spatial rate: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'm':
+            args->spatial_budget = atol(optarg);
+            break;
+        case 't':
+            if (parse_target(optarg, args)) {
+                usage("Error: Illegal target: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'p':
+            if (parse_period_range(optarg, args)) {
+                usage("Error: Illegal period range: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'k':
+            args->reservoir_size = atol(optarg);
+            break;
+        case 'n':
+            args->phase_interval = atol(optarg);
+            break;
+        case 'd':
+            args->phase_threshold = atof(optarg);
+            break;
+        case 'c':
+            args->phase_bursts = atoi(optarg);
+            break;
+        case 'q':
+            args->sdist_precision = atoi(optarg);
+            if (args->sdist_precision < 4 || args->sdist_precision > 16) {
+                usage("Error: Illegal stack distance precision: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'w':
+            args->sdist_bucket = atol(optarg);
+            break;
+        case 'g':
+            args->sharing_table_size = atoi(optarg);
+            break;
+        case 'C':
+            if (args->no_configs >= MAX_CONFIGS) {
+                usage("Error: Too many configurations\n");
+                return 1;
+            }
+            args->configs[args->no_configs++] = optarg;
+            break;
+        case 'j':
+            args->segments = atoi(optarg);
+            break;
+        case 'e':
+            args->segment_size = atol(optarg);
+            if (!args->segment_size) {
+                usage("Error: Illegal segment size: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'T':
+            args->begin_time = strtoull(optarg, NULL, 0);
+            break;
+        case 'E':
+            args->end_time = strtoull(optarg, NULL, 0);
+            break;
+        case 'I':
+            args->index_name = optarg;
+            break;
+        case 'A':
+            if (!strcmp(optarg, "data"))
+                args->accesses = ACCESSES_DATA;
+            else if (!strcmp(optarg, "instructions"))
+                args->accesses = ACCESSES_INSTRUCTIONS;
+            else if (!strcmp(optarg, "unified"))
+                args->accesses = ACCESSES_UNIFIED;
+            else if (!strcmp(optarg, "separate"))
+                args->accesses = ACCESSES_SEPARATE;
+            else {
+                usage("Error: Illegal accesses: %s\n", optarg);
+                return 1;
+            }
+            break;
         case 'h':
         default:
             usage(NULL);
             return 1;
         }
     }
-    
-    if (!args->i_file_name) {
+
+    /* The period is only adapted when a burst begins */
+    if (args->target != SAMPLER_TARGET_NONE && !args->burst_size) {
+        usage("Error: --target needs --burst-size\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * A configuration is a string of options that are applied on top of
+ * the common ones, e.g. -C "-s 1000 -r 2". The input is shared.
+ */
+static int
+parse_config(args_t *common, unsigned idx, args_t *args)
+{
+    char *argv[MAX_CONFIG_ARGS + 1];
+    int   argc = 0;
+    char *str;
+    char *tok;
+    char *save;
+
+    *args = *common;
+    args->no_configs = 0;
+
+    /* The options point into the string, it lives as long as the
+     * process */
+    str = strdup(common->configs[idx]);
+    if (!str)
+        return 1;
+
+    argv[argc++] = "usfsampler";
+    for (tok = strtok_r(str, " \t", &save); tok;
+         tok = strtok_r(NULL, " \t", &save)) {
+        if (argc == MAX_CONFIG_ARGS) {
+            usage("Error: Too many options in configuration: %s\n",
+                  common->configs[idx]);
+            return 1;
+        }
+        argv[argc++] = tok;
+    }
+    argv[argc] = NULL;
+
+    optind = 0;
+    if (parse_opts(argc, argv, args))
+        return 1;
+
+    if (args->no_configs || args->no_inputs != common->no_inputs ||
+        args->segments || args->begin_time != common->begin_time ||
+        args->end_time != common->end_time ||
+        args->index_name != common->index_name) {
+        usage("Error: Configurations can't have --config, --infile, "
+              "--segments, --begin-time, --end-time or --index\n");
+        return 1;
+    }
+
+    if (args->o_file_name == common->o_file_name) {
+        size_t len = strlen(common->o_file_name) + 16;
+
+        args->o_file_name = malloc(len);
+        if (!args->o_file_name)
+            return 1;
+        snprintf(args->o_file_name, len, "%s-%u", common->o_file_name,
+                 idx + 1);
+    }
+
+    return 0;
+}
+
+static int
+parse_args(int argc, char **argv, args_t *args)
+{
+    bzero(args, sizeof(*args));
+    args->line_size_lg2 = 6;
+    args->sample_rnd    = "exp";
+    args->burst_rnd     = "exp";
+    args->segment_size  = SEGMENT_SIZE;
+
+    if (parse_opts(argc, argv, args))
+        return 1;
+
+    if (!args->no_inputs) {
         usage("Error: --infile must be specified.\n");
         return 1;
     }
@@ -164,11 +506,34 @@ parse_args(int argc, char **argv, args_t *args)
         return 1;
     }
 
+    if (args->end_time && args->end_time <= args->begin_time) {
+        usage("Error: --end-time must be after --begin-time.\n");
+        return 1;
+    }
+
+    if (args->index_name && args->no_inputs > 1) {
+        usage("Error: --index needs a single --infile.\n");
+        return 1;
+    }
+
+    /* Segments are sampled independently, anything that carries
+     * state from one burst to the next doesn't work */
+    if (args->segments &&
+        (args->no_configs || args->accesses == ACCESSES_SEPARATE ||
+         args->reservoir_size || args->phase_interval ||
+         args->sdist_precision || args->sharing_table_size ||
+         args->target != SAMPLER_TARGET_NONE || args->spatial_budget)) {
+        usage("Error: --segments can't be combined with --config, "
+              "--accesses separate, --reservoir, --phase-interval, "
+              "--sdist-precision, --sharing, --target or --spatial-budget\n");
+        return 1;
+    }
+
     return 0;
 }
 
 static int
-my_sampler_init(sampler_t *sampler, args_t *args)
+sampler_config(sampler_t *sampler, args_t *args)
 {
     int err;
 
@@ -183,8 +548,29 @@ my_sampler_init(sampler_t *sampler, args_t *args)
     sampler->line_size_lg2   = args->line_size_lg2;
     sampler->seed            = args->random_seed;
     sampler->log_level       = args->log_level;
+    sampler->output          = args->output;
+    sampler->spatial_rate    = args->spatial_rate;
+    sampler->spatial_budget  = args->spatial_budget;
+    sampler->target          = args->target;
+    sampler->target_value    = args->target_value;
+    sampler->sample_period_min = args->sample_period_min;
+    sampler->sample_period_max = args->sample_period_max;
+    sampler->reservoir_size  = args->reservoir_size;
+    sampler->phase_interval  = args->phase_interval;
+    sampler->phase_threshold = args->phase_threshold;
+    sampler->phase_bursts    = args->phase_bursts;
+    sampler->sdist_precision = args->sdist_precision;
+    sampler->sdist_bucket    = args->sdist_bucket;
+    sampler->sharing_table_size = args->sharing_table_size;
+    if (args->accesses != ACCESSES_DATA)
+        sampler->usf_flags |= USF_FLAG_INSTRUCTIONS;
 
-    srand((unsigned int)sampler->seed);
+    for (int i = 0; i < args->no_addr_ranges; i++) {
+        err = sampler_addr_range_add(sampler, args->addr_ranges[i][0],
+                                     args->addr_ranges[i][1]);
+        if (err)
+            return err;
+    }
 
     if (!strncmp(args->burst_rnd, "const", 5)) {
         sampler->burst_rnd = sampler_rnd_const;
@@ -198,71 +584,577 @@ my_sampler_init(sampler_t *sampler, args_t *args)
         sampler->sample_rnd = sampler_rnd_exp;
     }
 
+    return 0;
+}
+
+static int
+my_sampler_init(sampler_t *sampler, args_t *args)
+{
+    int err;
+
+    err = sampler_config(sampler, args);
+    if (err)
+        return err;
+
+    /* Write the output from a thread of its own */
+    sampler->sink = async_sink_new(sampler_sink_create(sampler,
+                                                       sampler->output));
+    if (!sampler->sink)
+        return -1;
+
     if (!sampler->burst_size) {
-        err = sampler_burst_begin(sampler, 0);
+        err = sampler_burst_begin(sampler, args->begin_time);
         if (err)
             return err;
     }
 
+    /* A window is sampled like a part of a longer run */
+    if (args->begin_time)
+        sampler_start(sampler, args->begin_time);
+
     return 0;
 }
 
+/*
+ * The trace is replayed by a pipeline. The main thread decodes the
+ * trace into blocks that are passed to one sampling thread per
+ * configuration, two with --accesses separate. A block is freed by
+ * the last thread that is done with it. Every sampler writes its
+ * output from a thread of its own, see asyncsink.h. Without --config
+ * there is a single configuration made up of the common options.
+ */
 
-int
-main(int argc, char **argv)
+typedef struct {
+    usf_access_t   *accesses;
+    unsigned long   no_accesses;
+    int             refs;
+    unsigned long   segment;        /* With --segments */
+    /* Burst clock and whether the previous segment left a burst
+     * open, set in the first block of a segment */
+    segment_clock_t clock;
+    int             continued;
+    /* Decoded accesses, a block of a raw trace points into the
+     * mapping */
+    usf_access_t    storage[];
+} block_t;
+
+typedef struct {
+    pthread_t       thread;
+    blockq_t        queue;
+    args_t          args;
+    sampler_t       sampler;
+    int             failed;
+} worker_t;
+
+static void
+block_put(block_t *b)
 {
-    args_t args;
-    sampler_t sampler;
-    usf_file_t *usf_i_file;
-    usf_header_t *header;
+    if (!__sync_sub_and_fetch(&b->refs, 1))
+        free(b);
+}
 
-    if (parse_args(argc, argv, &args))
+static inline int
+access_sampled(accesses_t accesses, usf_access_t *access)
+{
+    switch (access->type) {
+    case USF_ATYPE_RD: case USF_ATYPE_WR: case USF_ATYPE_RW:
+        return accesses != ACCESSES_INSTRUCTIONS;
+    case USF_ATYPE_INSTRUCTION:
+        return accesses != ACCESSES_DATA;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Replay an access. Other accesses still count in time, they move the
+ * pending samples and bursts forward, see sampler_ref_skip().
+ */
+static inline int
+access_ref(sampler_t *sampler, accesses_t accesses, usf_access_t *access)
+{
+    if (!access_sampled(accesses, access)) {
+        sampler_ref_skip(sampler, access->time);
+        return 0;
+    }
+    return sampler_ref(sampler, access);
+}
+
+static void *
+worker_main(void *arg)
+{
+    worker_t *w = (worker_t *)arg;
+    block_t  *b;
+
+    /* Keep draining the queue after an error, the reader would block
+     * otherwise */
+    while ((b = blockq_pop(&w->queue))) {
+        for (unsigned long i = 0; i < b->no_accesses && !w->failed; i++) {
+            if (access_ref(&w->sampler, w->args.accesses, &b->accesses[i])) {
+                fprintf(stderr, "Sampler error: %s\n", w->args.o_file_name);
+                w->failed = 1;
+            }
+        }
+        block_put(b);
+    }
+
+    if (sampler_fini(&w->sampler))
+        w->failed = 1;
+    return NULL;
+}
+
+/* Decode the next block of accesses, or take it in place from a raw
+ * trace. NULL at the end of the trace. */
+static int
+block_read(input_t *in, block_t **block)
+{
+    block_t *b;
+
+    *block = NULL;
+
+    if (input_mapped(in)) {
+        b = malloc(sizeof(block_t));
+        if (!b)
+            return 1;
+        b->no_accesses = input_slice(in, &b->accesses, SLICE_SIZE);
+    } else {
+        b = malloc(sizeof(block_t) + BLOCK_SIZE * sizeof(usf_access_t));
+        if (!b)
+            return 1;
+        b->accesses = b->storage;
+        b->no_accesses = 0;
+
+        while (b->no_accesses < BLOCK_SIZE) {
+            usf_error_t error;
+
+            error = input_read(in, &b->accesses[b->no_accesses]);
+            if (error == USF_ERROR_EOF)
+                break;
+            if (error != USF_ERROR_OK) {
+                fprintf(stderr, "%s\n", usf_strerror(error));
+                free(b);
+                return 1;
+            }
+            b->no_accesses++;
+        }
+    }
+
+    if (!b->no_accesses)
+        free(b);
+    else
+        *block = b;
+    return 0;
+}
+
+static void
+block_send(worker_t *workers, unsigned no_workers, block_t *b)
+{
+    b->refs = no_workers;
+    for (unsigned i = 0; i < no_workers; i++)
+        blockq_push(&workers[i].queue, b);
+}
+
+static char *
+file_name_suffix(const char *name, const char *suffix)
+{
+    size_t len = strlen(name) + strlen(suffix) + 2;
+    char  *str = malloc(len);
+
+    if (str)
+        snprintf(str, len, "%s-%s", name, suffix);
+    return str;
+}
+
+/* A configuration with --accesses separate is run by two workers,
+ * returns the number of workers */
+static unsigned
+config_split(args_t *args, worker_t *workers)
+{
+    if (args->accesses != ACCESSES_SEPARATE) {
+        workers[0].args = *args;
+        return 1;
+    }
+
+    workers[0].args = *args;
+    workers[0].args.accesses = ACCESSES_DATA;
+    workers[0].args.o_file_name = file_name_suffix(args->o_file_name, "data");
+    workers[1].args = *args;
+    workers[1].args.accesses = ACCESSES_INSTRUCTIONS;
+    workers[1].args.o_file_name = file_name_suffix(args->o_file_name, "instr");
+
+    return workers[0].args.o_file_name && workers[1].args.o_file_name ? 2 : 0;
+}
+
+static int
+run_pipeline(args_t *args, input_t *in)
+{
+    worker_t *workers;
+    unsigned  no_configs = args->no_configs ? args->no_configs : 1;
+    unsigned  no_splits = 0;
+    unsigned  no_workers = 0;
+    block_t  *b;
+    int       ret = 0;
+
+    workers = calloc(2 * no_configs, sizeof(worker_t));
+    if (!workers)
+        return 1;
+
+    for (unsigned i = 0; i < no_configs; i++) {
+        args_t   config;
+        unsigned n;
+
+        if (!args->no_configs)
+            config = *args;
+        else if (parse_config(args, i, &config)) {
+            free(workers);
+            return 1;
+        }
+
+        n = config_split(&config, &workers[no_splits]);
+        if (!n) {
+            free(workers);
+            return 1;
+        }
+        no_splits += n;
+    }
+
+    for (; no_workers < no_splits; no_workers++) {
+        worker_t *w = &workers[no_workers];
+
+        if (blockq_init(&w->queue, QUEUE_SIZE)) {
+            ret = 1;
+            break;
+        }
+
+        if (my_sampler_init(&w->sampler, &w->args)) {
+            fprintf(stderr, "Error initializing sampler: %s\n",
+                    w->args.o_file_name);
+            blockq_fini(&w->queue);
+            ret = 1;
+            break;
+        }
+
+        if (pthread_create(&w->thread, NULL, worker_main, w)) {
+            sampler_fini(&w->sampler);
+            blockq_fini(&w->queue);
+            ret = 1;
+            break;
+        }
+    }
+
+    while (!ret) {
+        ret = block_read(in, &b);
+        if (ret || !b)
+            break;
+        block_send(workers, no_workers, b);
+    }
+
+    for (unsigned i = 0; i < no_workers; i++) {
+        blockq_push(&workers[i].queue, NULL);
+        pthread_join(workers[i].thread, NULL);
+        blockq_fini(&workers[i].queue);
+        if (workers[i].failed)
+            ret = 1;
+    }
+
+    free(workers);
+    return ret;
+}
+
+/*
+ * With --segments, the trace is split into segments of whole blocks
+ * and at least segment_size accesses, that are handed out round robin
+ * to the sampling threads.
+ * Every segment is sampled on its own, with a seed of its own, and
+ * merged into the output by segment_merge_add(), see segment.h. The
+ * bursts come from a clock that the reader runs over the whole trace,
+ * the samplers of the segments only draw the sample gaps. Without
+ * bursts, every segment but the first starts as if the sampler had
+ * been running before, see sampler_start().
+ */
+
+typedef struct {
+    pthread_t        thread;
+    blockq_t         queue;
+    args_t          *args;
+    segment_merge_t *merge;
+    int              failed;
+
+    /* With bursts */
+    segment_clock_t  clock;
+} segment_worker_t;
+
+static unsigned
+segment_seed(unsigned seed, unsigned long idx)
+{
+    return seed ^ (unsigned)(idx * 0x9e3779b9UL);
+}
+
+static segment_t *
+segment_begin(segment_worker_t *w, sampler_t *sampler, block_t *b)
+{
+    unsigned long begin = b->accesses[0].time;
+    segment_t    *seg;
+    int           err;
+
+    seg = segment_new(b->segment, begin, b->continued);
+    if (!seg)
+        return NULL;
+
+    if (sampler_config(sampler, w->args)) {
+        segment_free(seg);
+        return NULL;
+    }
+
+    sampler->seed = segment_seed(w->args->random_seed, b->segment);
+    sampler->sink = segment_sink(seg);
+
+    if (w->args->burst_size) {
+        /* The clock begins and ends the bursts, see segment_ref_bursts() */
+        sampler->burst_size = 0;
+        w->clock = b->clock;
+        err = b->continued ?
+            sampler_burst_resume(sampler, w->clock.sampled, begin) : 0;
+    } else {
+        err = sampler_burst_begin(sampler, begin);
+        if (!err && (b->segment || w->args->begin_time))
+            sampler_start(sampler, begin);
+    }
+
+    if (err) {
+        sampler_discard(sampler);
+        segment_free(seg);
+        return NULL;
+    }
+    return seg;
+}
+
+/* Begin and end the bursts of the segment's sampler by the clock,
+ * before the access is passed to the sampler */
+static inline int
+segment_ref_bursts(segment_worker_t *w, sampler_t *sampler,
+                   unsigned long time, int sampled)
+{
+    int events = segment_clock_ref(&w->clock, time, sampled);
+
+    if ((events & SEGMENT_BURST_END) && sampler_burst_end(sampler, time))
+        return 1;
+    if ((events & SEGMENT_BURST_BEGIN) &&
+        sampler_burst_resume(sampler, 0, time))
+        return 1;
+    return 0;
+}
+
+/* Run the reader's clock over a block. Outside bursts, only the
+ * accesses at the boundaries are looked at, found by their time. */
+static void
+segment_clock_block(segment_clock_t *c, sampler_t *s, accesses_t accesses,
+                    block_t *b)
+{
+    unsigned long i = 0;
+
+    while (i < b->no_accesses) {
+        unsigned long hi = b->no_accesses;
+        usf_access_t *ref;
+
+        /* Skip to the first access at or after the next burst */
+        while (!c->active && i < hi) {
+            unsigned long mid = i + (hi - i) / 2;
+
+            if (b->accesses[mid].time < c->begin)
+                i = mid + 1;
+            else
+                hi = mid;
+        }
+        if (i == b->no_accesses)
+            break;
+
+        ref = &b->accesses[i++];
+        segment_clock_ref(c, ref->time,
+                          access_sampled(accesses, ref) &&
+                          sampler_addr_match(s, ref->addr));
+    }
+}
+
+/* Pass the dangling samples to the segment and hand it over to the
+ * merge */
+static int
+segment_end(segment_worker_t *w, sampler_t *sampler, segment_t *seg)
+{
+    if (sampler_fini(sampler)) {
+        segment_free(seg);
         return 1;
+    }
+    return segment_merge_add(w->merge, seg) ? 1 : 0;
+}
+
+static void *
+segment_worker_main(void *arg)
+{
+    segment_worker_t *w = (segment_worker_t *)arg;
+    sampler_t         sampler;
+    segment_t        *seg = NULL;
+    unsigned long     idx = 0;
+    block_t          *b;
+
+    while ((b = blockq_pop(&w->queue))) {
+        if (seg && b->segment != idx) {
+            if (segment_end(w, &sampler, seg))
+                w->failed = 1;
+            seg = NULL;
+        }
+
+        if (!seg && !w->failed) {
+            idx = b->segment;
+            seg = segment_begin(w, &sampler, b);
+            if (!seg) {
+                fprintf(stderr, "Error initializing sampler: %s\n",
+                        w->args->o_file_name);
+                w->failed = 1;
+            }
+        }
 
-    USF_CHECK_E(usf_open(&usf_i_file, args.i_file_name));
-    USF_CHECK_E(usf_header((const usf_header_t **)&header, usf_i_file));
+        for (unsigned long i = 0; i < b->no_accesses && !w->failed; i++) {
+            usf_access_t *ref = &b->accesses[i];
 
-    if (!(header->flags & USF_FLAG_TRACE)) {
-        fprintf(stderr, "%s: is not a trace file.\n", args.i_file_name);
+            int           sampled;
+
+            sampled = access_sampled(w->args->accesses, ref) &&
+                sampler_addr_match(&sampler, ref->addr);
+            if ((sampled && segment_ref(seg, ref, sampler.line_size_lg2)) ||
+                (w->args->burst_size &&
+                 segment_ref_bursts(w, &sampler, ref->time, sampled)) ||
+                access_ref(&sampler, w->args->accesses, ref)) {
+                fprintf(stderr, "Sampler error: %s\n", w->args->o_file_name);
+                w->failed = 1;
+            }
+        }
+        free(b);
+    }
+
+    if (seg && segment_end(w, &sampler, seg))
+        w->failed = 1;
+    return NULL;
+}
+
+static int
+run_segments(args_t *args, input_t *in)
+{
+    segment_worker_t *workers;
+    segment_merge_t  *merge;
+    sampler_t         proto;
+    segment_clock_t   clock;
+    unsigned long     segment = 0;
+    unsigned long     no_accesses = 0;     /* In the segment */
+    unsigned          no_workers = 0;
+    block_t          *b;
+    int               ret = 0;
+
+    /* The merge writes the output, configured like a single sampler.
+     * The reader's clock takes the bursts and address ranges from it. */
+    if (sampler_config(&proto, args))
+        return 1;
+    merge = segment_merge_new(async_sink_new(sampler_sink_create(&proto,
+                                                                 proto.output)),
+                              !args->burst_size);
+    if (!merge) {
+        fprintf(stderr, "Error creating output: %s\n", args->o_file_name);
+        sampler_discard(&proto);
         return 1;
     }
 
-    if (my_sampler_init(&sampler, &args)) {
-        fprintf(stderr, "Error initializing sampler.\n");
+    workers = calloc(args->segments, sizeof(segment_worker_t));
+    if (!workers) {
+        segment_merge_fini(merge);
+        sampler_discard(&proto);
         return 1;
     }
 
-    do {
-        usf_error_t error;
-        usf_event_t event;
-        
-        error = usf_read(usf_i_file, &event);
-        if (error == USF_ERROR_EOF)
+    for (; no_workers < args->segments; no_workers++) {
+        segment_worker_t *w = &workers[no_workers];
+
+        w->args = args;
+        w->merge = merge;
+        if (blockq_init(&w->queue, QUEUE_SIZE)) {
+            ret = 1;
+            break;
+        }
+
+        if (pthread_create(&w->thread, NULL, segment_worker_main, w)) {
+            blockq_fini(&w->queue);
+            ret = 1;
             break;
-        USF_E(error);
+        }
+    }
 
-        if (event.type != USF_EVENT_TRACE)
-            USF_E(USF_ERROR_FILE);
+    while (!ret) {
+        ret = block_read(in, &b);
+        if (ret || !b)
+            break;
 
-        switch (event.u.trace.access.type) {
-        case USF_ATYPE_RD: case USF_ATYPE_WR: case USF_ATYPE_RW: break;
-        default: continue;
+        b->refs = 1;
+        if (!no_accesses && args->burst_size) {
+            /* The first burst is drawn from the beginning of the
+             * window, or from the first sampled access */
+            if (!segment)
+                segment_clock_init(&clock, proto.burst_period,
+                                   proto.burst_rnd, proto.burst_size,
+                                   proto.seed, args->begin_time ?
+                                   args->begin_time : b->accesses[0].time,
+                                   args->begin_time != 0);
+            b->clock = clock;
+            b->continued = clock.active;
         }
+        if (args->burst_size)
+            segment_clock_block(&clock, &proto, args->accesses, b);
 
-        if (sampler_ref(&sampler, &event.u.trace.access)) {
-            fprintf(stderr, "Sampler error: exiting\n");
-            goto error_out;
+        /* A segment ends with the block that fills it */
+        b->segment = segment;
+        no_accesses += b->no_accesses;
+        if (no_accesses >= args->segment_size) {
+            segment++;
+            no_accesses = 0;
         }
-    } while (1);
-// Clean return
-    sampler_fini(&sampler);
-    USF_CHECK_E(usf_close(usf_i_file));
-    return 0;
+        blockq_push(&workers[b->segment % no_workers].queue, b);
+    }
+
+    for (unsigned i = 0; i < no_workers; i++) {
+        blockq_push(&workers[i].queue, NULL);
+        pthread_join(workers[i].thread, NULL);
+        blockq_fini(&workers[i].queue);
+        if (workers[i].failed)
+            ret = 1;
+    }
+
+    if (segment_merge_fini(merge))
+        ret = 1;
+
+    sampler_discard(&proto);
+    free(workers);
+    return ret;
+}
+
+int
+main(int argc, char **argv)
+{
+    args_t  args;
+    input_t in;
+    int     ret;
+
+    if (parse_args(argc, argv, &args))
+        return 1;
+
+    if (input_open(&in, args.i_file_names, args.no_inputs, args.index_name,
+                   args.begin_time, args.end_time))
+        return 1;
 
-error_out:
-    sampler_fini(&sampler);
-    USF_CHECK_E(usf_close(usf_i_file));
-    return 1;
+    if (args.segments)
+        ret = run_segments(&args, &in);
+    else
+        ret = run_pipeline(&args, &in);
+    if (input_close(&in))
+        ret = 1;
+    return ret;
 }
 
 /*